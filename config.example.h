@@ -42,6 +42,264 @@
  */
 #define BLOG_STRICT_ACCESS 1
 
+/*!
+ * @brief Enable / Disable sharded `BLOG_DIR`
+ *
+ * If enabled, entries may also be stored in subdirectories of `BLOG_DIR`
+ * named after the year and month of their publication, e. g.
+ * `BLOG_DIR/2020/08/my-entry`. The index is assembled from the newest
+ * shard backwards, so large blogs don't need to keep all entries in a
+ * single, slow to read directory. Entries of a newer shard are always
+ * listed before entries of an older one, so the publication time of an
+ * entry in a shard (its modification time or `date` of its front matter)
+ * is clamped to the shard's month in local time: An entry dated before
+ * the month is shown as published at its start, one dated after it at
+ * its end. This also keeps it on the archive page of the shard's month
+ * (see `BLOG_ARCHIVE`). Entries directly in `BLOG_DIR` keep their times,
+ * but are always listed first.
+ *
+ * Optional setting, defaults to `0`.
+ *
+ * @see BLOG_INDEX_MAX_ENTRIES
+ */
+#define BLOG_SHARDED 0
+
+/*!
+ * @brief Maximum number of entries on the index page and in the feeds
+ *
+ * If positive, only the newest `BLOG_INDEX_MAX_ENTRIES` entries are
+ * listed. With `BLOG_SHARDED` enabled, this also means that older
+ * shards don't need to be read at all.
+ *
+ * Optional setting, defaults to `0` which means no limit.
+ */
+#define BLOG_INDEX_MAX_ENTRIES 0
+
+/*!
+ * @brief Enable / Disable Markdown entries
+ *
+ * If enabled, entries are written in Markdown (see markdown.h for the
+ * supported syntax) and converted to HTML. The HTML is stored in
+ * `BLOG_CACHE_DIR` and only converted again once the modification time
+ * (including nanoseconds) or size of the entry changes, so the index and feeds don't need to convert
+ * every entry on every request. Without `BLOG_CACHE_DIR`, entries are
+ * converted every time they are served.
+ *
+ * Optional setting, defaults to `0`.
+ */
+#define BLOG_MARKDOWN 0
+
+/*!
+ * @brief Enable / Disable front matter in entries
+ *
+ * If enabled, entries may start with a block of `key: value` lines between
+ * two lines consisting of `---` which sets their `title`, publication
+ * `date` (used instead of the modification time, so renaming or touching
+ * an entry doesn't move it, but see `BLOG_SHARDED`), `tags` and `summary`,
+ * see entry.h for the details. It is stored in the index, so the index and
+ * feeds don't need to read any entry just for it. To build the index, every
+ * new or changed entry's file needs to be opened, so `BLOG_CACHE_DIR` is
+ * recommended.
+ *
+ * The index of a directory is only rebuilt once the directory's own
+ * modification time changes (see `BLOG_CACHE_DIR`), which editing an entry
+ * in place doesn't do. Until the directory is touched, the index page,
+ * feeds, sitemap and tag and archive pages keep showing the old front
+ * matter of an edited entry while its own page already shows the new one.
+ * Writing the new version to a temporary file and renaming it over the
+ * entry (as many editors do) changes the directory as well.
+ *
+ * Optional setting, defaults to `0`.
+ */
+#define BLOG_FRONT_MATTER 0
+
+/*!
+ * @brief Maximum size of the excerpts shown on the index page and in the feeds
+ *
+ * If positive, the index page and feeds only show an excerpt of every
+ * entry instead of its whole text: It ends at a `<!--more-->` marker
+ * within the first `BLOG_EXCERPT` bytes or is cut at a safe boundary
+ * (between elements or words for HTML, blocks or lines for Markdown)
+ * before that, see entry.h for the details. The excerpts are stored in the
+ * index, so the entries' files aren't read to render the index page or
+ * feeds. Entries without a safe boundary are shown completely.
+ *
+ * Optional setting, defaults to `0` which shows the whole text.
+ */
+#define BLOG_EXCERPT 0
+
+/*!
+ * @brief Enable / Disable full text search
+ *
+ * If enabled, `PATH_INFO` `/search` lists all entries containing every
+ * word of the `q` query parameter like the index page, newest first. It
+ * uses an inverted index (see search.h) which is stored in `BLOG_CACHE_DIR`
+ * and mapped for every search, so a search only reads the lists of entries
+ * containing the words searched for. Whenever entries are added, removed or
+ * modified, only those entries are read to update it. Without
+ * `BLOG_CACHE_DIR`, every entry is read for the first search of a process.
+ *
+ * Optional setting, defaults to `0`.
+ */
+#define BLOG_SEARCH 0
+
+/*!
+ * @brief Enable / Disable tag and archive pages
+ *
+ * If enabled, `PATH_INFO` `/tag/<tag>` lists all entries with the given tag
+ * (see `BLOG_FRONT_MATTER`) and `/archive/yyyy/mm` all entries published in
+ * the given month like the index page, newest first. The entries of every
+ * tag and month are stored in the same file as the search index (see
+ * `BLOG_SEARCH`) which is updated from the index whenever entries change.
+ * Whether it is current is checked per index segment, not per entry, so
+ * listing them only costs reading the entries listed.
+ *
+ * Optional setting, defaults to `0`.
+ */
+#define BLOG_ARCHIVE 0
+
+/*
+ * Directory sternenblog may use to store index caches, the search index
+ * and the HTML of Markdown entries in. It must be writeable by the webserver's user.
+ * Every directory read to build the index gets its own cache which is
+ * reused until the modification time of the directory changes. Note that
+ * editing or touching an entry in place doesn't change it, so touch the
+ * directory afterwards in such a case.
+ *
+ * Optional setting, caching is disabled if unset.
+ */
+// #define BLOG_CACHE_DIR "/var/cache/sternenblog/"
+
+/*
+ * Name of a POSIX shared memory object (see shm_overview(7)) used to share
+ * index segments between all processes of sternenblog, e. g. concurrently
+ * running CGI scripts or the worker processes of the builtin server. The
+ * first process finding a directory changed reads it while the others wait
+ * for it and then map its result read-only, so the index exists only once
+ * in memory and is read only once regardless of the number of processes.
+ * Every shard's segment is stored in an object named after this one with
+ * the shard and a generation number appended. The name must start with a
+ * slash and not contain any further slashes.
+ *
+ * Optional setting, the index isn't shared if unset.
+ */
+// #define BLOG_SHARED_INDEX "/sternenblog"
+
+//! @}
+
+/*!
+ * @name Diagnostics
+ * @{
+ */
+
+/*!
+ * @brief Measure where time is spent handling requests
+ *
+ * If set, sternenblog measures wall clock and CPU time of the stages of
+ * handling a request (routing, building the index, sorting, searching,
+ * mapping entry texts, rendering and flushing the output). The value
+ * determines how the results are reported:
+ *
+ * * `1`: `Server-Timing` header (only stages completed before the
+ *   headers are sent, i. e. routing, index, sorting and searching)
+ * * `2`: a single line of `key=value` pairs per request on `stderr`
+ *   which usually ends up in the webserver's error log
+ * * `3`: both
+ *
+ * Optional setting, `0` or unset disables timing.
+ */
+#define BLOG_TIMING 0
+
+/*
+ * PATH_INFO at which sternenblog exposes counters about handled requests,
+ * their latency, index builds, index cache hits and misses, requests for
+ * missing entries answered using the index and entries served in the
+ * Prometheus text format. The counters only cover the
+ * process serving the request, so they are only useful if sternenblog
+ * is running persistently and not spawned per request as a CGI script.
+ * Restrict access to it in the webserver configuration if necessary.
+ *
+ * Optional setting, the endpoint is disabled if unset.
+ */
+// #define BLOG_METRICS_PATH "/metrics"
+
+//! @}
+
+/*!
+ * @name Server Settings
+ *
+ * Only relevant if `sternenblog.cgi` is run as a server instead
+ * of as a CGI script, see server.h.
+ *
+ * @{
+ */
+
+/*!
+ * @brief Number of worker threads of the builtin server
+ *
+ * Optional setting, defaults to `0` which means one
+ * worker per online CPU core.
+ */
+#define BLOG_SERVER_THREADS 0
+
+/*!
+ * @brief Number of worker processes of the builtin server
+ *
+ * If positive, the server runs as a supervisor which forks the given
+ * number of worker processes sharing the listening socket and restarts
+ * them if they exit. Sending `SIGHUP` to the supervisor replaces all
+ * workers gracefully, i. e. in-flight requests are finished by the old
+ * workers while new ones already accept connections. Since each worker
+ * starts with an empty index, this reloads the index.
+ *
+ * If `BLOG_SERVER_THREADS` is `0`, the online CPU cores are divided
+ * among the worker processes.
+ *
+ * Optional setting, defaults to `0` which means a single process
+ * without a supervisor.
+ */
+#define BLOG_SERVER_PROCESSES 0
+
+/*!
+ * @brief Number of requests after which a worker process is replaced
+ *
+ * Only used if `BLOG_SERVER_PROCESSES` is positive.
+ *
+ * Optional setting, defaults to `0` which means no limit.
+ */
+#define BLOG_SERVER_MAX_REQUESTS 0
+
+/*!
+ * @brief Maximum resident set size in KiB before a worker process is replaced
+ *
+ * Only used if `BLOG_SERVER_PROCESSES` is positive.
+ *
+ * Optional setting, defaults to `0` which means no limit.
+ */
+#define BLOG_SERVER_MAX_RSS 0
+
+/*!
+ * @brief Pin worker threads to CPU cores
+ *
+ * If `1`, every worker thread of the builtin server is pinned to its
+ * own CPU core (as far as there are enough), which avoids threads
+ * migrating between cores and losing their caches.
+ *
+ * Optional setting, defaults to `0`.
+ */
+#define BLOG_SERVER_CPU_AFFINITY 0
+
+/*
+ * Directory the builtin server serves static files like the CSS and
+ * favicon from. Only files directly in this directory are served,
+ * i. e. `/sternenblog.css` would be served from
+ * `BLOG_SERVER_ASSET_DIR/sternenblog.css`. They take precedence
+ * over entries of the same name.
+ *
+ * Optional setting, no assets are served if unset.
+ */
+// #define BLOG_SERVER_ASSET_DIR "/usr/local/share/sternenblog"
+
 //! @}
 
 /*!
@@ -14,7 +14,9 @@ CP = cp
 CONVERT = convert
 
 CC = gcc
-CFLAGS = -Wall -pedantic --std=c99 -Os
+CFLAGS = -Wall -pedantic --std=c11 -Os
+# the builtin server uses POSIX threads
+LIBS = -pthread
 
 # debugging
-# CFLAGS = -Wall -pedantic --std=c99 -ggdb -Og
+# CFLAGS = -Wall -pedantic --std=c11 -ggdb -Og
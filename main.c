@@ -75,6 +75,7 @@
  */
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <dirent.h>
@@ -92,23 +93,96 @@
 #include "sternenblog/cgiutil.h"
 #include "sternenblog/entry.h"
 #include "sternenblog/index.h"
+#include "sternenblog/json.h"
+#include "sternenblog/markdown.h"
+#include "sternenblog/metrics.h"
+#include "sternenblog/search.h"
+#include "sternenblog/server.h"
 #include "sternenblog/stringutil.h"
 #include "sternenblog/timeutil.h"
 #include "sternenblog/template.h"
+#include "sternenblog/timing.h"
 #include "sternenblog/xml.h"
 
+#ifndef BLOG_INDEX_MAX_ENTRIES
+#define BLOG_INDEX_MAX_ENTRIES 0
+#endif
+
+#ifndef BLOG_EXCERPT
+#define BLOG_EXCERPT 0
+#endif
+
+#ifndef BLOG_SEARCH
+#define BLOG_SEARCH 0
+#endif
+
+#ifndef BLOG_ARCHIVE
+#define BLOG_ARCHIVE 0
+#endif
+
 /*!
  * @brief Routing enum to differentiate feeds
  *
  * Used in routing to differentiate between
  *
- * * Feeds (RSS vs. Atom)
+ * * Feeds (RSS vs. Atom vs. JSON Feed)
+ * * Sitemaps (a list of URLs vs. an index of sitemaps)
  * * Feeds and non-feeds (feeds are a special type of `PAGE_TYPE_INDEX`)
  */
 enum feed_type {
     FEED_TYPE_NONE,
     FEED_TYPE_RSS,
-    FEED_TYPE_ATOM
+    FEED_TYPE_ATOM,
+    FEED_TYPE_JSON,
+    FEED_TYPE_SITEMAP,
+    FEED_TYPE_SITEMAP_INDEX
+};
+
+/*!
+ * @brief Maximum number of URLs in a single sitemap
+ *
+ * Limit imposed by the sitemap protocol,
+ * see https://www.sitemaps.org/protocol.html.
+ */
+#define SITEMAP_MAX_URLS 50000
+
+/*!
+ * @brief Size of a buffer large enough for the name of any sitemap
+ *
+ * @see sitemap_part_name
+ */
+#define MAX_SITEMAP_NAME_SIZE 32
+
+/*!
+ * @brief Part of the index listed by a single sitemap
+ *
+ * Every segment of the index gets its own sitemaps, so a sitemap only
+ * changes if the directory of its segment does. Segments with more than
+ * `SITEMAP_MAX_URLS` entries are split into pages counting from their
+ * oldest entry, so only the newest page changes as entries are added.
+ *
+ * @see sitemap_next_part
+ */
+struct sitemap_part {
+    size_t segment; //!< position of the segment in `index->segments`
+    size_t offset;  //!< position of the segment's first entry in the index
+    size_t page;    //!< number of the page within the segment, 1 for its oldest entries
+    size_t first;   //!< position of the part's first entry in the index
+    size_t count;   //!< number of entries in the part
+};
+
+/*!
+ * @brief Routing enum to differentiate listings
+ *
+ * Used in routing to differentiate between pages of type
+ * `PAGE_TYPE_INDEX` listing all entries and those only listing
+ * the entries found using the search index, see search.h.
+ */
+enum listing_type {
+    LISTING_TYPE_ALL,
+    LISTING_TYPE_SEARCH,
+    LISTING_TYPE_TAG,
+    LISTING_TYPE_ARCHIVE
 };
 
 /*!
@@ -118,7 +192,7 @@ enum feed_type {
  * values and a `Cache-Control` header if applicable before
  * calling `terminate_headers()`.
  */
-void send_standard_headers(int status, char content_type[]);
+void send_standard_headers(FILE *out, int status, char content_type[]);
 
 /*!
  * @brief Outputs the CGI response for the blog's RSS feed
@@ -128,7 +202,7 @@ void send_standard_headers(int status, char content_type[]);
  * @see make_index
  * @see blog_atom
  */
-void blog_rss(char script_name[], struct entry *entries, int count);
+void blog_rss(struct request *req, struct index *index);
 
 /*!
  * @brief Outputs the CGI response for the blog's Atom feed
@@ -138,26 +212,277 @@ void blog_rss(char script_name[], struct entry *entries, int count);
  * @see make_index
  * @see blog_rss
  */
-void blog_atom(char script_name[], struct entry *entries, int count);
+void blog_atom(struct request *req, struct index *index);
+
+/*!
+ * @brief Outputs the CGI response for the blog's JSON Feed
+ *
+ * This function is called if `PATH_INFO` is `/feed.json`.
+ * The feed follows version 1.1 of https://jsonfeed.org.
+ *
+ * @see make_index
+ * @see blog_rss
+ */
+void blog_json(struct request *req, struct index *index);
+
+/*!
+ * @brief Outputs the CGI response for a sitemap
+ *
+ * This function is called if `PATH_INFO` is `/sitemap.xml` or a sitemap
+ * below `/sitemap/` and outputs a list of the URLs of the entries of
+ * `part` (`FEED_TYPE_SITEMAP`) or an index of all sitemaps of the blog
+ * (`FEED_TYPE_SITEMAP_INDEX`), see `blog_sitemap_part()`.
+ *
+ * @see make_index
+ */
+void blog_sitemap(struct request *req, struct index *index, enum feed_type type,
+                  const struct sitemap_part *part);
+
+/*!
+ * @brief Looks up the sitemap to serve for a request
+ *
+ * `/sitemap.xml` is the list of URLs of all entries if they fit in a single
+ * sitemap, an index of the sitemaps of all parts otherwise. The sitemap of a
+ * part is served at `/sitemap/<name>.xml`, see `sitemap_part_name()`.
+ *
+ * @param req request for `/sitemap.xml` or a path below `/sitemap/`
+ * @param index complete index of the blog
+ * @param type set to the type of sitemap to serve
+ * @param part set to the part to list for `FEED_TYPE_SITEMAP`
+ * @return 0 on success, -1 if there is no such sitemap
+ */
+int blog_sitemap_part(const struct request *req, const struct index *index,
+                      enum feed_type *type, struct sitemap_part *part);
+
+/*!
+ * @brief Iterate the parts of the index listed by a sitemap each
+ *
+ * Parts are returned newest first.
+ *
+ * @param index complete index of the blog
+ * @param part zero initialized before the first call, set to the next part
+ * @return true if there is another part, false otherwise
+ */
+bool sitemap_next_part(const struct index *index, struct sitemap_part *part);
+
+/*!
+ * @brief Name of the sitemap of a part
+ *
+ * Parts are named after the shard of their segment (`latest` for `BLOG_DIR`
+ * itself) with `-<page>` appended for all but the first page, e. g.
+ * `latest`, `2020/08` or `2020/08-2`.
+ *
+ * @return length of the name or 0 if it didn't fit into `buf`
+ */
+size_t sitemap_part_name(const struct index *index, const struct sitemap_part *part,
+                         char *buf, size_t size);
+
+/*!
+ * @brief Constructs the next entry to output in a feed
+ *
+ * Shared by all feeds: Starting at position `*i`, constructs the entries of
+ * `index` using `index_get_entry()` and `blog_index_text()`, skipping those
+ * that fail, while prefetching the following ones. `*i` is set to the
+ * position of the entry constructed which must be passed to
+ * `entry_unget_text()` and `free_entry()` after it has been output.
+ *
+ * @return true if an entry was constructed, false at the end of the index
+ */
+bool feed_next_entry(const struct index *index, size_t *i, char *script_name, struct entry *entry);
+
+/*!
+ * @brief Populate the text of an entry listed on the index page or in a feed
+ *
+ * Uses the excerpt stored in the index if `BLOG_EXCERPT` is enabled and
+ * the entry has one, so its file isn't read, else `entry_get_text()`.
+ *
+ * @return 0 on success, -1 on error
+ * @see index_get_excerpt
+ */
+int blog_index_text(const struct index *index, size_t i, struct entry *entry);
+
+/*!
+ * @brief Looks up the entries to list for a search, tag or archive page
+ *
+ * Brings the search index up to date with `index` which must be complete
+ * and looks up the `q` parameter of `QUERY_STRING` using `search_query()`
+ * for `/search` or the tag of `/tag/<tag>` or month of `/archive/yyyy/mm`
+ * using `search_key()`. A missing or empty query and a malformed month
+ * match no entries.
+ *
+ * @param req request to look up the entries for
+ * @param listing type of the page, not `LISTING_TYPE_ALL`
+ * @param index complete index of the blog
+ * @param results location to store the matching positions in `index` at
+ * @return number of matching entries or -1 on error
+ */
+ssize_t blog_listing(const struct request *req, enum listing_type listing,
+                     const struct index *index, size_t **results);
+
+/*!
+ * @brief Outputs a category element for every tag of an entry
+ *
+ * Uses `<category>tag</category>` for RSS and
+ * `<category term="tag"/>` for Atom.
+ */
+void feed_categories(struct xml_context *ctx, const struct entry *entry, enum feed_type type);
+
+/*!
+ * @brief Outputs the body of an error page
+ *
+ * Error pages only depend on the status, `SCRIPT_NAME` and the
+ * configuration, so every one is rendered using the template once per
+ * thread into `error_pages` and copied from there afterwards. This way
+ * floods of requests for missing entries or malformed paths are cheap.
+ * A CGI process only serves a single request, so nothing is stored
+ * unless `serving` is set.
+ *
+ * @param data template data of the `PAGE_TYPE_ERROR` page
+ * @return 0 on success, -1 if the page couldn't be rendered or
+ *         stored or isn't worth storing in which case it must be
+ *         rendered as usual
+ * @see index_missing
+ */
+int blog_error_page(struct template_data data);
+
+#ifdef BLOG_METRICS_PATH
+/*!
+ * @brief Outputs the CGI response for the metrics endpoint
+ *
+ * This function is called if `PATH_INFO` is `BLOG_METRICS_PATH`.
+ *
+ * @see metrics_write
+ */
+void blog_metrics(FILE *out);
+#endif
+
+/*!
+ * @brief Index of the blog
+ *
+ * Kept between requests, so a persistently running process only
+ * needs to reread directories that have changed, see `update_index()`.
+ * Every thread keeps its own, so requests can be served concurrently.
+ */
+static _Thread_local struct index warm_index;
+
+/*!
+ * @brief Search index of the blog
+ *
+ * Kept between requests like `warm_index`, see `update_search_index()`.
+ */
+static _Thread_local struct search_index warm_search;
+
+/*!
+ * @brief Pre-rendered error page
+ *
+ * @see blog_error_page
+ */
+struct error_page {
+    int status;        //!< HTTP status of the page, 0 if the slot is unused
+    char *script_name; //!< `SCRIPT_NAME` the page was rendered for
+    char *body;        //!< HTML of the page
+    size_t len;        //!< length of `body`
+};
+
+/*!
+ * @brief Number of error pages kept per thread
+ *
+ * Enough for all statuses sternenblog responds with, i. e.
+ * 400, 403, 404, 500 and the odd `http_errno()` result.
+ */
+#define ERROR_PAGE_SLOTS 8
+
+/*!
+ * @brief Error pages of the current thread
+ */
+static _Thread_local struct error_page error_pages[ERROR_PAGE_SLOTS];
+
+/*!
+ * @brief Whether requests are served by `serve()` instead of a single CGI request
+ *
+ * Set before any thread is started and never changed afterwards.
+ */
+static bool serving = false;
 
 /*!
  * @brief Implements routing of requests
  *
- * @see blog_index
+ * Serves a single request, writing a CGI response
+ * (headers followed by the body) to `req->out`.
+ *
+ * Multiple requests may be served concurrently
+ * as long as every one is served by a single thread.
+ *
+ * @param req request to serve
+ * @return HTTP status of the response
  * @see blog_rss
- * @see blog_entry
+ * @see blog_atom
+ */
+int blog_respond(struct request *req);
+
+/*!
+ * @brief Entry point of `sternenblog.cgi`
+ *
+ * Serves a single CGI request using `blog_respond()`. If it is not invoked as
+ * a CGI script, i. e. `GATEWAY_INTERFACE` is not set, but with command line
+ * arguments, it runs a server for the protocol given as the first argument
+ * instead, see `serve()`.
  */
-int main(void) {
-    char *path_info = getenv("PATH_INFO");
-    char *script_name = getenv("SCRIPT_NAME");
+int main(int argc, char *argv[]) {
+    if(argc > 1 && getenv("GATEWAY_INTERFACE") == NULL) {
+        serving = true;
+        return serve(argc - 1, argv + 1, blog_respond) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    struct request req;
+    req.out = stdout;
+    req.script_name = getenv("SCRIPT_NAME");
+    req.path_info = getenv("PATH_INFO");
+    req.query_string = getenv("QUERY_STRING");
+    req.server_name = getenv("SERVER_NAME");
+    req.server_port = getenv("SERVER_PORT");
+    req.template_state = NULL;
+
+    blog_respond(&req);
+
+    return EXIT_SUCCESS;
+}
+
+int blog_respond(struct request *req) {
+    FILE *out = req->out;
+    char *script_name = req->script_name;
+    char *path_info = req->path_info;
 
     enum page_type page_type;
     enum feed_type is_feed = FEED_TYPE_NONE;
-
-    struct entry *entries = NULL;
-    int count = 0;
+    enum listing_type listing = LISTING_TYPE_ALL;
+
+    struct index *index = &warm_index;
+    // positions of the entries to list, all of the index if NULL
+    size_t *results = NULL;
+    size_t listed = 0;
+    // part of the index listed by FEED_TYPE_SITEMAP
+    struct sitemap_part sitemap;
+    struct entry entry;
+    bool have_entry = false;
     int status = 500;
 
+#ifdef BLOG_METRICS_PATH
+    if(path_info != NULL && strcmp(path_info, BLOG_METRICS_PATH) == 0) {
+        blog_metrics(out);
+        return 200;
+    }
+#endif
+
+    struct timespec request_start;
+    clock_gettime(CLOCK_MONOTONIC, &request_start);
+
+#ifdef BLOG_TIMING
+    timing_init(BLOG_TIMING);
+#endif
+
+    timing_start(TIMING_STAGE_ROUTE);
+
     // Routing: determine page_type and feed_type
     // already allocate data for single entries
     if(script_name == NULL) {
@@ -165,7 +490,7 @@ int main(void) {
         page_type = PAGE_TYPE_ERROR;
     } else if(path_info == NULL || path_info[0] == '\0' || strcmp(path_info, "/") == 0) {
         // make sure clean URLs are generated
-        setenv("PATH_INFO", "/", 1);
+        path_info = "/";
 
         page_type = PAGE_TYPE_INDEX;
     } else if(strcmp(path_info, "/rss.xml") == 0) {
@@ -174,36 +499,82 @@ int main(void) {
     } else if(strcmp(path_info, "/atom.xml") == 0) {
         page_type = PAGE_TYPE_INDEX;
         is_feed = FEED_TYPE_ATOM;
+    } else if(strcmp(path_info, "/feed.json") == 0) {
+        page_type = PAGE_TYPE_INDEX;
+        is_feed = FEED_TYPE_JSON;
+    } else if(strcmp(path_info, "/sitemap.xml") == 0 || strncmp(path_info, "/sitemap/", 9) == 0) {
+        page_type = PAGE_TYPE_INDEX;
+        // the exact type is determined by blog_sitemap_part()
+        is_feed = FEED_TYPE_SITEMAP;
+    } else if(BLOG_SEARCH && strcmp(path_info, "/search") == 0) {
+        page_type = PAGE_TYPE_INDEX;
+        listing = LISTING_TYPE_SEARCH;
+    } else if(BLOG_ARCHIVE && strncmp(path_info, "/tag/", 5) == 0) {
+        page_type = PAGE_TYPE_INDEX;
+        listing = LISTING_TYPE_TAG;
+    } else if(BLOG_ARCHIVE && strncmp(path_info, "/archive/", 9) == 0) {
+        page_type = PAGE_TYPE_INDEX;
+        listing = LISTING_TYPE_ARCHIVE;
+    } else if(index_missing(index, BLOG_DIR, path_info)) {
+        // uses the index kept from a previous request or the index cache
+        page_type = PAGE_TYPE_ERROR;
+        status = 404;
     } else {
-        // single entry is just a special index
-        entries = malloc(sizeof(struct entry));
-        if(entries == NULL) {
-            status = 500;
-        } else {
-            status = make_entry(BLOG_DIR, script_name, path_info, entries);
-        }
+        status = make_entry(BLOG_DIR, script_name, path_info, &entry);
+        have_entry = true;
 
-        if(status == 200 && entry_get_text(entries) != -1) {
+        if(status == 200 && entry_get_text(&entry) != -1) {
             page_type = PAGE_TYPE_ENTRY;
-            count = 1;
         } else {
             page_type = PAGE_TYPE_ERROR;
         }
     }
 
+    timing_stop(TIMING_STAGE_ROUTE);
+
     // confirm index is allocated if we are serving a feed
     assert(is_feed == FEED_TYPE_NONE || page_type == PAGE_TYPE_INDEX);
 
     // construct index for feeds and index page
     if(page_type == PAGE_TYPE_INDEX) {
-        count = make_index(BLOG_DIR, script_name, 0, &entries);
+        // other listings and sitemaps may contain any entry, so the index needs to be complete
+        int max_count = listing == LISTING_TYPE_ALL && is_feed != FEED_TYPE_SITEMAP
+            ? BLOG_INDEX_MAX_ENTRIES : 0;
+
+        timing_start(TIMING_STAGE_INDEX);
+        ssize_t index_result = update_index(BLOG_DIR, max_count, index);
+        timing_stop(TIMING_STAGE_INDEX);
+
+        if(index_result >= 0 && listing != LISTING_TYPE_ALL) {
+            timing_start(TIMING_STAGE_SEARCH);
+            index_result = blog_listing(req, listing, index, &results);
+            timing_stop(TIMING_STAGE_SEARCH);
+        }
 
-        if(count < 0) {
+        if(index_result < 0) {
             page_type = PAGE_TYPE_ERROR;
             status = 500;
+        } else if(is_feed == FEED_TYPE_SITEMAP && blog_sitemap_part(req, index, &is_feed, &sitemap) == -1) {
+            page_type = PAGE_TYPE_ERROR;
+            status = 404;
+        } else if(index_result == 0 && (listing == LISTING_TYPE_TAG || listing == LISTING_TYPE_ARCHIVE)) {
+            // tags and months without entries don't exist
+            page_type = PAGE_TYPE_ERROR;
+            status = 404;
         } else {
             page_type = PAGE_TYPE_INDEX;
             status = 200;
+            listed = index_result;
+
+            // template_header() gets the first entry listed
+            if(is_feed == FEED_TYPE_NONE && listed > 0) {
+                have_entry = true;
+                if(index_get_entry(index, results == NULL ? 0 : results[0],
+                                   BLOG_DIR, script_name, &entry) != 200) {
+                    page_type = PAGE_TYPE_ERROR;
+                    status = 500;
+                }
+            }
         }
     }
 
@@ -221,64 +592,104 @@ int main(void) {
     } else {
         data.path_info = path_info;
     }
+    data.request = req;
 
     // confirm that we have SCRIPT_NAME and PATH_INFO unless an error occurred
     assert(data.page_type == PAGE_TYPE_ERROR ||
            (data.path_info != NULL && data.script_name != NULL));
 
     // make sure that PAGE_TYPE_ENTRY will have an entry set in template_header
-    if(count > 0) {
-        data.entry = entries;
+    if(page_type != PAGE_TYPE_ERROR && have_entry) {
+        data.entry = &entry;
     } else {
         data.entry = NULL;
     }
     assert(page_type != PAGE_TYPE_ENTRY || data.entry != NULL);
 
     // render response
+    timing_start(TIMING_STAGE_RENDER);
+
     if(page_type == PAGE_TYPE_ERROR) {
-        send_standard_headers(status, "text/html");
+        send_standard_headers(out, status, "text/html");
+
+        if(blog_error_page(data) == -1) {
+            template_header(data);
+            template_main(data);
+            template_footer(data);
+        }
+    } else if(page_type == PAGE_TYPE_ENTRY) {
+        send_standard_headers(out, 200, "text/html");
 
         template_header(data);
         template_main(data);
         template_footer(data);
     } else if(is_feed == FEED_TYPE_NONE) {
-        // either PAGE_TYPE_INDEX or PAGE_TYPE_ENTRY
-        send_standard_headers(200, "text/html");
+        send_standard_headers(out, 200, "text/html");
 
         template_header(data);
 
-        // confirm that PAGE_TYPE_ENTRY → count == 1
-        assert(page_type != PAGE_TYPE_ENTRY || count == 1);
+        for(size_t n = 0; n < listed; n++) {
+            size_t i = results == NULL ? n : results[n];
+
+            // search results are too far apart to benefit from prefetching
+            if(results == NULL) {
+                index_prefetch(index, i, BLOG_DIR);
+            }
 
-        for(int i = 0; i < count; i++) {
-            if(entries[i].text != NULL || entry_get_text(&entries[i]) != -1) {
-                data.entry = &entries[i];
-                assert(data.entry != NULL);
+            // the first entry has already been constructed for template_header()
+            if(n > 0) {
+                free_entry(&entry);
+                if(index_get_entry(index, i, BLOG_DIR, script_name, &entry) != 200) {
+                    continue;
+                }
+            }
 
+            if(blog_index_text(index, i, &entry) != -1) {
                 template_main(data);
 
-                entry_unget_text(&entries[i]);
+                entry_unget_text(&entry);
             }
         }
 
+        entry_prefetch_clear();
+
         template_footer(data);
     } else if(is_feed == FEED_TYPE_RSS) {
-        blog_rss(script_name, entries, count);
+        blog_rss(req, index);
     } else if(is_feed == FEED_TYPE_ATOM) {
-        blog_atom(script_name, entries, count);
+        blog_atom(req, index);
+    } else if(is_feed == FEED_TYPE_JSON) {
+        blog_json(req, index);
+    } else if(is_feed == FEED_TYPE_SITEMAP || is_feed == FEED_TYPE_SITEMAP_INDEX) {
+        blog_sitemap(req, index, is_feed, &sitemap);
     }
 
+    timing_stop(TIMING_STAGE_RENDER);
+
+    timing_start(TIMING_STAGE_FLUSH);
+    fflush(out);
+    timing_stop(TIMING_STAGE_FLUSH);
+
+    timing_log(stderr, path_info, status);
+
+    struct timespec request_end;
+    clock_gettime(CLOCK_MONOTONIC, &request_end);
+    metrics_request(page_type, status, (request_end.tv_sec - request_start.tv_sec) +
+                                       (request_end.tv_nsec - request_start.tv_nsec) / 1e9);
+
     // clean up
-    if(entries != NULL) {
-        free_index(&entries, count);
+    if(have_entry) {
+        free_entry(&entry);
     }
 
-    return EXIT_SUCCESS;
+    free(results);
+
+    return status;
 }
 
-void send_standard_headers(int status, char content_type[]) {
-    send_header("Status", http_status_line(status));
-    send_header("Content-type", content_type);
+void send_standard_headers(FILE *out, int status, char content_type[]) {
+    send_header(out, "Status", http_status_line(status));
+    send_header(out, "Content-type", content_type);
 
 #ifdef BLOG_CACHE_MAX_AGE
     // TODO correct sized buffer, no snprintf
@@ -289,18 +700,184 @@ void send_standard_headers(int status, char content_type[]) {
     max_age[sizeof max_age - 1] = '\0';
 
     if(result > 0) {
-        send_header("Cache-Control", max_age);
+        send_header(out, "Cache-Control", max_age);
+    }
+#endif
+
+    char server_timing[MAX_TIMING_HEADER_SIZE];
+
+    if(timing_header(server_timing, sizeof server_timing) > 0) {
+        send_header(out, "Server-Timing", server_timing);
+    }
+
+    terminate_headers(out);
+}
+
+int blog_error_page(struct template_data data) {
+    if(!serving || data.script_name == NULL) {
+        return -1;
+    }
+
+    struct error_page *page = NULL;
+
+    for(size_t i = 0; i < ERROR_PAGE_SLOTS && page == NULL; i++) {
+        if(error_pages[i].status == data.status) {
+            page = error_pages + i;
+        }
+    }
+
+    for(size_t i = 0; i < ERROR_PAGE_SLOTS && page == NULL; i++) {
+        if(error_pages[i].status == 0) {
+            page = error_pages + i;
+        }
+    }
+
+    if(page == NULL) {
+        return -1;
+    }
+
+    if(page->status == 0 || strcmp(page->script_name, data.script_name) != 0) {
+        free(page->script_name);
+        free(page->body);
+        page->status = 0;
+        page->script_name = NULL;
+        page->body = NULL;
+
+        struct request req = *data.request;
+        req.template_state = NULL;
+        req.out = open_memstream(&page->body, &page->len);
+
+        if(req.out == NULL) {
+            return -1;
+        }
+
+        struct template_data render = data;
+        render.request = &req;
+
+        template_header(render);
+        template_main(render);
+        template_footer(render);
+
+        page->script_name = strdup(data.script_name);
+
+        if(fclose(req.out) != 0 || page->body == NULL || page->script_name == NULL) {
+            free(page->script_name);
+            free(page->body);
+            page->script_name = NULL;
+            page->body = NULL;
+            return -1;
+        }
+
+        page->status = data.status;
     }
+
+    fwrite(page->body, 1, page->len, data.request->out);
+
+    return 0;
+}
+
+#ifdef BLOG_METRICS_PATH
+void blog_metrics(FILE *out) {
+    send_header(out, "Status", http_status_line(200));
+    send_header(out, "Content-type", "text/plain; version=0.0.4");
+    // metrics are outdated as soon as they have been sent
+    send_header(out, "Cache-Control", "no-store");
+    terminate_headers(out);
+
+    metrics_write(out);
+    fflush(out);
+}
 #endif
 
-    terminate_headers();
+ssize_t blog_listing(const struct request *req, enum listing_type listing,
+                     const struct index *index, size_t **results) {
+    *results = NULL;
+
+    if(update_search_index(index, BLOG_DIR, &warm_search) == -1) {
+        return -1;
+    }
+
+    if(listing == LISTING_TYPE_TAG) {
+        return search_key(&warm_search, SEARCH_KEY_TAG, req->path_info + strlen("/tag/"), results);
+    } else if(listing == LISTING_TYPE_ARCHIVE) {
+        const char *month = req->path_info + strlen("/archive/");
+
+        // only yyyy/mm, like ARCHIVE_TIME_FORMAT
+        if(strlen(month) != 7 || strspn(month, "0123456789") != 4 || month[4] != '/' ||
+           strspn(month + 5, "0123456789") != 2) {
+            return 0;
+        }
+
+        return search_key(&warm_search, SEARCH_KEY_ARCHIVE, month, results);
+    }
+
+    char *query = query_param(req->query_string, "q");
+
+    if(query == NULL) {
+        return 0;
+    }
+
+    ssize_t count = search_query(&warm_search, query, results);
+
+    free(query);
+
+    return count;
+}
+
+int blog_index_text(const struct index *index, size_t i, struct entry *entry) {
+    if(BLOG_EXCERPT > 0 && index_get_excerpt(index, i, entry) == 0) {
+        return 0;
+    }
+
+    return entry_get_text(entry);
+}
+
+bool feed_next_entry(const struct index *index, size_t *i, char *script_name, struct entry *entry) {
+    for(; *i < index->count; (*i)++) {
+        index_prefetch(index, *i, BLOG_DIR);
+
+        if(index_get_entry(index, *i, BLOG_DIR, script_name, entry) == 200 &&
+           blog_index_text(index, *i, entry) != -1) {
+            return true;
+        }
+
+        free_entry(entry);
+    }
+
+    entry_prefetch_clear();
+
+    return false;
+}
+
+void feed_categories(struct xml_context *ctx, const struct entry *entry, enum feed_type type) {
+    const char *tags = entry->tags;
+    const char *tag;
+    size_t len;
+
+    while((tag = entry_next_tag(&tags, &len)) != NULL) {
+        char term[len + 1];
+
+        memcpy(term, tag, len);
+        term[len] = '\0';
+
+        if(type == FEED_TYPE_ATOM) {
+            xml_empty_tag(ctx, "category", 1, "term", term);
+        } else {
+            xml_open_tag(ctx, "category");
+            xml_escaped(ctx, term);
+            xml_close_tag(ctx, "category");
+        }
+    }
 }
 
-void blog_rss(char script_name[], struct entry *entries, int count) {
-    send_standard_headers(200, "application/rss+xml");
+void blog_rss(struct request *req, struct index *index) {
+    char *script_name = req->script_name;
+
+    send_standard_headers(req->out, 200, "application/rss+xml");
 
     struct xml_context ctx;
     new_xml_context(&ctx);
+    ctx.out = req->out;
 
     xml_raw(&ctx, "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>");
     xml_open_tag_attrs(&ctx, "rss", 2, "version", "2.0", "xmlns:atom", "http://www.w3.org/2005/Atom");
@@ -316,7 +893,7 @@ void blog_rss(char script_name[], struct entry *entries, int count) {
     xml_close_cdata(&ctx);
     xml_close_tag(&ctx, "description");
 
-    char *external_url = server_url(BLOG_USE_HTTPS);
+    char *external_url = server_url(req, BLOG_USE_HTTPS);
 
     xml_open_tag(&ctx, "link");
     if(external_url != NULL) {
@@ -326,8 +903,8 @@ void blog_rss(char script_name[], struct entry *entries, int count) {
     xml_escaped(&ctx, "/");
     xml_close_tag(&ctx, "link");
 
-    if(count > 0) {
-        time_t update_time = entries[0].time;
+    if(index->count > 0) {
+        time_t update_time = index_time(index, 0);
         char strtime_update[MAX_TIMESTR_SIZE];
 
         if(flocaltime(strtime_update, RSS_TIME_FORMAT, MAX_TIMESTR_SIZE, &update_time) > 0) {
@@ -346,47 +923,50 @@ void blog_rss(char script_name[], struct entry *entries, int count) {
         free(rss_link);
     }
 
-    for(int i = 0; i < count; i++) {
-        if(entry_get_text(&entries[i]) != -1) {
-            xml_open_tag(&ctx, "item");
-            xml_open_tag(&ctx, "title");
-            xml_escaped(&ctx, entries[i].title);
-            xml_close_tag(&ctx, "title");
+    struct entry entry;
 
-            xml_open_tag(&ctx, "link");
-            if(external_url != NULL) {
-                xml_escaped(&ctx, external_url);
-            }
-            xml_escaped(&ctx, entries[i].link);
-            xml_close_tag(&ctx, "link");
+    for(size_t i = 0; feed_next_entry(index, &i, script_name, &entry); i++) {
+        xml_open_tag(&ctx, "item");
+        xml_open_tag(&ctx, "title");
+        xml_escaped(&ctx, entry.title);
+        xml_close_tag(&ctx, "title");
 
-            xml_open_tag(&ctx, "guid");
-            if(external_url != NULL) {
-                xml_escaped(&ctx, external_url);
-            }
-            xml_escaped(&ctx, entries[i].link);
-            xml_close_tag(&ctx, "guid");
-
-            if(entries[i].text_size > 0) {
-                xml_open_tag(&ctx, "description");
-                xml_open_cdata(&ctx);
-                xml_raw(&ctx, entries[i].text);
-                xml_close_cdata(&ctx);
-                xml_close_tag(&ctx, "description");
-            }
+        xml_open_tag(&ctx, "link");
+        if(external_url != NULL) {
+            xml_escaped(&ctx, external_url);
+        }
+        xml_escaped(&ctx, entry.link);
+        xml_close_tag(&ctx, "link");
 
-            char strtime_entry[MAX_TIMESTR_SIZE];
+        xml_open_tag(&ctx, "guid");
+        if(external_url != NULL) {
+            xml_escaped(&ctx, external_url);
+        }
+        xml_escaped(&ctx, entry.link);
+        xml_close_tag(&ctx, "guid");
 
-            if(flocaltime(strtime_entry, RSS_TIME_FORMAT, MAX_TIMESTR_SIZE, &entries[i].time) > 0) {
-                xml_open_tag(&ctx, "pubDate");
-                xml_escaped(&ctx, strtime_entry);
-                xml_close_tag(&ctx, "pubDate");
-            }
+        if(entry.text_size > 0) {
+            xml_open_tag(&ctx, "description");
+            xml_open_cdata(&ctx);
+            markdown_entry_text(&ctx, &entry);
+            xml_close_cdata(&ctx);
+            xml_close_tag(&ctx, "description");
+        }
 
-            xml_close_tag(&ctx, "item");
+        char strtime_entry[MAX_TIMESTR_SIZE];
 
-            entry_unget_text(&entries[i]);
+        if(flocaltime(strtime_entry, RSS_TIME_FORMAT, MAX_TIMESTR_SIZE, &entry.time) > 0) {
+            xml_open_tag(&ctx, "pubDate");
+            xml_escaped(&ctx, strtime_entry);
+            xml_close_tag(&ctx, "pubDate");
         }
+
+        feed_categories(&ctx, &entry, FEED_TYPE_RSS);
+
+        xml_close_tag(&ctx, "item");
+
+        entry_unget_text(&entry);
+        free_entry(&entry);
     }
 
     xml_close_all(&ctx);
@@ -396,15 +976,18 @@ void blog_rss(char script_name[], struct entry *entries, int count) {
     del_xml_context(&ctx);
 }
 
-void blog_atom(char script_name[], struct entry *entries, int count) {
+void blog_atom(struct request *req, struct index *index) {
+    char *script_name = req->script_name;
+
     struct xml_context ctx;
     new_xml_context(&ctx);
+    ctx.out = req->out;
 
-    char *external_url = server_url(BLOG_USE_HTTPS);
+    char *external_url = server_url(req, BLOG_USE_HTTPS);
     char *self_url = catn_alloc(3, external_url, script_name, "/atom.xml");
     char *html_url = catn_alloc(3, external_url, script_name, "/");
 
-    send_standard_headers(200, "application/atom+xml");
+    send_standard_headers(req->out, 200, "application/atom+xml");
 
     xml_raw(&ctx, "<?xml version=\"1.0\" encoding=\"utf-8\"?>");
     xml_open_tag_attrs(&ctx, "feed", 1, "xmlns", "http://www.w3.org/2005/Atom");
@@ -432,10 +1015,13 @@ void blog_atom(char script_name[], struct entry *entries, int count) {
 #ifdef BLOG_AUTHOR
     xml_escaped(&ctx, BLOG_AUTHOR);
 #else
-    struct passwd *user;
-    uid_t uid = geteuid();
-    user = getpwuid(uid);
-    xml_escaped(&ctx, user->pw_name);
+    struct passwd pwd;
+    struct passwd *user = NULL;
+    char pwd_buf[1024];
+
+    if(getpwuid_r(geteuid(), &pwd, pwd_buf, sizeof(pwd_buf), &user) == 0 && user != NULL) {
+        xml_escaped(&ctx, user->pw_name);
+    }
 #endif
     xml_close_tag(&ctx, "name");
 
@@ -448,8 +1034,8 @@ void blog_atom(char script_name[], struct entry *entries, int count) {
 
     xml_close_tag(&ctx, "author");
 
-    if(count > 0) {
-        time_t update_time = entries[0].time;
+    if(index->count > 0) {
+        time_t update_time = index_time(index, 0);
         char strtime_update[MAX_TIMESTR_SIZE];
         if(flocaltime(strtime_update, ATOM_TIME_FORMAT, MAX_TIMESTR_SIZE, &update_time) > 0) {
             xml_open_tag(&ctx, "updated");
@@ -458,49 +1044,391 @@ void blog_atom(char script_name[], struct entry *entries, int count) {
         }
     }
 
-    for(int i = 0; i < count; i++) {
-        if(entry_get_text(&entries[i]) != -1) {
-            xml_open_tag(&ctx, "entry");
+    struct entry entry;
+
+    for(size_t i = 0; feed_next_entry(index, &i, script_name, &entry); i++) {
+        xml_open_tag(&ctx, "entry");
+
+        xml_open_tag(&ctx, "id");
+        if(external_url != NULL) {
+            xml_escaped(&ctx, external_url);
+        }
+        xml_escaped(&ctx, entry.link);
+        xml_close_tag(&ctx, "id");
+
+        xml_open_tag(&ctx, "title");
+        xml_escaped(&ctx, entry.title);
+        xml_close_tag(&ctx, "title");
+
+        char strtime_entry[MAX_TIMESTR_SIZE];
+        if(flocaltime(strtime_entry, ATOM_TIME_FORMAT, MAX_TIMESTR_SIZE, &entry.time) > 0) {
+            xml_open_tag(&ctx, "updated");
+            xml_escaped(&ctx, strtime_entry);
+            xml_close_tag(&ctx, "updated");
+        }
+
+        char *entry_url = catn_alloc(2, external_url, entry.link);
+        if(entry_url != NULL) {
+            xml_empty_tag(&ctx, "link", 3, "rel", "alternate", "type", "text/html", "href", entry_url);
+            free(entry_url);
+        }
+
+        feed_categories(&ctx, &entry, FEED_TYPE_ATOM);
+
+        if(entry.summary != NULL) {
+            xml_open_tag(&ctx, "summary");
+            xml_escaped(&ctx, entry.summary);
+            xml_close_tag(&ctx, "summary");
+        }
+
+        xml_open_tag_attrs(&ctx, "content", 1, "type", "html");
+        xml_open_cdata(&ctx);
+        markdown_entry_text(&ctx, &entry);
+        xml_close_cdata(&ctx);
+        xml_close_tag(&ctx, "content");
+
+        xml_close_tag(&ctx, "entry");
+
+        entry_unget_text(&entry);
+        free_entry(&entry);
+    }
+
+    xml_close_tag(&ctx, "feed");
+
+    free(external_url);
+
+    del_xml_context(&ctx);
+}
+
+void blog_json(struct request *req, struct index *index) {
+    char *script_name = req->script_name;
+
+    struct json_context ctx;
+    new_json_context(&ctx);
+    ctx.out = req->out;
+
+    // Markdown is converted to HTML into html_buf first, so it can be escaped
+    struct xml_context html;
+    new_xml_context(&html);
+    html.out = NULL;
+    char *html_buf = NULL;
+    size_t html_len = 0;
+
+    char *external_url = server_url(req, BLOG_USE_HTTPS);
+    char *home_url = catn_alloc(3, external_url, script_name, "/");
+    char *feed_url = catn_alloc(3, external_url, script_name, "/feed.json");
+
+    send_standard_headers(req->out, 200, "application/feed+json");
+
+    json_open_object(&ctx);
+
+    json_key(&ctx, "version");
+    json_string(&ctx, "https://jsonfeed.org/version/1.1");
+
+    json_key(&ctx, "title");
+    json_string(&ctx, BLOG_TITLE);
+
+    json_key(&ctx, "description");
+    json_string(&ctx, BLOG_DESCRIPTION);
+
+    if(home_url != NULL) {
+        json_key(&ctx, "home_page_url");
+        json_string(&ctx, home_url);
+        free(home_url);
+    }
+
+    if(feed_url != NULL) {
+        json_key(&ctx, "feed_url");
+        json_string(&ctx, feed_url);
+        free(feed_url);
+    }
+
+    json_key(&ctx, "authors");
+    json_open_array(&ctx);
+    json_open_object(&ctx);
+    json_key(&ctx, "name");
+#ifdef BLOG_AUTHOR
+    json_string(&ctx, BLOG_AUTHOR);
+#else
+    struct passwd pwd;
+    struct passwd *user = NULL;
+    char pwd_buf[1024];
+
+    if(getpwuid_r(geteuid(), &pwd, pwd_buf, sizeof(pwd_buf), &user) == 0 && user != NULL) {
+        json_string(&ctx, user->pw_name);
+    } else {
+        json_string(&ctx, "");
+    }
+#endif
+    json_close_object(&ctx);
+    json_close_array(&ctx);
+
+    json_key(&ctx, "items");
+    json_open_array(&ctx);
+
+    struct entry entry;
+
+    for(size_t i = 0; feed_next_entry(index, &i, script_name, &entry); i++) {
+        json_open_object(&ctx);
+
+        json_key(&ctx, "id");
+        json_open_string(&ctx);
+        if(external_url != NULL) {
+            json_escaped(&ctx, external_url, strlen(external_url));
+        }
+        json_escaped(&ctx, entry.link, strlen(entry.link));
+        json_close_string(&ctx);
+
+        json_key(&ctx, "url");
+        json_open_string(&ctx);
+        if(external_url != NULL) {
+            json_escaped(&ctx, external_url, strlen(external_url));
+        }
+        json_escaped(&ctx, entry.link, strlen(entry.link));
+        json_close_string(&ctx);
+
+        json_key(&ctx, "title");
+        json_string(&ctx, entry.title);
+
+        if(entry.summary != NULL) {
+            json_key(&ctx, "summary");
+            json_string(&ctx, entry.summary);
+        }
+
+        json_key(&ctx, "content_html");
+        json_open_string(&ctx);
+        if(!entry.text_markdown) {
+            json_escaped(&ctx, entry.text, entry.text_size);
+        } else {
+            if(html.out == NULL) {
+                html.out = open_memstream(&html_buf, &html_len);
+            }
+
+            // the buffer is reused for every entry
+            if(html.out != NULL && fseeko(html.out, 0, SEEK_SET) == 0) {
+                markdown_entry_text(&html, &entry);
+
+                off_t len = ftello(html.out);
+
+                if(fflush(html.out) == 0 && len > 0) {
+                    json_escaped(&ctx, html_buf, len);
+                }
+            }
+        }
+        json_close_string(&ctx);
+
+        char strtime_entry[MAX_TIMESTR_SIZE];
+        if(flocaltime(strtime_entry, ATOM_TIME_FORMAT, MAX_TIMESTR_SIZE, &entry.time) > 0) {
+            json_key(&ctx, "date_published");
+            json_string(&ctx, strtime_entry);
+        }
+
+        if(entry.tags != NULL) {
+            const char *tags = entry.tags;
+            const char *tag;
+            size_t len;
+
+            json_key(&ctx, "tags");
+            json_open_array(&ctx);
+            while((tag = entry_next_tag(&tags, &len)) != NULL) {
+                json_open_string(&ctx);
+                json_escaped(&ctx, tag, len);
+                json_close_string(&ctx);
+            }
+            json_close_array(&ctx);
+        }
+
+        json_close_object(&ctx);
+
+        entry_unget_text(&entry);
+        free_entry(&entry);
+    }
+
+    json_close_array(&ctx);
+    json_close_object(&ctx);
+
+    if(html.out != NULL) {
+        fclose(html.out);
+    }
+    free(html_buf);
+
+    free(external_url);
+
+    del_xml_context(&html);
+}
+
+bool sitemap_next_part(const struct index *index, struct sitemap_part *part) {
+    if(part->page > 1) {
+        part->page--;
+    } else {
+        // move on to the next segment after its oldest page
+        if(part->page == 1) {
+            part->offset += index->segments[part->segment].count;
+            part->segment++;
+        }
+
+        if(part->segment >= index->segment_count) {
+            return false;
+        }
+
+        part->page = (index->segments[part->segment].count + SITEMAP_MAX_URLS - 1) / SITEMAP_MAX_URLS;
+    }
+
+    // pages are counted from the end of the segment, i. e. its oldest entry
+    size_t end = index->segments[part->segment].count - (part->page - 1) * SITEMAP_MAX_URLS;
+    size_t start = end > SITEMAP_MAX_URLS ? end - SITEMAP_MAX_URLS : 0;
+
+    part->first = part->offset + start;
+    part->count = end - start;
+
+    return true;
+}
+
+size_t sitemap_part_name(const struct index *index, const struct sitemap_part *part,
+                         char *buf, size_t size) {
+    const char *shard = index->segments[part->segment].shard;
+    int len;
+
+    if(part->page > 1) {
+        len = snprintf(buf, size, "%s-%zu", shard[0] == '\0' ? "latest" : shard, part->page);
+    } else {
+        len = snprintf(buf, size, "%s", shard[0] == '\0' ? "latest" : shard);
+    }
+
+    return len < 0 || (size_t) len >= size ? 0 : (size_t) len;
+}
+
+int blog_sitemap_part(const struct request *req, const struct index *index,
+                      enum feed_type *type, struct sitemap_part *part) {
+    memset(part, 0, sizeof(struct sitemap_part));
+
+    if(strcmp(req->path_info, "/sitemap.xml") == 0) {
+        // a blog without entries gets an empty list
+        if(!sitemap_next_part(index, part)) {
+            *type = FEED_TYPE_SITEMAP;
+            return 0;
+        }
+
+        struct sitemap_part next = *part;
+        *type = sitemap_next_part(index, &next) ? FEED_TYPE_SITEMAP_INDEX : FEED_TYPE_SITEMAP;
+
+        return 0;
+    }
+
+    // /sitemap/<name>.xml
+    const char *name = req->path_info + strlen("/sitemap/");
+    size_t name_len = strlen(name);
+
+    if(name_len <= 4 || strcmp(name + name_len - 4, ".xml") != 0) {
+        return -1;
+    }
+
+    name_len -= 4;
+
+    while(sitemap_next_part(index, part)) {
+        char part_name[MAX_SITEMAP_NAME_SIZE];
+        size_t len = sitemap_part_name(index, part, part_name, sizeof(part_name));
+
+        if(len == name_len && memcmp(part_name, name, len) == 0) {
+            *type = FEED_TYPE_SITEMAP;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void blog_sitemap(struct request *req, struct index *index, enum feed_type type,
+                  const struct sitemap_part *part) {
+    struct xml_context ctx;
+    new_xml_context(&ctx);
+    ctx.out = req->out;
+
+    char *external_url = server_url(req, BLOG_USE_HTTPS);
+
+    // links are stored url encoded, so SCRIPT_NAME needs to be encoded as
+    // well to match index_get_entry(). Without memory, use it unencoded.
+    char *script_name = catn_alloc(1, req->script_name);
+
+    if(script_name != NULL) {
+        urlencode_realloc(&script_name, strlen(script_name) + 1);
+    }
+
+    send_standard_headers(req->out, 200, "application/xml");
+
+    xml_raw(&ctx, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>");
+
+    if(type == FEED_TYPE_SITEMAP_INDEX) {
+        xml_open_tag_attrs(&ctx, "sitemapindex", 1, "xmlns", "http://www.sitemaps.org/schemas/sitemap/0.9");
+
+        struct sitemap_part p;
+        memset(&p, 0, sizeof(struct sitemap_part));
+
+        while(sitemap_next_part(index, &p)) {
+            char name[MAX_SITEMAP_NAME_SIZE];
+
+            if(sitemap_part_name(index, &p, name, sizeof(name)) == 0) {
+                continue;
+            }
+
+            xml_open_tag(&ctx, "sitemap");
 
-            xml_open_tag(&ctx, "id");
+            xml_open_tag(&ctx, "loc");
             if(external_url != NULL) {
                 xml_escaped(&ctx, external_url);
             }
-            xml_escaped(&ctx, entries[i].link);
-            xml_close_tag(&ctx, "id");
-
-            xml_open_tag(&ctx, "title");
-            xml_escaped(&ctx, entries[i].title);
-            xml_close_tag(&ctx, "title");
-
-            char strtime_entry[MAX_TIMESTR_SIZE];
-            if(flocaltime(strtime_entry, ATOM_TIME_FORMAT, MAX_TIMESTR_SIZE, &entries[i].time) > 0) {
-                xml_open_tag(&ctx, "updated");
-                xml_escaped(&ctx, strtime_entry);
-                xml_close_tag(&ctx, "updated");
+            xml_escaped(&ctx, script_name != NULL ? script_name : req->script_name);
+            xml_escaped(&ctx, "/sitemap/");
+            xml_escaped(&ctx, name);
+            xml_escaped(&ctx, ".xml");
+            xml_close_tag(&ctx, "loc");
+
+            // the list of entries changes whenever the directory does
+            time_t dir_time = index->segments[p.segment].header->dir_mtime_sec;
+            char strtime[MAX_TIMESTR_SIZE];
+
+            if(flocaltime(strtime, ATOM_TIME_FORMAT, MAX_TIMESTR_SIZE, &dir_time) > 0) {
+                xml_open_tag(&ctx, "lastmod");
+                xml_escaped(&ctx, strtime);
+                xml_close_tag(&ctx, "lastmod");
             }
 
-            char *entry_url = catn_alloc(2, external_url, entries[i].link);
-            if(entry_url != NULL) {
-                xml_empty_tag(&ctx, "link", 3, "rel", "alternate", "type", "text/html", "href", entry_url);
-                free(entry_url);
-            }
+            xml_close_tag(&ctx, "sitemap");
+        }
+    } else {
+        xml_open_tag_attrs(&ctx, "urlset", 1, "xmlns", "http://www.sitemaps.org/schemas/sitemap/0.9");
 
-            xml_open_tag_attrs(&ctx, "content", 1, "type", "html");
-            xml_open_cdata(&ctx);
-            xml_raw(&ctx, entries[i].text);
-            xml_close_cdata(&ctx);
-            xml_close_tag(&ctx, "content");
+        // links and times are taken from the index directly, so no entry is constructed
+        for(size_t n = 0; n < part->count; n++) {
+            const struct index_segment *segment = index->segments + part->segment;
+            size_t i = part->first - part->offset + n;
+            time_t published = segment->times[i];
+            char strtime[MAX_TIMESTR_SIZE];
+
+            xml_open_tag(&ctx, "url");
 
-            xml_close_tag(&ctx, "entry");
+            xml_open_tag(&ctx, "loc");
+            if(external_url != NULL) {
+                xml_escaped(&ctx, external_url);
+            }
+            xml_escaped(&ctx, script_name != NULL ? script_name : req->script_name);
+            xml_escaped(&ctx, segment->pool + segment->links[i]);
+            xml_close_tag(&ctx, "loc");
+
+            if(flocaltime(strtime, ATOM_TIME_FORMAT, MAX_TIMESTR_SIZE, &published) > 0) {
+                xml_open_tag(&ctx, "lastmod");
+                xml_escaped(&ctx, strtime);
+                xml_close_tag(&ctx, "lastmod");
+            }
 
-            entry_unget_text(&entries[i]);
+            xml_close_tag(&ctx, "url");
         }
     }
 
-    xml_close_tag(&ctx, "feed");
+    xml_close_all(&ctx);
 
     free(external_url);
+    free(script_name);
 
     del_xml_context(&ctx);
 }
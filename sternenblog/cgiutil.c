@@ -3,17 +3,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "cgiutil.h"
+#include "core.h"
 #include "stringutil.h"
 
-void send_header(char key[], char val[]) {
-    fputs(key, stdout);
-    fputs(": ", stdout);
-    fputs(val, stdout);
-    puts("\r");
+void send_header(FILE *out, char key[], char val[]) {
+    fputs(key, out);
+    fputs(": ", out);
+    fputs(val, out);
+    fputs("\r\n", out);
 }
 
-void terminate_headers(void) {
-    puts("\r");
+void terminate_headers(FILE *out) {
+    fputs("\r\n", out);
 }
 
 char *http_status_line(int status) {
@@ -116,15 +118,56 @@ int urlencode_realloc(char **input, int size) {
     return output_size;
 }
 
-char *server_url(bool https) {
-    char *server_name = getenv("SERVER_NAME");
-    char *server_port = getenv("SERVER_PORT");
+char *query_param(const char *query_string, const char *name) {
+    size_t name_len = strlen(name);
+    const char *param = query_string;
 
-    if(server_name == NULL || server_port == NULL) {
+    while(param != NULL) {
+        size_t param_len = strcspn(param, "&");
+
+        if(param_len > name_len && strncmp(param, name, name_len) == 0 && param[name_len] == '=') {
+            const char *value = param + name_len + 1;
+            size_t value_len = param_len - name_len - 1;
+            char *output = malloc(value_len + 1);
+
+            if(output == NULL) {
+                return NULL;
+            }
+
+            size_t output_pos = 0;
+
+            for(size_t i = 0; i < value_len; i++) {
+                int high = i + 2 < value_len && value[i] == '%' ? hex_nibble(value[i + 1]) : -1;
+                int low = high == -1 ? -1 : hex_nibble(value[i + 2]);
+
+                if(low != -1) {
+                    if(high != 0 || low != 0) {
+                        output[output_pos++] = (char) (high << 4 | low);
+                    }
+                    i += 2;
+                } else if(value[i] == '+') {
+                    output[output_pos++] = ' ';
+                } else {
+                    output[output_pos++] = value[i];
+                }
+            }
+
+            output[output_pos] = '\0';
+            return output;
+        }
+
+        param = param[param_len] == '&' ? param + param_len + 1 : NULL;
+    }
+
+    return NULL;
+}
+
+char *server_url(const struct request *req, bool https) {
+    if(req->server_name == NULL || req->server_port == NULL) {
         return NULL;
     }
 
     char *proto = https ? "https://" : "http://";
 
-    return catn_alloc(4, proto, server_name, ":", server_port);
+    return catn_alloc(4, proto, req->server_name, ":", req->server_port);
 }
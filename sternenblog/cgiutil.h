@@ -7,23 +7,29 @@
 #define STERNENBLOG_CGIUTIL_H
 
 #include <stdbool.h>
+#include <stdio.h>
+
+#include "core.h"
 
 /*!
  * @brief Print a HTTP header
  *
- * Prints a HTTP Header to `stdout` like CGI requires.
+ * Prints a HTTP Header to `out` (usually `stdout`) like CGI requires.
  *
+ * @param out where to write the header
  * @param key Name of the HTTP Header
  * @param val Contents of the header to send
  */
-void send_header(char key[], char val[]);
+void send_header(FILE *out, char key[], char val[]);
 
 /*!
  * @brief Print end of HTTP header section
  *
- * Terminates the header section of a CGI/HTTP Response by printing `\r\n` to `stdout`.
+ * Terminates the header section of a CGI/HTTP Response by printing `\r\n` to `out`.
+ *
+ * @param out where to write the response, usually `stdout`
  */
-void terminate_headers(void);
+void terminate_headers(FILE *out);
 
 /*!
  * @brief Value of a HTTP status header for a given status code.
@@ -37,7 +43,7 @@ void terminate_headers(void);
  * Example usage:
  *
  * ```
- * send_header("Status", http_status_line(404);
+ * send_header(stdout, "Status", http_status_line(404));
  * // Prints: Status: 404 Not Found
  * ```
  *
@@ -96,21 +102,40 @@ int http_errno(int err);
 int urlencode_realloc(char **input, int size);
 
 /*!
- * @brief Returns URL of server addressed by the current CGI request
+ * @brief Returns a parameter of a query string
+ *
+ * Looks up the first parameter called `name` in a query string of
+ * `&` separated `name=value` pairs like `QUERY_STRING` and decodes its
+ * value the way HTML forms encode it, i. e. percent escapes are decoded
+ * and `+` is replaced by a space. Invalid escapes are kept as they are,
+ * encoded null bytes are dropped.
+ *
+ * The returned `char *` is dynamically allocated and must be cleaned
+ * up using `free()` before it goes out of scope.
+ *
+ * @param query_string query string to search, may be `NULL`
+ * @param name name of the parameter
+ * @return decoded value of the parameter or `NULL` if it is missing or on error
+ */
+char *query_param(const char *query_string, const char *name);
+
+/*!
+ * @brief Returns URL of server addressed by a request
  *
- * server_url() uses the CGI 1.1 environment variables `SERVER_NAME`
- * and `SERVER_PORT` to construct an URL to the server the current
- * request is addressed to. Since CGI only reveals the HTTP version
- * used and not wether an encrypted version of HTTP is used,
- * server_url() will use the parameter `https` to decide which protocol
- * identifier to prefix.
+ * server_url() uses the CGI 1.1 variables `SERVER_NAME` and `SERVER_PORT`
+ * of the given request to construct an URL to the server the request is
+ * addressed to. Since CGI only reveals the HTTP version used and not
+ * wether an encrypted version of HTTP is used, server_url() will use the
+ * parameter `https` to decide which protocol identifier to prefix.
  *
  * The returned `char *` is dynamically allocated and must be cleaned
  * up using `free()` before it goes out of scope.
  *
+ * @param req request to construct the URL for
  * @param https if true, prefix `https://` else `http://`
- * @return Pointer to dynamically allocated char buffer containing the URL.
+ * @return Pointer to dynamically allocated char buffer containing the URL
+ *         or `NULL` if `SERVER_NAME` or `SERVER_PORT` is missing.
  */
-char *server_url(bool https);
+char *server_url(const struct request *req, bool https);
 
 #endif
@@ -6,6 +6,8 @@
 #ifndef STERNENBLOG_CORE_H
 #define STERNENBLOG_CORE_H
 
+#include <stdbool.h>
+#include <stdio.h>
 #include <time.h>
 
 /*!
@@ -27,13 +29,46 @@
  */
 struct entry {
     // mandatory: part of each well-formed entry
-    time_t time;       //!< last modification time of the entry
+    time_t time;       //!< publication time, `date` of the front matter or the modification time of the entry
+    time_t time_min;   //!< earliest publication time allowed by the entry's shard, see `entry_shard_month()`
+    time_t time_max;   //!< latest publication time allowed by the entry's shard, equal to `time_min` if unrestricted
+    time_t mtime;      //!< last modification time of the entry's file
     char *path;        //!< path (on disk) to the entry
     char *link;        //!< absolute path on the http server to the entry
-    char *title;       //!< title of the post, currently `PATH_INFO` without the initial slash
+    char *title;       //!< title of the post, `title` of the front matter or `PATH_INFO` without the initial slash
     size_t text_size;  //!< size of text, -1 to indicate it's missing
     // optional: may be NULL, depending on context
-    char *text;        //!< contents of the entry (mmap-ed file) or `NULL`
+    char *tags;        //!< comma separated `tags` of the front matter or `NULL`
+    char *summary;     //!< `summary` of the front matter or `NULL`
+    char *text;        //!< contents of the entry (read or mmap-ed file) or `NULL`
+    bool text_markdown; //!< if `text` is Markdown to be converted by `markdown_entry_text()`
+    bool text_excerpt; //!< if `text` is only an excerpt of the entry, see `index_get_excerpt()`
+    // used by entry_get_text() to avoid looking up the file again
+    int fd;            //!< file descriptor of the already checked file or -1
+    size_t file_size;  //!< size of the file when it was checked, -1 if unknown
+    bool indexed;      //!< if the front matter has already been taken from the index
+    size_t text_skip;  //!< size of the front matter `text` has been advanced past
+    bool text_indexed; //!< if `text` belongs to the index and must not be released
+};
+
+/*!
+ * @brief Request being served
+ *
+ * Holds everything sternenblog needs to know about the request it is
+ * currently serving, as opposed to reading it from the environment.
+ * It is passed through routing, the feeds and the template, so
+ * multiple requests can be served concurrently by different threads.
+ *
+ * All strings are owned by the caller serving the request.
+ */
+struct request {
+    FILE *out;             //!< where to write the CGI response, usually `stdout`
+    char *script_name;     //!< `SCRIPT_NAME` of the request, may be `NULL`
+    char *path_info;       //!< `PATH_INFO` of the request, may be `NULL`
+    char *query_string;    //!< `QUERY_STRING` of the request, not decoded, may be `NULL`
+    char *server_name;     //!< `SERVER_NAME` of the request, may be `NULL`
+    char *server_port;     //!< `SERVER_PORT` of the request, may be `NULL`
+    void *template_state;  //!< may be used by the template to keep state, initially `NULL`
 };
 
 /*!
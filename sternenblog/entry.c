@@ -1,35 +1,288 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // for MAP_POPULATE and statx()
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef STATX_BASIC_STATS
+#include <sys/sysmacros.h>
+#endif
+
 #include "core.h"
 #include "../config.h" // TODO: make independent?
 #include "cgiutil.h"
 #include "entry.h"
+#include "markdown.h"
+#include "metrics.h"
+#include "stringutil.h"
+#include "timing.h"
+#include "xml.h"
 
-int make_entry(const char *blog_dir, char *script_name, char *path_info, struct entry *entry) {
-    // TODO: allow subdirectories?
-    // TODO: no status code return?
+#ifndef BLOG_MARKDOWN
+#define BLOG_MARKDOWN 0
+#endif
 
-    // TODO: url encoding of links
+#ifndef BLOG_FRONT_MATTER
+#define BLOG_FRONT_MATTER 0
+#endif
+
+/*!
+ * @brief Size up to which entry texts are read instead of mapped
+ *
+ * Reading small files into a reused buffer is cheaper than setting up
+ * and tearing down a mapping (and the page faults and TLB flushes that
+ * come with it), larger ones are mapped to avoid copying them.
+ *
+ * @see entry_get_text
+ */
+#define ENTRY_TEXT_MMAP_THRESHOLD (64 * 1024)
+
+/*!
+ * @brief File opened in advance by `entry_prefetch()`
+ */
+struct prefetched_file {
+    char *path; //!< path of the file, `NULL` if the slot is unused
+    int fd;     //!< file descriptor of the opened file
+};
+
+// per thread, so concurrently served requests don't interfere
+static _Thread_local char *text_buffer = NULL;
+static _Thread_local size_t text_buffer_size = 0;
+static _Thread_local bool text_buffer_used = false;
+
+static _Thread_local struct prefetched_file prefetched[ENTRY_PREFETCH_DISTANCE];
+static _Thread_local size_t prefetched_next = 0;
+
+#ifdef STATX_BASIC_STATS
+// cleared if the kernel (or a seccomp filter) doesn't allow statx()
+static atomic_bool statx_supported = true;
+#endif
+
+int entry_stat(int dir_fd, const char *name, struct stat *info) {
+#ifdef STATX_BASIC_STATS
+    if(atomic_load_explicit(&statx_supported, memory_order_relaxed)) {
+        struct statx stx;
+        // only what entry_check_file(), make_entry(), the index and the
+        // text loader need
+        unsigned int mask = STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID |
+                            STATX_INO | STATX_MTIME | STATX_SIZE;
+        // use cached attributes on network file systems instead of a round trip
+        int flags = AT_STATX_DONT_SYNC | (name[0] == '\0' ? AT_EMPTY_PATH : 0);
+
+        if(statx(dir_fd, name, flags, mask, &stx) == 0) {
+            memset(info, 0, sizeof(struct stat));
+            info->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+            info->st_ino = stx.stx_ino;
+            info->st_mode = stx.stx_mode;
+            info->st_uid = stx.stx_uid;
+            info->st_gid = stx.stx_gid;
+            info->st_size = stx.stx_size;
+            info->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+            info->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+
+            return 0;
+        } else if(errno != ENOSYS && errno != EPERM) {
+            return -1;
+        }
+
+        atomic_store_explicit(&statx_supported, false, memory_order_relaxed);
+    }
+#endif
+
+    if(name[0] == '\0') {
+        return fstat(dir_fd, info);
+    }
+
+    return fstatat(dir_fd, name, info, 0);
+}
+
+static pthread_mutex_t dir_fd_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *dir_fd_path = NULL;
+static int dir_fd = -1;
+
+int entry_dir_fd(const char *blog_dir) {
+    pthread_mutex_lock(&dir_fd_lock);
+
+    if(dir_fd == -1 || strcmp(dir_fd_path, blog_dir) != 0) {
+        char *path = strdup(blog_dir);
+        int fd = path == NULL ? -1 : open(blog_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if(fd == -1) {
+            free(path);
+        } else {
+            // a previous descriptor is leaked on purpose: other threads may still use it
+            free(dir_fd_path);
+            dir_fd_path = path;
+            dir_fd = fd;
+        }
+    }
+
+    int fd = dir_fd;
+
+    pthread_mutex_unlock(&dir_fd_lock);
+
+    return fd;
+}
+
+/*
+ * Sets title, path and link of an entry whose path_info has
+ * already been validated. Returns 200 or an HTTP status code.
+ */
+static int entry_set_names(const char *blog_dir, char *script_name, char *path_info, size_t path_info_len, struct entry *entry) {
+    // title length is exactly path_info_len (-1 for slash, +1 for null byte)
+    entry->title = malloc(sizeof(char) * path_info_len);
+    if(entry->title == NULL) {
+        return 500;
+    }
+    memcpy(entry->title, path_info + 1, sizeof(char) * path_info_len);
+
+    // build path to entry's file
+    size_t blog_dir_len = strlen(blog_dir);
+
+    entry->path = malloc(sizeof(char) * (path_info_len + blog_dir_len + 1));
+    if(entry->path == NULL) {
+        return 500;
+    }
+
+    memcpy(entry->path, blog_dir, blog_dir_len * sizeof(char));
+
+    // prevent double slash
+    if(entry->path[blog_dir_len - 1] == '/') {
+        blog_dir_len--;
+    }
+
+    memcpy(entry->path + blog_dir_len, path_info, path_info_len);
+    entry->path[path_info_len + blog_dir_len] = '\0';
+
+    // build the link using SCRIPT_NAME
+    if(script_name == NULL) {
+        fprintf(stderr, "Missing SCRIPT_NAME\n");
+        return 500;
+    }
+
+    // don't check SCRIPT_NAME validity, since we
+    // don't depend on it starting with a slash
 
+    size_t script_name_len = strlen(script_name);
+    size_t link_size = script_name_len + path_info_len + 1;
+
+    entry->link = malloc(sizeof(char) * link_size);
+    if(entry->link == NULL) {
+        return 500;
+    }
+
+    if(script_name_len != 0) {
+        memcpy(entry->link, script_name, script_name_len);
+    }
+
+    memcpy(entry->link + script_name_len, path_info, path_info_len);
+
+    entry->link[link_size - 1] = '\0';
+
+    if(urlencode_realloc(&entry->link, link_size) <= 0) {
+        return 500;
+    }
+
+    return 200;
+}
+
+static void entry_init(struct entry *entry) {
     // intialize pointers
     entry->time = 0;
+    entry->time_min = 0;
+    entry->time_max = 0;
+    entry->mtime = 0;
     entry->link = NULL;
     entry->path = NULL;
     entry->title = NULL;
 
     // won't be handled by make_entry
+    entry->tags = NULL;
+    entry->summary = NULL;
     entry->text = NULL;
     entry->text_size = 0;
+    entry->text_markdown = false;
+    entry->text_excerpt = false;
+    entry->text_indexed = false;
+
+    entry->fd = -1;
+    entry->file_size = -1;
+    entry->indexed = false;
+    entry->text_skip = 0;
+}
+
+bool entry_shard_month(const char *shard, size_t shard_len, time_t *start, time_t *end) {
+    if(!BLOG_SHARDED || shard_len != 7 || shard[4] != '/') {
+        return false;
+    }
+
+    int year = 0;
+    int month = 0;
+
+    for(size_t i = 0; i < shard_len; i++) {
+        if(i == 4) {
+            continue;
+        } else if(!isdigit((unsigned char) shard[i])) {
+            return false;
+        } else if(i < 4) {
+            year = year * 10 + shard[i] - '0';
+        } else {
+            month = month * 10 + shard[i] - '0';
+        }
+    }
+
+    if(month < 1 || month > 12) {
+        return false;
+    }
+
+    // mktime() normalizes month 12 into january of the next year
+    struct tm tm = { .tm_year = year - 1900, .tm_mon = month - 1, .tm_mday = 1, .tm_isdst = -1 };
+    struct tm next = { .tm_year = year - 1900, .tm_mon = month, .tm_mday = 1, .tm_isdst = -1 };
+
+    *start = mktime(&tm);
+    *end = mktime(&next);
+
+    if(*start == (time_t) -1 || *end == (time_t) -1) {
+        return false;
+    }
+
+    (*end)--;
+
+    return true;
+}
+
+/*
+ * Restricts time to the month of the entry's shard, if it is in one.
+ */
+static time_t entry_clamp_time(const struct entry *entry, time_t time) {
+    if(entry->time_min == entry->time_max) {
+        return time;
+    }
+
+    return time < entry->time_min ? entry->time_min
+         : time > entry->time_max ? entry->time_max
+         : time;
+}
+
+int make_entry(const char *blog_dir, char *script_name, char *path_info, struct entry *entry) {
+    // TODO: allow subdirectories?
+    // TODO: no status code return?
+
+    // TODO: url encoding of links
+
+    entry_init(entry);
 
     // validate path_info
     if(path_info == NULL) {
@@ -75,33 +328,75 @@ int make_entry(const char *blog_dir, char *script_name, char *path_info, struct
         return 500;
     }
 
-    // title length is exactly path_info_len (-1 for slash, +1 for null byte)
-    entry->title = malloc(sizeof(char) * path_info_len);
-    memcpy(entry->title, path_info + 1, sizeof(char) * path_info_len);
-
-    // build path to entry's file
-    size_t blog_dir_len = strlen(blog_dir);
-
-    entry->path = malloc(sizeof(char) * (path_info_len + blog_dir_len + 1));
+    int status = entry_set_names(blog_dir, script_name, path_info, path_info_len, entry);
+    if(status != 200) {
+        return status;
+    }
 
-    memcpy(entry->path, blog_dir, blog_dir_len * sizeof(char));
+    int blog_dir_fd = entry_dir_fd(blog_dir);
 
-    // prevent double slash
-    if(entry->path[blog_dir_len - 1] == '/') {
-        blog_dir_len--;
+    if(blog_dir_fd == -1) {
+        return http_errno(errno);
     }
 
-    memcpy(entry->path + blog_dir_len, path_info, path_info_len);
-    entry->path[path_info_len + blog_dir_len] = '\0';
-
     struct stat file_info;
     memset(&file_info, 0, sizeof(struct stat));
 
-    if(stat(entry->path, &file_info) == -1) {
+    // check the file before opening it, so a request never opens
+    // a device node or a file BLOG_STRICT_ACCESS forbids
+    if(entry_stat(blog_dir_fd, path_info + 1, &file_info) == -1) {
         return http_errno(errno);
     }
 
-    int regular_file = (file_info.st_mode & S_IFMT) == S_IFREG;
+    status = entry_check_file(&file_info);
+
+    if(status != 200) {
+        return status;
+    }
+
+    // Keep the checked file open for entry_get_text(). If it can't be opened,
+    // answer from its metadata and let entry_get_text() fail like before.
+    // O_NONBLOCK prevents hanging on a FIFO swapped in after the check.
+    entry->fd = openat(blog_dir_fd, path_info + 1, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+    if(entry->fd != -1) {
+        struct stat fd_info;
+
+        // if the file was replaced in the meantime, check the new one
+        if(entry_stat(entry->fd, "", &fd_info) == -1) {
+            status = http_errno(errno);
+        } else if(fd_info.st_dev != file_info.st_dev || fd_info.st_ino != file_info.st_ino) {
+            status = entry_check_file(&fd_info);
+        }
+
+        file_info = fd_info;
+    }
+
+    if(status == 200) {
+        const char *name = strrchr(path_info, '/');
+        time_t month_start;
+        time_t month_end;
+
+        if(name - path_info > 1 &&
+           entry_shard_month(path_info + 1, name - path_info - 1, &month_start, &month_end)) {
+            entry->time_min = month_start;
+            entry->time_max = month_end;
+        }
+
+        // use POSIX compatible version, since we don't need nanoseconds
+        entry->time = entry_clamp_time(entry, file_info.st_mtime);
+        entry->mtime = file_info.st_mtime;
+        entry->file_size = file_info.st_size;
+    } else if(entry->fd != -1) {
+        close(entry->fd);
+        entry->fd = -1;
+    }
+
+    return status;
+}
+
+int entry_check_file(const struct stat *file_info) {
+    int regular_file = (file_info->st_mode & S_IFMT) == S_IFREG;
 
     // strict access check requires files to be owned by the webserver's
     // group or user in order to be processed. can be disabled in config.h
@@ -109,7 +404,7 @@ int make_entry(const char *blog_dir, char *script_name, char *path_info, struct
     if(BLOG_STRICT_ACCESS) {
         gid_t gid = getegid();
         uid_t uid = geteuid();
-        access = file_info.st_gid == gid || file_info.st_uid == uid;
+        access = file_info->st_gid == gid || file_info->st_uid == uid;
     }
 
     if(!access) {
@@ -118,63 +413,753 @@ int make_entry(const char *blog_dir, char *script_name, char *path_info, struct
         return http_errno(ENOENT);
     }
 
-    // use POSIX compatible version, since we don't need nanoseconds
-    entry->time = file_info.st_mtime;
+    return 200;
+}
 
-    // build the link using SCRIPT_NAME
-    if(script_name == NULL) {
-        fprintf(stderr, "Missing SCRIPT_NAME\n");
-        return 500;
+/*
+ * Length of the line starting at text (without its line break),
+ * *next is set to the start of the following line. Returns -1
+ * if the line doesn't end before end.
+ */
+static ssize_t front_matter_line(const char *text, const char *end, const char **next) {
+    const char *nl = memchr(text, '\n', end - text);
+
+    if(nl == NULL) {
+        return -1;
     }
 
-    // don't check SCRIPT_NAME validity, since we
-    // don't depend on it starting with a slash
+    *next = nl + 1;
 
-    size_t script_name_len = strlen(script_name);
-    size_t link_size = script_name_len + path_info_len + 1;
+    return nl > text && nl[-1] == '\r' ? nl - text - 1 : nl - text;
+}
 
-    entry->link = malloc(sizeof(char) * link_size);
+/*
+ * Parses exactly len digits at s into *value.
+ */
+static bool front_matter_digits(const char *s, size_t len, int *value) {
+    *value = 0;
 
-    if(script_name_len != 0) {
-        memcpy(entry->link, script_name, script_name_len);
+    for(size_t i = 0; i < len; i++) {
+        if(s[i] < '0' || s[i] > '9') {
+            return false;
+        }
+
+        *value = *value * 10 + (s[i] - '0');
     }
 
-    memcpy(entry->link + script_name_len, path_info, path_info_len);
+    return true;
+}
 
-    entry->link[link_size - 1] = '\0';
+/*
+ * Parses yyyy-mm-dd[( |T)hh:mm[:ss]][Z].
+ */
+static bool front_matter_date(const char *s, size_t len, time_t *date) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(struct tm));
 
-    if(urlencode_realloc(&entry->link, link_size) <= 0) {
-        return 500;
+    if(len < 10 || s[4] != '-' || s[7] != '-' ||
+       !front_matter_digits(s, 4, &tm.tm_year) ||
+       !front_matter_digits(s + 5, 2, &tm.tm_mon) ||
+       !front_matter_digits(s + 8, 2, &tm.tm_mday)) {
+        return false;
     }
 
-    return 200;
+    size_t pos = 10;
+
+    if(len >= 16 && (s[10] == ' ' || s[10] == 'T') && s[13] == ':') {
+        if(!front_matter_digits(s + 11, 2, &tm.tm_hour) ||
+           !front_matter_digits(s + 14, 2, &tm.tm_min)) {
+            return false;
+        }
+
+        pos = 16;
+
+        if(len >= 19 && s[16] == ':') {
+            if(!front_matter_digits(s + 17, 2, &tm.tm_sec)) {
+                return false;
+            }
+
+            pos = 19;
+        }
+    }
+
+    bool utc = pos + 1 == len && s[pos] == 'Z';
+
+    if(pos != len && !utc) {
+        return false;
+    }
+
+    if(tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31 ||
+       tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 60) {
+        return false;
+    }
+
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+
+    *date = utc ? timegm(&tm) : mktime(&tm);
+
+    return *date != (time_t) -1;
 }
 
-int entry_get_text(struct entry *entry) {
+size_t entry_front_matter(const char *text, size_t size, struct front_matter *fm) {
+    memset(fm, 0, sizeof(struct front_matter));
+
+    const char *end = text + (size < ENTRY_FRONT_MATTER_MAX ? size : ENTRY_FRONT_MATTER_MAX);
+    const char *line = text;
+    const char *next;
+    ssize_t len = text == NULL ? -1 : front_matter_line(line, end, &next);
+
+    if(len != 3 || memcmp(line, "---", 3) != 0) {
+        return 0;
+    }
+
+    struct front_matter result;
+    memset(&result, 0, sizeof(struct front_matter));
+
+    for(;;) {
+        line = next;
+        len = front_matter_line(line, end, &next);
+
+        if(len == -1 && end - line == 3 && (size_t) (end - text) == size) {
+            // closing delimiter at the very end of the file
+            len = 3;
+            next = end;
+        }
+
+        if(len == -1) {
+            return 0;
+        } else if(len == 3 && memcmp(line, "---", 3) == 0) {
+            break;
+        }
+
+        const char *colon = memchr(line, ':', len);
+
+        if(colon == NULL) {
+            continue;
+        }
+
+        size_t key_len = colon - line;
+        const char *value = colon + 1;
+        const char *value_end = line + len;
+
+        while(value < value_end && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+
+        while(value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+            value_end--;
+        }
+
+        if(value_end - value >= 2 && *value == '"' && value_end[-1] == '"') {
+            value++;
+            value_end--;
+        }
+
+        size_t value_len = value_end - value;
+
+        if(key_len == 5 && memcmp(line, "title", 5) == 0) {
+            result.title = value;
+            result.title_len = value_len;
+        } else if(key_len == 4 && memcmp(line, "tags", 4) == 0) {
+            result.tags = value;
+            result.tags_len = value_len;
+        } else if(key_len == 7 && memcmp(line, "summary", 7) == 0) {
+            result.summary = value;
+            result.summary_len = value_len;
+        } else if(key_len == 4 && memcmp(line, "date", 4) == 0) {
+            result.has_date = front_matter_date(value, value_len, &result.date);
+        }
+    }
+
+    result.size = next - text;
+    *fm = result;
+
+    return fm->size;
+}
+
+/*!
+ * @brief Where an HTML excerpt may be cut
+ *
+ * Result of scanning the start of an entry with `excerpt_scan_html()`.
+ */
+struct excerpt_scan {
+    const char *open[ENTRY_EXCERPT_NESTING]; //!< names of the open elements
+    size_t open_len[ENTRY_EXCERPT_NESTING];  //!< lengths of the names in `open`
+    size_t depth;     //!< number of open elements, only the first are stored
+    size_t top_cut;   //!< end of the last top level element
+    size_t space_cut; //!< position of the last whitespace outside of tags
+    ssize_t marker;   //!< position of `ENTRY_EXCERPT_MARKER` or -1
+};
+
+static const char *void_elements[] = {
+    "area", "base", "br", "col", "embed", "hr", "img", "input",
+    "link", "meta", "param", "source", "track", "wbr", NULL
+};
+
+static const char *raw_text_elements[] = { "script", "style", "textarea", NULL };
+
+static bool excerpt_name_in(const char *name, size_t len, const char **names) {
+    for(; *names != NULL; names++) {
+        if(strlen(*names) == len && strncasecmp(name, *names, len) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Position after the closing tag of the raw text element name
+ * starting at text + i or 0 if it doesn't end before end.
+ */
+static size_t excerpt_skip_raw_text(const char *text, size_t i, size_t end, const char *name, size_t len) {
+    while(i < end) {
+        const char *close = memmem(text + i, end - i, "</", 2);
+
+        if(close == NULL) {
+            return 0;
+        }
+
+        i = close - text + 2;
+
+        if(end - i > len && strncasecmp(text + i, name, len) == 0) {
+            const char *gt = memchr(text + i, '>', end - i);
+
+            return gt == NULL ? 0 : (size_t) (gt - text) + 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Scans the HTML in text up to end for the positions it may be cut
+ * at. Stops early at the marker or a tag not ending before end.
+ */
+static void excerpt_scan_html(const char *text, size_t end, struct excerpt_scan *s) {
+    size_t marker_len = strlen(ENTRY_EXCERPT_MARKER);
+    size_t i = 0;
+
+    s->depth = 0;
+    s->top_cut = 0;
+    s->space_cut = 0;
+    s->marker = -1;
+
+    while(i < end) {
+        if(text[i] != '<') {
+            if(isspace((unsigned char) text[i])) {
+                s->space_cut = i;
+            }
+
+            i++;
+            continue;
+        }
+
+        if(end - i >= marker_len && memcmp(text + i, ENTRY_EXCERPT_MARKER, marker_len) == 0) {
+            s->marker = i;
+            return;
+        }
+
+        if(end - i >= 4 && memcmp(text + i, "<!--", 4) == 0) {
+            const char *close = memmem(text + i + 4, end - i - 4, "-->", 3);
+
+            if(close == NULL) {
+                return;
+            }
+
+            i = close - text + 3;
+        } else {
+            const char *gt = memchr(text + i, '>', end - i);
+
+            if(gt == NULL) {
+                return;
+            }
+
+            bool closing = text[i + 1] == '/';
+            const char *name = text + i + 1 + closing;
+            size_t len = 0;
+
+            while(name + len < gt && (isalnum((unsigned char) name[len]) || name[len] == '-')) {
+                len++;
+            }
+
+            i = gt - text + 1;
+
+            if(len == 0) {
+                // <!doctype …> etc. don't nest
+            } else if(closing && s->depth > ENTRY_EXCERPT_NESTING) {
+                s->depth--;
+            } else if(closing) {
+                // pop up to the matching element, stray closing tags are ignored
+                size_t d = s->depth;
+
+                while(d > 0 && (s->open_len[d - 1] != len ||
+                                strncasecmp(s->open[d - 1], name, len) != 0)) {
+                    d--;
+                }
+
+                if(d > 0) {
+                    s->depth = d - 1;
+                }
+            } else if(excerpt_name_in(name, len, raw_text_elements)) {
+                // the contents aren't HTML, so skip them as a whole
+                i = excerpt_skip_raw_text(text, i, end, name, len);
+
+                if(i == 0) {
+                    return;
+                }
+            } else if(gt[-1] != '/' && !excerpt_name_in(name, len, void_elements)) {
+                if(s->depth < ENTRY_EXCERPT_NESTING) {
+                    s->open[s->depth] = name;
+                    s->open_len[s->depth] = len;
+                }
+
+                s->depth++;
+            }
+        }
+
+        if(s->depth == 0) {
+            s->top_cut = i;
+        }
+    }
+}
+
+/*
+ * Like excerpt_scan_html() for Markdown, top_cut being the
+ * last blank line and space_cut the last line break.
+ */
+static void excerpt_scan_markdown(const char *text, size_t end, struct excerpt_scan *s) {
+    const char *marker = memmem(text, end, ENTRY_EXCERPT_MARKER, strlen(ENTRY_EXCERPT_MARKER));
+    bool fenced = false;
+    size_t i = 0;
+
+    s->depth = 0;
+    s->top_cut = 0;
+    s->space_cut = 0;
+    s->marker = marker == NULL ? -1 : marker - text;
+
+    if(marker != NULL) {
+        end = marker - text;
+    }
+
+    while(i < end) {
+        const char *nl = memchr(text + i, '\n', end - i);
+
+        if(nl == NULL) {
+            break;
+        }
+
+        const char *line = text + i;
+        size_t indent = 0;
+
+        while(indent < 3 && line[indent] == ' ') {
+            indent++;
+        }
+
+        if(nl - line - indent >= 3 &&
+           (memcmp(line + indent, "```", 3) == 0 || memcmp(line + indent, "~~~", 3) == 0)) {
+            fenced = !fenced;
+        } else if(!fenced && nl - line - indent <= 1 && (line[indent] == '\n' || line[indent] == '\r')) {
+            s->top_cut = i;
+        }
+
+        i = nl - text + 1;
+
+        if(!fenced) {
+            s->space_cut = i;
+        }
+    }
+}
+
+ssize_t entry_excerpt(const char *text, size_t size, bool complete, size_t max,
+                      char *out, bool *truncated) {
+    struct excerpt_scan s;
+    size_t end = size < max ? size : max;
+    size_t cut;
+
+    if(BLOG_MARKDOWN) {
+        excerpt_scan_markdown(text, end, &s);
+    } else {
+        excerpt_scan_html(text, end, &s);
+    }
+
+    *truncated = true;
+
+    if(s.marker != -1) {
+        cut = s.marker;
+    } else if(complete && size <= max) {
+        cut = size;
+        *truncated = false;
+    } else {
+        cut = s.top_cut >= max / 2 || s.space_cut == 0 ? s.top_cut : s.space_cut;
+    }
+
+    if(cut == 0 && *truncated) {
+        return -1;
+    }
+
+    // find the elements still open at the cut
+    if(!BLOG_MARKDOWN && *truncated) {
+        excerpt_scan_html(text, cut, &s);
+    } else {
+        s.depth = 0;
+    }
+
+    if(s.depth > ENTRY_EXCERPT_NESTING) {
+        return -1;
+    }
+
+    memcpy(out, text, cut);
+
+    size_t len = cut;
+
+    while(s.depth > 0) {
+        s.depth--;
+
+        if(s.open_len[s.depth] > ENTRY_EXCERPT_NAME_MAX) {
+            return -1;
+        }
+
+        out[len++] = '<';
+        out[len++] = '/';
+        memcpy(out + len, s.open[s.depth], s.open_len[s.depth]);
+        len += s.open_len[s.depth];
+        out[len++] = '>';
+    }
+
+    return len;
+}
+
+const char *entry_next_tag(const char **tags, size_t *len) {
+    const char *p = *tags;
+
+    while(p != NULL && *p != '\0') {
+        const char *comma = strchr(p, ',');
+        const char *end = comma == NULL ? p + strlen(p) : comma;
+        const char *tag = p;
+
+        p = comma == NULL ? end : comma + 1;
+
+        while(tag < end && (*tag == ' ' || *tag == '\t')) {
+            tag++;
+        }
+
+        while(end > tag && (end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
+
+        if(end > tag) {
+            *tags = p;
+            *len = end - tag;
+            return tag;
+        }
+    }
+
+    *tags = p;
+
+    return NULL;
+}
+
+/*
+ * Replaces *field with a copy of the len bytes at value.
+ */
+static void entry_set_field(char **field, const char *value, size_t len) {
+    char *copy = value == NULL ? NULL : strndup(value, len);
+
+    if(copy != NULL) {
+        free(*field);
+        *field = copy;
+    }
+}
+
+/*
+ * Advances the entry's text past its front matter,
+ * taking the metadata from it unless the index has.
+ */
+static void entry_skip_front_matter(struct entry *entry) {
+    struct front_matter fm;
+
+    if(entry->text == NULL || entry_front_matter(entry->text, entry->text_size, &fm) == 0) {
+        return;
+    }
+
+    if(!entry->indexed) {
+        entry_set_field(&entry->title, fm.title, fm.title_len);
+        entry_set_field(&entry->tags, fm.tags, fm.tags_len);
+        entry_set_field(&entry->summary, fm.summary, fm.summary_len);
+
+        if(fm.has_date) {
+            entry->time = entry_clamp_time(entry, fm.date);
+        }
+    }
+
+    entry->text += fm.size;
+    entry->text_size -= fm.size;
+    entry->text_skip += fm.size;
+}
+
+#if BLOG_MARKDOWN
+/*!
+ * @brief Start of a file of cached HTML
+ *
+ * Identifies the version of the Markdown file the HTML has been converted
+ * from, so the cache is only used as long as the file stays the same.
+ */
+struct html_cache_key {
+    char magic[8];      //!< `"sbhtml1"` including the `NUL` byte
+    int64_t mtime_sec;  //!< modification time (seconds) of the Markdown file
+    int64_t mtime_nsec; //!< modification time (nanoseconds) of the Markdown file
+    uint64_t size;      //!< size of the Markdown file
+};
+
+#define HTML_CACHE_MAGIC "sbhtml1"
+
+static void html_cache_key(struct html_cache_key *key, const struct stat *info) {
+    memset(key, 0, sizeof(struct html_cache_key));
+    memcpy(key->magic, HTML_CACHE_MAGIC, sizeof(key->magic));
+    key->mtime_sec = info->st_mtim.tv_sec;
+    key->mtime_nsec = info->st_mtim.tv_nsec;
+    key->size = info->st_size;
+}
+
+/*
+ * Advances the text of an entry loaded from the HTML cache past its key.
+ */
+static int entry_skip_html_key(struct entry *entry, int result) {
+    if(result != -1 && entry->text != NULL && entry->text_size >= sizeof(struct html_cache_key)) {
+        entry->text += sizeof(struct html_cache_key);
+        entry->text_size -= sizeof(struct html_cache_key);
+        entry->text_skip = sizeof(struct html_cache_key);
+    }
+
+    return result;
+}
+/*
+ * Path of the cached HTML of the entry at path: BLOG_CACHE_DIR/html-name
+ * where name is the path relative to BLOG_DIR with slashes (and percent
+ * signs) percent encoded. NULL if there is no cache.
+ */
+static char *entry_html_path(const char *path) {
+#ifdef BLOG_CACHE_DIR
+    size_t dir_len = strlen(BLOG_DIR);
+
+    if(dir_len > 0 && BLOG_DIR[dir_len - 1] == '/') {
+        dir_len--;
+    }
+
+    const char *name = path;
+
+    if(strncmp(path, BLOG_DIR, dir_len) == 0 && path[dir_len] == '/') {
+        name += dir_len + 1;
+    }
+
+    const char *prefix = BLOG_CACHE_DIR "/html-";
+    size_t prefix_len = strlen(prefix);
+    char *html_path = malloc(prefix_len + 3 * strlen(name) + 1);
+
+    if(html_path == NULL) {
+        return NULL;
+    }
+
+    memcpy(html_path, prefix, prefix_len);
+
+    char *p = html_path + prefix_len;
+
+    for(; *name != '\0'; name++) {
+        if(*name == '/' || *name == '%') {
+            *p++ = '%';
+            *p++ = nibble_hex(*name >> 4);
+            *p++ = nibble_hex(*name & 15);
+        } else {
+            *p++ = *name;
+        }
+    }
+
+    *p = '\0';
+
+    return html_path;
+#else
+    (void) path;
+    return NULL;
+#endif
+}
+#endif
+
+void entry_prefetch(int blog_dir_fd, const char *name, const char *path) {
+    struct prefetched_file *slot = prefetched + prefetched_next;
+
+    prefetched_next = (prefetched_next + 1) % ENTRY_PREFETCH_DISTANCE;
+
+    // evict the oldest prefetched file if it hasn't been used
+    if(slot->path != NULL) {
+        close(slot->fd);
+        free(slot->path);
+        slot->path = NULL;
+    }
+
+#if BLOG_MARKDOWN
+    // usually only the cached HTML needs to be read
+    char *slot_path = entry_html_path(path);
+    int fd = slot_path == NULL ? -1 : open(slot_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+    (void) blog_dir_fd;
+    (void) name;
+#else
+    char *slot_path = strdup(path);
+    int fd = slot_path == NULL ? -1 : openat(blog_dir_fd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+#endif
+
+    if(fd == -1) {
+        free(slot_path);
+        return;
+    }
+
+    slot->path = slot_path;
+    slot->fd = fd;
+
+    // start reading the file in the background if it isn't cached
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+}
+
+void entry_prefetch_clear(void) {
+    for(size_t i = 0; i < ENTRY_PREFETCH_DISTANCE; i++) {
+        if(prefetched[i].path != NULL) {
+            close(prefetched[i].fd);
+            free(prefetched[i].path);
+            prefetched[i].path = NULL;
+        }
+    }
+
+    prefetched_next = 0;
+}
+
+/*
+ * Opens path for reading, using a file descriptor
+ * from entry_prefetch() if there is one.
+ */
+static int entry_open(const char *path) {
+    for(size_t i = 0; i < ENTRY_PREFETCH_DISTANCE; i++) {
+        if(prefetched[i].path != NULL && strcmp(prefetched[i].path, path) == 0) {
+            free(prefetched[i].path);
+            prefetched[i].path = NULL;
+
+            return prefetched[i].fd;
+        }
+    }
+
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/*
+ * Reads the file at fd which is expected to be size bytes large into the
+ * reusable text buffer, followed by a NUL byte. One more byte than expected
+ * is requested, so a file that has grown is noticed without calling fstat().
+ * Returns the number of bytes read or -1 on error.
+ */
+static ssize_t entry_read_text(struct entry *entry, int fd, size_t size) {
+    if(text_buffer_size < size + 2) {
+        char *tmp = realloc(text_buffer, size + 2);
+
+        if(tmp == NULL) {
+            return -1;
+        }
+
+        text_buffer = tmp;
+        text_buffer_size = size + 2;
+    }
+
+    size_t pos = 0;
+
+    while(pos < size + 1) {
+        ssize_t n = pread(fd, text_buffer + pos, size + 1 - pos, pos);
+
+        if(n == -1 && errno == EINTR) {
+            continue;
+        } else if(n == -1) {
+            return -1;
+        } else if(n == 0) {
+            // end of file, possibly truncated since it was checked
+            break;
+        }
+
+        pos += n;
+    }
+
+    if(pos <= size) {
+        text_buffer[pos] = '\0';
+        text_buffer_used = true;
+
+        entry->text = text_buffer;
+        entry->text_size = pos;
+    }
+
+    return pos;
+}
+
+static int entry_map_text(struct entry *entry) {
     // TODO set errno correctly in all cases
     if(entry->text != NULL) {
         // nothing to do
         return 0;
     }
 
-    int fd = open(entry->path, O_RDONLY);
+    // use the file checked by make_entry() if possible
+    int fd = entry->fd;
+    entry->fd = -1;
+
+    if(fd == -1) {
+        fd = entry_open(entry->path);
+    }
 
     if(fd == -1) {
         return -1;
     }
 
+    size_t size = entry->file_size;
+
+    // the size is only verified using fstat() if it's unknown,
+    // the file needs to be mapped or turns out to have grown
+    if(size != (size_t) -1 && size <= ENTRY_TEXT_MMAP_THRESHOLD && !text_buffer_used) {
+        ssize_t n = entry_read_text(entry, fd, size);
+
+        if(n != -1 && (size_t) n <= size) {
+            return close(fd);
+        }
+    }
+
     struct stat file_info;
 
-    if(fstat(fd, &file_info) == -1) {
+    if(entry_stat(fd, "", &file_info) == -1) {
+        close(fd);
         return -1;
     }
 
-    if(file_info.st_size == 0) {
+    size = file_info.st_size;
+
+    if(size == 0) {
         close(fd);
         return 0;
     }
 
-    entry->text = mmap(NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(size <= ENTRY_TEXT_MMAP_THRESHOLD && !text_buffer_used) {
+        ssize_t result = entry_read_text(entry, fd, size);
+
+        if(close(fd) == -1) {
+            return -1;
+        }
+
+        return result == -1 ? -1 : 0;
+    }
+
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    // fault in all pages at once, the whole text is going to be read anyway
+    flags |= MAP_POPULATE;
+#endif
+
+    entry->text = mmap(NULL, size, PROT_READ, flags, fd, 0);
 
     if(entry->text == MAP_FAILED) {
         entry->text = NULL;
@@ -182,7 +1167,8 @@ int entry_get_text(struct entry *entry) {
         return -1;
     }
 
-    entry->text_size = file_info.st_size;
+    entry->text_size = size;
+    posix_madvise(entry->text, entry->text_size, POSIX_MADV_SEQUENTIAL);
 
     if(close(fd) == -1) {
         return -1;
@@ -191,9 +1177,192 @@ int entry_get_text(struct entry *entry) {
     return 0;
 }
 
+#if BLOG_MARKDOWN
+/*
+ * Converts the entry's Markdown to HTML, stores it in the cache
+ * at html_path after key and loads it as the entry's text.
+ */
+static int entry_render_html(struct entry *entry, const char *html_path,
+                             const struct html_cache_key *key) {
+    char *tmp_path = catn_alloc(2, html_path, ".XXXXXX");
+    int tmp_fd = tmp_path == NULL ? -1 : mkstemp(tmp_path);
+    FILE *out = tmp_fd == -1 ? NULL : fdopen(tmp_fd, "w");
+
+    if(out == NULL || entry_map_text(entry) == -1) {
+        if(out != NULL) {
+            fclose(out);
+        } else if(tmp_fd != -1) {
+            close(tmp_fd);
+        }
+
+        if(tmp_fd != -1) {
+            unlink(tmp_path);
+        }
+
+        free(tmp_path);
+        return -1;
+    }
+
+    metrics_add(METRICS_MARKDOWN_RENDERS, 1);
+
+    struct xml_context ctx;
+    new_xml_context(&ctx);
+    ctx.out = out;
+
+    // entry->text is NULL for empty files
+    const char *md = entry->text == NULL ? "" : entry->text;
+    size_t size = entry->text == NULL ? 0 : entry->text_size;
+    struct front_matter fm;
+    size_t skip = BLOG_FRONT_MATTER ? entry_front_matter(md, size, &fm) : 0;
+
+    // the front matter is kept, so it's still available when the cache is used
+    int result = fwrite(key, sizeof(struct html_cache_key), 1, out) != 1 ||
+                 (skip > 0 && fwrite(md, 1, skip, out) != skip) ? -1 : 0;
+
+    if(result == 0) {
+        result = markdown_to_html(&ctx, md + skip, size - skip);
+    }
+
+    del_xml_context(&ctx);
+    entry_unget_text(entry);
+    entry->text_size = 0;
+
+    int fd = result == 0 && fflush(out) == 0 ? dup(fileno(out)) : -1;
+
+    if(fclose(out) != 0 && fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+
+    // replace the old cache atomically, so concurrent readers never see a partial file
+    if(fd == -1 || rename(tmp_path, html_path) == -1) {
+        unlink(tmp_path);
+    }
+
+    free(tmp_path);
+
+    if(fd == -1) {
+        return -1;
+    }
+
+    entry->fd = fd;
+    entry->file_size = -1;
+
+    return entry_skip_html_key(entry, entry_map_text(entry));
+}
+
+/*
+ * Loads the cached HTML of the entry if its key matches the entry's
+ * Markdown file (see struct html_cache_key) and renders the entry's Markdown otherwise. If there is no cache
+ * or it can't be written, the Markdown is loaded to be converted while it
+ * is output by markdown_entry_text().
+ */
+static int entry_map_html(struct entry *entry) {
+    if(entry->text != NULL) {
+        // nothing to do
+        return 0;
+    }
+
+    // the key is taken from the Markdown file itself, since entry->mtime
+    // may come from an index that hasn't noticed an edit in place yet
+    struct stat md_info;
+    struct html_cache_key key;
+    bool have_key = (entry->fd != -1 ? entry_stat(entry->fd, "", &md_info)
+                                     : entry_stat(AT_FDCWD, entry->path, &md_info)) == 0;
+
+    if(have_key) {
+        html_cache_key(&key, &md_info);
+    }
+
+    char *html_path = have_key ? entry_html_path(entry->path) : NULL;
+    int fd = html_path == NULL ? -1 : entry_open(html_path);
+    struct html_cache_key cached;
+    struct stat html_info;
+
+    if(fd != -1 && pread(fd, &cached, sizeof(cached), 0) == sizeof(cached) &&
+       memcmp(&cached, &key, sizeof(key)) == 0 && entry_stat(fd, "", &html_info) == 0) {
+        // the Markdown itself isn't needed
+        if(entry->fd != -1) {
+            close(entry->fd);
+        }
+
+        entry->fd = fd;
+        entry->file_size = html_info.st_size;
+
+        free(html_path);
+
+        return entry_skip_html_key(entry, entry_map_text(entry));
+    }
+
+    if(fd != -1) {
+        close(fd);
+    }
+
+    int result = html_path == NULL ? -1 : entry_render_html(entry, html_path, &key);
+
+    free(html_path);
+
+    if(result == -1) {
+        result = entry_map_text(entry);
+        entry->text_markdown = result != -1 && entry->text != NULL;
+
+        if(entry->text_markdown) {
+            metrics_add(METRICS_MARKDOWN_RENDERS, 1);
+        }
+    }
+
+    return result;
+}
+#endif
+
+int entry_get_text(struct entry *entry) {
+    timing_start(TIMING_STAGE_TEXT);
+#if BLOG_MARKDOWN
+    int result = entry_map_html(entry);
+#else
+    int result = entry_map_text(entry);
+#endif
+
+    if(BLOG_FRONT_MATTER && result != -1) {
+        entry_skip_front_matter(entry);
+    }
+
+    timing_stop(TIMING_STAGE_TEXT);
+
+    if(result != -1) {
+        metrics_add(METRICS_ENTRIES_SERVED, 1);
+        metrics_add(METRICS_BYTES_SERVED, entry->text_size);
+    }
+
+    return result;
+}
+
 void entry_unget_text(struct entry *entry) {
-    if(entry->text_size > 0 && entry->text != NULL &&
-       munmap(entry->text, entry->text_size) != -1) {
+    entry->text_markdown = false;
+    entry->text_excerpt = false;
+
+    if(entry->text_indexed) {
+        entry->text_indexed = false;
+        entry->text_size = -1;
+        entry->text = NULL;
+        return;
+    }
+
+    if(entry->text != NULL) {
+        // restore what has been read or mapped
+        entry->text -= entry->text_skip;
+        entry->text_size += entry->text_skip;
+    }
+
+    entry->text_skip = 0;
+
+    if(entry->text != NULL && entry->text == text_buffer) {
+        // the buffer is kept for the next entry
+        text_buffer_used = false;
+        entry->text_size = -1;
+        entry->text = NULL;
+    } else if(entry->text_size > 0 && entry->text != NULL &&
+              munmap(entry->text, entry->text_size) != -1) {
         entry->text_size = -1;
         entry->text = NULL;
     }
@@ -212,5 +1381,18 @@ void free_entry(struct entry *entry) {
         free(entry->title);
     }
 
+    if(entry->tags != NULL) {
+        free(entry->tags);
+    }
+
+    if(entry->summary != NULL) {
+        free(entry->summary);
+    }
+
+    if(entry->fd != -1) {
+        close(entry->fd);
+        entry->fd = -1;
+    }
+
     entry_unget_text(entry);
 }
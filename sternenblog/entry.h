@@ -6,6 +6,9 @@
 #ifndef STERNENBLOG_ENTRY_H
 #define STERNENBLOG_ENTRY_H
 
+#include <sys/stat.h>
+#include <sys/types.h>
+
 #include "core.h"
 
 /*!
@@ -30,7 +33,8 @@
  * any indices), but may also be confusing. In the future an option to disable this
  * may be added.
  *
- * Before constructing the entry, `make_entry()` calls `stat()` to check if the given
+ * Before constructing the entry, `make_entry()` opens the file relative to the
+ * descriptor returned by `entry_dir_fd()` and calls `fstat()` on it to check if the given
  * entry a) exists b) is a regular file and c) is owned by the current processes user
  * or group. The last check ensures that the file is not only readable for the webserver,
  * but also owned by either its group or its user. This lessens the likelyhood of
@@ -41,11 +45,15 @@
  *
  * * `path` is set to the constructed path to the entry file (dynamically allocated)
  * * `title` is set to `path_info` with the leading slash removed (dynamically allocated)
- * * `time` is set to the file's modification time
+ * * `time` and `mtime` are set to the file's modification time,
+ *   `time` and `title` may be replaced by `entry_get_text()`
  * * `link` is set to `script_name` and `path_info` concatenated which is the absolute web
  *   server path corresponding to the entry
  * * `text_size` is set to `-1`
  * * `text` is set to `NULL`
+ * * `fd` is set to the opened file which `entry_get_text()` reads later,
+ *   so the file checked is guaranteed to be the one that's served
+ * * `file_size` is set to the file's size
  *
  * `make_entry()` may fail at any point with parts of the struct already containing
  * pointers to dynamically allocated memory. It is always safe to call `free_entry()`
@@ -66,11 +74,223 @@
  */
 int make_entry(const char *blog_dir, char *script_name, char *path_info, struct entry *entry);
 
+/*!
+ * @brief Directory file descriptor of `blog_dir`
+ *
+ * Opens `blog_dir` once and returns the same descriptor on subsequent calls,
+ * so entries can be opened using `openat()` without resolving the path to
+ * `blog_dir` again and again. Note that this means a persistently running
+ * process keeps using the directory even if `blog_dir` is replaced, e. g.
+ * by renaming another directory to its name.
+ *
+ * @param blog_dir Directory blog entries are stored in, usually `BLOG_DIR`
+ * @return file descriptor or -1 on error
+ */
+int entry_dir_fd(const char *blog_dir);
+
+/*!
+ * @brief Get the metadata of a file relevant to sternenblog
+ *
+ * Works like `fstatat()` or, if `name` is empty, like `fstat()` on `dir_fd`,
+ * but only device, inode, mode, owner, group, size and modification time are
+ * guaranteed to be set in `info`. On Linux `statx()` is used to only request
+ * those fields with `AT_STATX_DONT_SYNC`, so network file systems like NFS may
+ * answer from their attribute cache instead of asking the server every time.
+ *
+ * @param dir_fd directory `name` is relative to or file to query
+ * @param name path relative to `dir_fd` or `""`
+ * @param info structure to store the metadata in
+ * @return 0 on success, -1 on error with `errno` set
+ */
+int entry_stat(int dir_fd, const char *name, struct stat *info);
+
+/*!
+ * @brief Check whether a file may be served as an entry
+ *
+ * Performs the checks `make_entry()` does on the result of `stat()`:
+ * The file must be a regular file and, if `BLOG_STRICT_ACCESS` is enabled,
+ * be owned by the current process's user or group.
+ *
+ * @param file_info result of `stat()` for the file in question
+ * @return 200 if the file is acceptable, 403 or 404 otherwise
+ *
+ * @see make_entry
+ */
+int entry_check_file(const struct stat *file_info);
+
+/*!
+ * @brief Get the month an entry's shard stands for
+ *
+ * If `BLOG_SHARDED` is enabled and `shard` (relative to `BLOG_DIR`, without
+ * slashes around it) is a shard directory `yyyy/mm`, stores the first and
+ * last second of that month in local time at `start` and `end`. Publication
+ * times of entries in the shard are clamped to this range by both `make_entry()`
+ * and the index, so they agree with the order of the shards and the entries
+ * end up in the archive page of their shard's month.
+ *
+ * @param shard directory the entry is stored in
+ * @param shard_len length of `shard`
+ * @param start location to store the start of the month at
+ * @param end location to store the end of the month at
+ * @return `true` if `shard` is a shard directory, `false` otherwise
+ */
+bool entry_shard_month(const char *shard, size_t shard_len, time_t *start, time_t *end);
+
+/*!
+ * @brief Maximum size of the front matter of an entry
+ *
+ * Only this many bytes at the start of a file are
+ * considered when looking for its front matter.
+ */
+#define ENTRY_FRONT_MATTER_MAX 4096
+
+/*!
+ * @brief Metadata given in the front matter of an entry
+ *
+ * Strings point into the text the front matter has been parsed
+ * from and are not `NUL` terminated, they are `NULL` if missing.
+ *
+ * @see entry_front_matter
+ */
+struct front_matter {
+    size_t size;         //!< size of the front matter including its delimiters, 0 if there is none
+    const char *title;   //!< value of `title`
+    size_t title_len;    //!< length of `title`
+    const char *tags;    //!< value of `tags`
+    size_t tags_len;     //!< length of `tags`
+    const char *summary; //!< value of `summary`
+    size_t summary_len;  //!< length of `summary`
+    bool has_date;       //!< whether `date` is set
+    time_t date;         //!< value of `date`
+};
+
+/*!
+ * @brief Parse the front matter at the start of an entry
+ *
+ * If `BLOG_FRONT_MATTER` is enabled, an entry may start with a block of
+ * `key: value` lines delimited by lines consisting of `---`:
+ *
+ * ```
+ * ---
+ * title: Hello, World!
+ * date: 2020-08-12 14:00
+ * tags: c, cgi
+ * summary: A first entry.
+ * ---
+ * ```
+ *
+ * `date` is given as `yyyy-mm-dd`, optionally followed by a space or `T`
+ * and `hh:mm` or `hh:mm:ss` in local time or, if a `Z` is appended, UTC.
+ * Values may be enclosed in double quotes. Unknown keys, malformed lines
+ * and invalid dates are ignored. A front matter which isn't closed within
+ * the first `ENTRY_FRONT_MATTER_MAX` bytes isn't recognized.
+ *
+ * @param text start of the entry's file, doesn't need to be `NUL` terminated
+ * @param size size of `text` in bytes
+ * @param fm structure to store the result in
+ * @return size of the front matter, i. e. `fm->size`
+ */
+size_t entry_front_matter(const char *text, size_t size, struct front_matter *fm);
+
+/*!
+ * @brief Marker ending the excerpt of an entry
+ *
+ * @see entry_excerpt
+ */
+#define ENTRY_EXCERPT_MARKER "<!--more-->"
+
+/*!
+ * @brief Maximum number of elements an excerpt may cut through
+ */
+#define ENTRY_EXCERPT_NESTING 16
+
+/*!
+ * @brief Maximum length of the name of an element an excerpt may cut through
+ */
+#define ENTRY_EXCERPT_NAME_MAX 15
+
+/*!
+ * @brief Size of the buffer `entry_excerpt()` needs for excerpts of `max` bytes
+ *
+ * Room for the closing tags of the elements an excerpt cuts through.
+ */
+#define ENTRY_EXCERPT_SIZE(max) ((max) + ENTRY_EXCERPT_NESTING * (ENTRY_EXCERPT_NAME_MAX + 3))
+
+/*!
+ * @brief Cut the excerpt of an entry
+ *
+ * The excerpt ends before `ENTRY_EXCERPT_MARKER` if it occurs within the
+ * first `max` bytes of `text`. Otherwise it's the whole text, if that is no
+ * longer than `max`, or the text is cut at a safe boundary before `max`:
+ *
+ * * HTML is cut after the last top level element ending before `max` if
+ *   that leaves at least `max / 2` bytes, else at the last whitespace
+ *   outside of tags, comments and `script`, `style` or `textarea` elements.
+ *   The closing tags of elements still open at that point are appended.
+ * * Markdown (if `BLOG_MARKDOWN` is enabled) is cut the same way at the last
+ *   blank line or line break outside of a fenced code block.
+ *
+ * @param text text of the entry without its front matter
+ * @param size size of `text` which may be just the start of the entry
+ * @param complete whether `text` is the entry's whole text
+ * @param max maximum size of the excerpt without appended closing tags
+ * @param out buffer of `ENTRY_EXCERPT_SIZE(max)` bytes to store the excerpt in
+ * @param truncated set to whether the excerpt is only part of the text
+ * @return size of the excerpt in `out` or -1 if there is no safe boundary
+ */
+ssize_t entry_excerpt(const char *text, size_t size, bool complete, size_t max,
+                      char *out, bool *truncated);
+
+/*!
+ * @brief Get the next tag of a list of tags
+ *
+ * Iterates a list of tags like `entry->tags`: Tags are separated by
+ * commas, whitespace around them is ignored and empty tags are skipped.
+ *
+ * @param tags rest of the list, advanced past the returned tag
+ * @param len set to the length of the returned tag
+ * @return start of the tag (not `NUL` terminated) or `NULL` if there are no more
+ */
+const char *entry_next_tag(const char **tags, size_t *len);
+
+/*!
+ * @brief Number of entries to prefetch ahead when iterating an index
+ *
+ * @see entry_prefetch
+ * @see index_prefetch
+ */
+#define ENTRY_PREFETCH_DISTANCE 8
+
 /*!
  * @brief Populate an `entry`'s `text` field
  *
- * Reads the contents of `entry->path` into memory using `mmap()` and sets
- * `entry->text` and `entry->text_size` accordingly.
+ * Reads the contents of `entry->path` into memory and sets `entry->text`
+ * and `entry->text_size` accordingly. Small files are read into a buffer
+ * which is reused by the calling thread for the next entry after calling
+ * `entry_unget_text()`, larger files (or all files while the buffer is in
+ * use) are mapped using `mmap()`. Either way, `entry->text` is followed
+ * by a `NUL` byte unless the file's size is a multiple of the page size.
+ *
+ * The file descriptor opened by `make_entry()` or, failing that, one opened
+ * by `entry_prefetch()` is used if available and closed afterwards. The
+ * size the file had when it was checked (`entry->file_size`) is trusted
+ * for small files: One byte more than expected is read, so only files that
+ * have grown need to be checked again using `fstat()`.
+ *
+ * If `BLOG_MARKDOWN` is enabled, the entry's HTML is loaded instead:
+ * The cached HTML in `BLOG_CACHE_DIR` is used if its modification time
+ * matches `entry->mtime`, otherwise the entry is converted using
+ * `markdown_to_html()` and the cache is replaced. In that case, files
+ * opened by `entry_prefetch()` are the cached HTML files. Without a
+ * cache (or if it can't be written), the Markdown itself is loaded and
+ * `entry->text_markdown` is set, so `markdown_entry_text()` converts
+ * it while it is output.
+ *
+ * If `BLOG_FRONT_MATTER` is enabled, `entry->text` is advanced past the
+ * front matter of the entry (see `entry_front_matter()`). Unless the entry
+ * has been constructed by `index_get_entry()` which already took them from
+ * the index, `title`, `time`, `tags` and `summary` are set from it. The
+ * cached HTML of Markdown entries starts with the unchanged front matter.
  *
  * Must be called on an already completely constructed entry.
  *
@@ -83,10 +303,11 @@ int make_entry(const char *blog_dir, char *script_name, char *path_info, struct
 int entry_get_text(struct entry *entry);
 
 /*!
- * @brief Unmap the file referenced in a `struct entry`
+ * @brief Release the text of a `struct entry`
  *
- * Tries to `munmap()` the file pointed to by `entry->text`
- * if present, and updates `entry->text_size` accordingly.
+ * Tries to `munmap()` the file pointed to by `entry->text` if
+ * present or releases the read buffer for reuse, and updates
+ * `entry->text_size` accordingly.
  *
  * The rest of the struct is left untouched.
  *
@@ -94,6 +315,32 @@ int entry_get_text(struct entry *entry);
  */
 void entry_unget_text(struct entry *entry);
 
+/*!
+ * @brief Start reading an entry's file ahead of time
+ *
+ * Opens the file `name` relative to `blog_dir_fd` and advises the kernel to
+ * read it into the page cache using `posix_fadvise()`, so the I/O overlaps
+ * with rendering the entries before it. The file descriptor is kept until
+ * the next `entry_get_text()` for an entry with the given `path` uses it,
+ * or until it is evicted by later calls, up to `ENTRY_PREFETCH_DISTANCE`
+ * files per thread.
+ *
+ * @param blog_dir_fd descriptor of the blog directory, see `entry_dir_fd()`
+ * @param name path to the entry's file relative to the blog directory
+ * @param path path to the entry's file as found in `entry->path`
+ * @see entry_prefetch_clear
+ * @see index_prefetch
+ */
+void entry_prefetch(int blog_dir_fd, const char *name, const char *path);
+
+/*!
+ * @brief Close all files opened by `entry_prefetch()`
+ *
+ * Should be called after iterating an index, so
+ * no file descriptors are kept open between requests.
+ */
+void entry_prefetch_clear(void);
+
 /*!
  * @brief Free dynamically allocated parts on an `entry`
  *
@@ -1,133 +1,2198 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // for d_type and syscall()
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include <time.h>
+#include <unistd.h>
 
 #include "core.h"
+#include "../config.h"
+#include "cgiutil.h"
 #include "entry.h"
 #include "index.h"
+#include "metrics.h"
+#include "stringutil.h"
+#include "timing.h"
+
+#ifndef BLOG_SHARDED
+#define BLOG_SHARDED 0
+#endif
+
+#ifndef BLOG_FRONT_MATTER
+#define BLOG_FRONT_MATTER 0
+#endif
+
+#ifndef BLOG_EXCERPT
+#define BLOG_EXCERPT 0
+#endif
+
+#ifndef BLOG_MARKDOWN
+#define BLOG_MARKDOWN 0
+#endif
+
+/*!
+ * @brief Whether the start of every entry's file is read to build the index
+ */
+#define INDEX_READ_HEADS (BLOG_FRONT_MATTER || BLOG_EXCERPT > 0)
+
+/*!
+ * @brief Settings a segment's contents depend on
+ *
+ * Stored in every segment, so segments (e. g. index caches)
+ * built with different settings are not used.
+ */
+#define INDEX_OPTIONS ((uint64_t) BLOG_EXCERPT << 32 | BLOG_MARKDOWN << 1 | BLOG_FRONT_MATTER)
 
 /*!
- * @brief Base size of the allocated index array
+ * @brief Base size of the allocated index arrays
  *
- * Base count of `struct index` to use for allocation
- * of the `*entries` array in `make_index()`.
+ * Number of entries (or shards) to grow the arrays
+ * used while building an index by.
  *
  * @see make_index
  */
 #define BASE_INDEX_SIZE 64
 
-int entries_timesort_r(struct entry *a, struct entry *b) {
-    if(a == NULL && b == NULL) {
-        return 0;
-    } else if(a == NULL) {
-        return 1;
-    } else if(b == NULL) {
+/*!
+ * @brief Magic bytes at the start of every index segment
+ */
+#define INDEX_MAGIC "sbindex"
+
+/*!
+ * @brief Version of the index segment layout
+ *
+ * Must be incremented whenever `struct index_header` or
+ * the layout following it changes.
+ */
+#define INDEX_VERSION 6
+
+/*!
+ * @brief Bits of a segment's Bloom filter per name in its directory
+ *
+ * Together with `INDEX_FILTER_HASHES` this gives
+ * a false positive rate of about 0.1 %.
+ *
+ * @see index_missing
+ */
+#define INDEX_FILTER_BITS 16
+
+/*!
+ * @brief Number of bits set in a segment's Bloom filter per name
+ */
+#define INDEX_FILTER_HASHES 6
+
+/*!
+ * @brief Number of slots in the shared index table
+ *
+ * Every shard occupies one slot, so this is enough for
+ * the top level directory and about 85 years of shards.
+ *
+ * @see BLOG_SHARED_INDEX
+ */
+#define SHARED_INDEX_SLOTS 1024
+
+/*!
+ * @brief Slot of a shard in the shared index table
+ *
+ * Describes the shared memory object currently holding the segment
+ * of a shard. Writers serialize using a `fcntl()` lock on the slot
+ * and bump `seq` before and after updating it (seqlock), so readers
+ * can get a consistent view without taking any locks.
+ */
+struct shared_slot {
+    atomic_ullong key;        //!< shard the slot belongs to, 0 if unused
+    atomic_ullong seq;        //!< odd while the slot is being updated
+    atomic_ullong generation; //!< generation of the published segment, 0 if none
+    atomic_llong mtime_sec;   //!< modification time (seconds) of the shard when it was read
+    atomic_llong mtime_nsec;  //!< modification time (nanoseconds) of the shard when it was read
+};
+
+/*!
+ * @brief Size of the buffer directory entries are read into
+ *
+ * Large enough to read a directory with a few thousand
+ * entries using just a handful of `getdents64()` calls.
+ */
+#define DIR_READER_BUFFER_SIZE (64 * 1024)
+
+/*!
+ * @brief Directory being read
+ *
+ * On Linux, `getdents64()` is used directly to read directory entries
+ * in large batches, elsewhere it's a thin wrapper around `readdir()`.
+ *
+ * @see dir_reader_next
+ */
+struct dir_reader {
+    int fd;        //!< file descriptor of the directory
+#ifdef __linux__
+    char *buf;     //!< buffer of `struct linux_dirent64` records
+    size_t len;    //!< bytes in `buf`
+    size_t pos;    //!< offset of the next record in `buf`
+#else
+    DIR *dir;      //!< directory stream using `fd`
+#endif
+};
+
+#ifdef __linux__
+/*!
+ * @brief Record returned by the `getdents64()` system call
+ */
+struct linux_dirent64 {
+    uint64_t d_ino;         //!< inode number
+    int64_t d_off;          //!< offset of the next record
+    unsigned short d_reclen; //!< size of this record
+    unsigned char d_type;   //!< file type or `DT_UNKNOWN`
+    char d_name[];          //!< `NUL` terminated file name
+};
+#endif
+
+/*!
+ * @brief Sort key of an entry
+ *
+ * Compact representation of an entry used for sorting: Only the
+ * publication time (converted to an unsigned integer which
+ * sorts ascendingly in the desired order) and the entry's
+ * original position in the arrays.
+ */
+struct index_key {
+    uint64_t time; //!< inverted publication time, smaller means newer
+    size_t pos;    //!< position of the entry before sorting
+};
+
+/*!
+ * @brief Number of keys below which insertion sort is used
+ */
+#define INDEX_SORT_SMALL 32
+
+/*!
+ * @brief Unsorted, growable index segment used while reading a directory
+ */
+struct segment_builder {
+    size_t count;      //!< number of entries
+    size_t size;       //!< number of entries allocated
+    int64_t *times;    //!< publication times
+    int64_t *mtimes;   //!< modification times
+    uint64_t *sizes;   //!< file sizes
+    uint32_t *titles;  //!< offsets of titles in the pool
+    uint32_t *links;   //!< offsets of url encoded `PATH_INFO`s in the pool
+    uint32_t *paths;   //!< offsets of paths in the pool
+    uint32_t *tags;    //!< offsets of tags in the pool or `INDEX_NO_STRING`
+    uint32_t *summaries; //!< offsets of summaries in the pool or `INDEX_NO_STRING`
+    uint32_t *excerpts; //!< offsets of excerpts in the pool or `INDEX_NO_STRING`
+    uint32_t *flags;   //!< `INDEX_FLAG_*` bits
+    uint64_t *names;   //!< hashes of all names in the directory for the Bloom filter
+    size_t name_count; //!< number of names
+    size_t name_size;  //!< number of names allocated
+    char *pool;        //!< string pool
+    size_t pool_len;   //!< bytes used in the pool
+    size_t pool_size;  //!< bytes allocated for the pool
+    int64_t time_min;  //!< start of the shard's month, see `entry_shard_month()`
+    int64_t time_max;  //!< end of the shard's month, same as `time_min` if unrestricted
+};
+
+/*!
+ * @brief Metadata of an entry taken from the start of its file
+ *
+ * Strings are not `NUL` terminated.
+ *
+ * @see index_entry_head
+ */
+struct entry_head {
+    struct front_matter fm; //!< front matter, empty if `BLOG_FRONT_MATTER` is disabled
+    const char *excerpt;    //!< excerpt or `NULL`
+    size_t excerpt_len;     //!< length of `excerpt`
+    uint32_t flags;         //!< `INDEX_FLAG_*` bits
+};
+
+/*!
+ * @brief Entries of an outdated segment looked up by path
+ *
+ * Used while reading a directory again to take the front matter of
+ * unchanged entries from the segment read before instead of the files.
+ */
+struct segment_lookup {
+    const struct index_segment *segment; //!< outdated segment, `NULL` if there is none
+    size_t *slots;                       //!< hash table of entry positions + 1, 0 if empty
+    size_t mask;                         //!< number of slots - 1
+};
+
+/*
+ * Opens the directory name relative to parent_fd for reading.
+ */
+static int dir_reader_open(struct dir_reader *r, int parent_fd, const char *name) {
+    r->fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if(r->fd == -1) {
         return -1;
-    } else if(a->time > b->time) {
+    }
+
+#ifdef __linux__
+    r->len = r->pos = 0;
+    r->buf = malloc(DIR_READER_BUFFER_SIZE);
+
+    if(r->buf == NULL) {
+#else
+    r->dir = fdopendir(r->fd);
+
+    if(r->dir == NULL) {
+#endif
+        close(r->fd);
         return -1;
-    } else if(a->time < b->time) {
-        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Returns the next entry of the directory, setting name and type (one of
+ * the DT_* constants, DT_UNKNOWN if the file system doesn't report it).
+ * Returns 1 if an entry has been read, 0 at the end and -1 on error.
+ */
+static int dir_reader_next(struct dir_reader *r, const char **name, unsigned char *type) {
+#ifdef __linux__
+    if(r->pos >= r->len) {
+        long n = syscall(SYS_getdents64, r->fd, r->buf, DIR_READER_BUFFER_SIZE);
+
+        if(n <= 0) {
+            return n == 0 ? 0 : -1;
+        }
+
+        r->len = n;
+        r->pos = 0;
+    }
+
+    struct linux_dirent64 *ent = (struct linux_dirent64 *) (r->buf + r->pos);
+
+    r->pos += ent->d_reclen;
+    *name = ent->d_name;
+    *type = ent->d_type;
+
+    return 1;
+#else
+    errno = 0;
+    struct dirent *ent = readdir(r->dir);
+
+    if(ent == NULL) {
+        return errno == 0 ? 0 : -1;
+    }
+
+    *name = ent->d_name;
+#ifdef _DIRENT_HAVE_D_TYPE
+    *type = ent->d_type;
+#else
+    *type = DT_UNKNOWN;
+#endif
+
+    return 1;
+#endif
+}
+
+static void dir_reader_close(struct dir_reader *r) {
+#ifdef __linux__
+    free(r->buf);
+    close(r->fd);
+#else
+    closedir(r->dir);
+#endif
+}
+
+/*
+ * Whether a directory entry of the given type may be a regular
+ * file, i. e. needs to be checked using stat().
+ */
+static bool maybe_regular(unsigned char type) {
+    // symbolic links are followed like stat() does
+    return type == DT_REG || type == DT_LNK || type == DT_UNKNOWN;
+}
+
+/*
+ * Whether a directory entry of the given type may be a directory.
+ */
+static bool maybe_directory(unsigned char type) {
+    return type == DT_DIR || type == DT_LNK || type == DT_UNKNOWN;
+}
+
+static inline uint64_t index_key_time(int64_t time) {
+    // flip the sign bit, so signed times sort correctly as unsigned
+    // integers, and invert all bits to get descending order
+    return ~((uint64_t) time ^ ((uint64_t) 1 << 63));
+}
+
+/*
+ * Stable LSD radix sort of keys by time, byte by byte. Passes over
+ * bytes which are the same for all keys (usually the upper ones of
+ * timestamps) are skipped. tmp must be able to hold count keys.
+ */
+static void index_radix_sort(struct index_key *keys, struct index_key *tmp, size_t count) {
+    size_t histogram[sizeof(uint64_t)][256];
+    memset(histogram, 0, sizeof(histogram));
+
+    for(size_t i = 0; i < count; i++) {
+        for(size_t byte = 0; byte < sizeof(uint64_t); byte++) {
+            histogram[byte][(keys[i].time >> (byte * 8)) & 0xff]++;
+        }
+    }
+
+    struct index_key *from = keys;
+    struct index_key *to = tmp;
+
+    for(size_t byte = 0; byte < sizeof(uint64_t); byte++) {
+        size_t *counts = histogram[byte];
+
+        if(counts[(keys[0].time >> (byte * 8)) & 0xff] == count) {
+            continue;
+        }
+
+        // turn counts into start offsets
+        size_t offset = 0;
+        for(size_t d = 0; d < 256; d++) {
+            size_t c = counts[d];
+            counts[d] = offset;
+            offset += c;
+        }
+
+        for(size_t i = 0; i < count; i++) {
+            to[counts[(from[i].time >> (byte * 8)) & 0xff]++] = from[i];
+        }
+
+        struct index_key *swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if(from != keys) {
+        memcpy(keys, from, count * sizeof(struct index_key));
+    }
+}
+
+static void index_insertion_sort(struct index_key *keys, size_t count) {
+    for(size_t i = 1; i < count; i++) {
+        struct index_key key = keys[i];
+        size_t j = i;
+
+        while(j > 0 && keys[j - 1].time > key.time) {
+            keys[j] = keys[j - 1];
+            j--;
+        }
+
+        keys[j] = key;
+    }
+}
+
+static int index_key_compare(const void *a, const void *b) {
+    const struct index_key *x = a;
+    const struct index_key *y = b;
+
+    // positions break ties, so the order is the same as the radix sort's
+    if(x->time != y->time) {
+        return x->time < y->time ? -1 : 1;
+    }
+
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+/*
+ * Returns keys for the given times sorted newest first. Entries
+ * with the same modification time keep their relative order.
+ * If the buffer for the radix sort can't be allocated, qsort()
+ * is used instead. Only if the keys themselves can't be
+ * allocated, NULL is returned. The result must be freed using free().
+ */
+static struct index_key *index_sort(const int64_t *times, size_t count) {
+    struct index_key *keys = malloc(sizeof(struct index_key) * (count + 1));
+
+    if(keys == NULL) {
+        return NULL;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        keys[i].time = index_key_time(times[i]);
+        keys[i].pos = i;
+    }
+
+    if(count < INDEX_SORT_SMALL) {
+        index_insertion_sort(keys, count);
+        return keys;
+    }
+
+    struct index_key *tmp = malloc(sizeof(struct index_key) * count);
+
+    if(tmp == NULL) {
+        qsort(keys, count, sizeof(struct index_key), index_key_compare);
     } else {
-        return 0;
+        index_radix_sort(keys, tmp, count);
+        free(tmp);
+    }
+
+    return keys;
+}
+
+static uint64_t lookup_hash(const char *path) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for(; *path != '\0'; path++) {
+        hash = (hash ^ (unsigned char) *path) * 0x100000001b3;
+    }
+
+    return hash;
+}
+
+static uint64_t fingerprint_add(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+
+    for(size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3;
+    }
+
+    return hash;
+}
+
+/*
+ * Positions of the bits of the Bloom filter of size bytes set for the
+ * name with the given hash, derived from its two halves (double hashing).
+ */
+static uint64_t filter_bit(uint64_t hash, int i, size_t size) {
+    uint64_t h1 = hash & 0xffffffff;
+    uint64_t h2 = (hash >> 32) | 1;
+
+    return (h1 + i * h2) % ((uint64_t) size * 8);
+}
+
+static void filter_add(unsigned char *filter, size_t size, uint64_t hash) {
+    for(int i = 0; i < INDEX_FILTER_HASHES; i++) {
+        uint64_t bit = filter_bit(hash, i, size);
+        filter[bit / 8] |= 1 << (bit % 8);
     }
 }
 
-int make_index(const char *blog_dir, char *script_name, bool get_text, struct entry *entries[]) {
-    if(*entries != NULL) {
+static bool filter_contains(const unsigned char *filter, size_t size, uint64_t hash) {
+    for(int i = 0; i < INDEX_FILTER_HASHES; i++) {
+        uint64_t bit = filter_bit(hash, i, size);
+
+        if((filter[bit / 8] & 1 << (bit % 8)) == 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int builder_grow(struct segment_builder *b) {
+    size_t size = b->size + BASE_INDEX_SIZE;
+
+    if(size > SIZE_MAX/sizeof(int64_t)) {
         return -1;
     }
 
-    if(script_name == NULL) {
+    int64_t *times = realloc(b->times, size * sizeof(int64_t));
+    if(times != NULL) {
+        b->times = times;
+    }
+    int64_t *mtimes = realloc(b->mtimes, size * sizeof(int64_t));
+    if(mtimes != NULL) {
+        b->mtimes = mtimes;
+    }
+    uint64_t *sizes = realloc(b->sizes, size * sizeof(uint64_t));
+    if(sizes != NULL) {
+        b->sizes = sizes;
+    }
+    uint32_t *titles = realloc(b->titles, size * sizeof(uint32_t));
+    if(titles != NULL) {
+        b->titles = titles;
+    }
+    uint32_t *links = realloc(b->links, size * sizeof(uint32_t));
+    if(links != NULL) {
+        b->links = links;
+    }
+    uint32_t *paths = realloc(b->paths, size * sizeof(uint32_t));
+    if(paths != NULL) {
+        b->paths = paths;
+    }
+    uint32_t *tags = realloc(b->tags, size * sizeof(uint32_t));
+    if(tags != NULL) {
+        b->tags = tags;
+    }
+    uint32_t *summaries = realloc(b->summaries, size * sizeof(uint32_t));
+    if(summaries != NULL) {
+        b->summaries = summaries;
+    }
+    uint32_t *excerpts = realloc(b->excerpts, size * sizeof(uint32_t));
+    if(excerpts != NULL) {
+        b->excerpts = excerpts;
+    }
+    uint32_t *flags = realloc(b->flags, size * sizeof(uint32_t));
+    if(flags != NULL) {
+        b->flags = flags;
+    }
+
+    if(times == NULL || mtimes == NULL || sizes == NULL || titles == NULL ||
+       links == NULL || paths == NULL || tags == NULL || summaries == NULL ||
+       excerpts == NULL || flags == NULL) {
         return -1;
     }
 
-    size_t index_count = 0;
-    DIR *dir;
+    b->size = size;
 
-    dir = opendir(blog_dir);
+    return 0;
+}
 
-    if(dir == NULL) {
+/*
+ * Appends a NUL terminated string of length len to the pool,
+ * storing its offset in off.
+ */
+static int builder_add_string(struct segment_builder *b, const char *str, size_t len, uint32_t *off) {
+    if(b->pool_len + len + 1 > UINT32_MAX) {
         return -1;
     }
 
-    struct dirent *ent;
+    if(b->pool_len + len + 1 > b->pool_size) {
+        size_t size = b->pool_size * 2 + len + 1;
+        char *tmp = realloc(b->pool, size);
 
-    size_t size = BASE_INDEX_SIZE;
-    *entries = malloc(sizeof(struct entry) * size);
+        if(tmp == NULL) {
+            return -1;
+        }
 
-    if(*entries == NULL) {
-        return -1;
+        b->pool = tmp;
+        b->pool_size = size;
     }
 
-    // losely based on musl's scandir(3)
-    // directly use struct entry instead of dirents,
-    // so we can directly use entries for filtering
-    // and later sorting
-    //
-    // TODO errno handling
-    while((ent = readdir(dir)) != NULL) {
-        if(ent->d_name[0] != '.') {
-            // build PATH_INFO for given entry
-            size_t d_name_len = strlen(ent->d_name);
-            char path_info[d_name_len + 2];
-            path_info[0] = '/';
-            memcpy(path_info + 1, ent->d_name, d_name_len + 1);
+    memcpy(b->pool + b->pool_len, str, len);
+    b->pool[b->pool_len + len] = '\0';
 
-            struct entry tmp_entry;
+    *off = b->pool_len;
+    b->pool_len += len + 1;
 
-            int result = make_entry(blog_dir, script_name, path_info, &tmp_entry);
+    return 0;
+}
 
-            if(result == 200) {
-                // increase array size if necessary
-                if(index_count >= size) {
-                    size += BASE_INDEX_SIZE;
+/*
+ * Like builder_add_string(), but str may be NULL
+ * in which case off is set to INDEX_NO_STRING.
+ */
+static int builder_add_optional(struct segment_builder *b, const char *str, size_t len, uint32_t *off) {
+    if(str == NULL) {
+        *off = INDEX_NO_STRING;
+        return 0;
+    }
 
-                    if(size > SIZE_MAX/sizeof(struct entry)) {
-                        break;
-                    }
+    return builder_add_string(b, str, len, off);
+}
 
-                    struct entry *tmp = realloc(*entries, size * sizeof(struct entry));
+/*
+ * Adds a name found in the directory to the builder's Bloom filter.
+ */
+static int builder_add_name(struct segment_builder *b, const char *name) {
+    if(b->name_count == b->name_size) {
+        size_t size = b->name_size + BASE_INDEX_SIZE;
+        uint64_t *names = size > SIZE_MAX/sizeof(uint64_t) ? NULL : realloc(b->names, size * sizeof(uint64_t));
 
-                    if(tmp == NULL) {
-                        break;
-                    }
+        if(names == NULL) {
+            return -1;
+        }
 
-                    *entries = tmp;
-                }
+        b->names = names;
+        b->name_size = size;
+    }
 
-                memcpy(*entries + index_count, &tmp_entry, sizeof(struct entry));
+    b->names[b->name_count++] = lookup_hash(name);
 
-                if(get_text) {
-                    entry_get_text(*entries + index_count);
-                }
+    return 0;
+}
 
-                index_count++;
-            } else {
-                free_entry(&tmp_entry);
-            }
+static void builder_free(struct segment_builder *b) {
+    free(b->times);
+    free(b->mtimes);
+    free(b->sizes);
+    free(b->titles);
+    free(b->links);
+    free(b->paths);
+    free(b->tags);
+    free(b->summaries);
+    free(b->excerpts);
+    free(b->flags);
+    free(b->names);
+    free(b->pool);
+}
+
+/*
+ * Adds an entry with the given PATH_INFO (relative to blog_dir) to the builder.
+ * head is the metadata from the start of the entry's file, NULL if not read.
+ */
+static int builder_add(struct segment_builder *b, const char *path_info, const struct stat *info,
+                       const struct entry_head *head) {
+    if(b->count >= b->size && builder_grow(b) == -1) {
+        return -1;
+    }
+
+    size_t path_info_len = strlen(path_info);
+
+    // title and path are the same (PATH_INFO without the slash) unless given
+    uint32_t path;
+    if(builder_add_string(b, path_info + 1, path_info_len - 1, &path) == -1) {
+        return -1;
+    }
+
+    uint32_t title = path;
+    b->times[b->count] = info->st_mtime;
+    b->tags[b->count] = INDEX_NO_STRING;
+    b->summaries[b->count] = INDEX_NO_STRING;
+    b->excerpts[b->count] = INDEX_NO_STRING;
+    b->flags[b->count] = 0;
+
+    if(head != NULL) {
+        const struct front_matter *fm = &head->fm;
+
+        if((fm->title != NULL && builder_add_string(b, fm->title, fm->title_len, &title) == -1) ||
+           builder_add_optional(b, fm->tags, fm->tags_len, b->tags + b->count) == -1 ||
+           builder_add_optional(b, fm->summary, fm->summary_len, b->summaries + b->count) == -1 ||
+           builder_add_optional(b, head->excerpt, head->excerpt_len, b->excerpts + b->count) == -1) {
+            return -1;
+        }
+
+        if(fm->has_date) {
+            b->times[b->count] = fm->date;
+        }
+
+        b->flags[b->count] = head->flags;
+    }
+
+    // the same as make_entry() does, so listing and entry page agree
+    if(b->time_min != b->time_max) {
+        if(b->times[b->count] < b->time_min) {
+            b->times[b->count] = b->time_min;
+        } else if(b->times[b->count] > b->time_max) {
+            b->times[b->count] = b->time_max;
         }
     }
 
-    closedir(dir);
+    char *link = catn_alloc(1, path_info);
+    int link_size = link == NULL ? -1 : urlencode_realloc(&link, path_info_len + 1);
+
+    if(link_size <= 0 ||
+       builder_add_string(b, link, strlen(link), b->links + b->count) == -1) {
+        free(link);
+        return -1;
+    }
+
+    free(link);
 
-    // reverse sort by time (use "incorrect" compar function
-    // to avoid using glibc specific qsort_r)
-    qsort(*entries, index_count, sizeof(struct entry),
-          (int (*)(const void *, const void *)) entries_timesort_r);
+    b->mtimes[b->count] = info->st_mtime;
+    b->sizes[b->count] = info->st_size;
+    b->titles[b->count] = title;
+    b->paths[b->count] = path;
+    b->count++;
 
-    return index_count;
+    return 0;
 }
 
-void free_index(struct entry *entries[], int count) {
-    if(count > 0) {
-        for(int i = 0; i < count; i++) {
-            free_entry(*entries + i);
+/*
+ * Points the members of segment to the right locations in
+ * segment->header which must be a block of block_size bytes.
+ * Fails if the block is not a valid index segment.
+ */
+static int segment_init(struct index_segment *segment, size_t block_size) {
+    const struct index_header *h = segment->header;
+
+    if(block_size < sizeof(struct index_header) ||
+       memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0 ||
+       h->version != INDEX_VERSION ||
+       h->header_size != sizeof(struct index_header) ||
+       h->options != INDEX_OPTIONS) {
+        return -1;
+    }
+
+    size_t entry_size = 3 * sizeof(int64_t) + 7 * sizeof(uint32_t);
+
+    if(h->count > (block_size - sizeof(struct index_header)) / entry_size ||
+       h->filter_size == 0 || h->filter_size % 8 != 0 ||
+       h->filter_size > block_size - sizeof(struct index_header) - h->count * entry_size ||
+       h->pool_size != block_size - sizeof(struct index_header) - h->count * entry_size - h->filter_size) {
+        return -1;
+    }
+
+    const char *p = (const char *) h + sizeof(struct index_header);
+
+    segment->block_size = block_size;
+    segment->count = h->count;
+    segment->times = (const int64_t *) p;
+    p += h->count * sizeof(int64_t);
+    segment->mtimes = (const int64_t *) p;
+    p += h->count * sizeof(int64_t);
+    segment->sizes = (const uint64_t *) p;
+    p += h->count * sizeof(uint64_t);
+    segment->titles = (const uint32_t *) p;
+    p += h->count * sizeof(uint32_t);
+    segment->links = (const uint32_t *) p;
+    p += h->count * sizeof(uint32_t);
+    segment->paths = (const uint32_t *) p;
+    p += h->count * sizeof(uint32_t);
+    segment->tags = (const uint32_t *) p;
+    p += h->count * sizeof(uint32_t);
+    segment->summaries = (const uint32_t *) p;
+    p += h->count * sizeof(uint32_t);
+    segment->excerpts = (const uint32_t *) p;
+    p += h->count * sizeof(uint32_t);
+    segment->flags = (const uint32_t *) p;
+    p += h->count * sizeof(uint32_t);
+    segment->filter = (const unsigned char *) p;
+    p += h->filter_size;
+    segment->pool = p;
+
+    // make sure no string can run past the end of the pool
+    if(h->pool_size > 0 && segment->pool[h->pool_size - 1] != '\0') {
+        return -1;
+    }
+
+    for(size_t i = 0; i < segment->count; i++) {
+        if(segment->titles[i] >= h->pool_size || segment->links[i] >= h->pool_size ||
+           segment->paths[i] >= h->pool_size ||
+           (segment->tags[i] != INDEX_NO_STRING && segment->tags[i] >= h->pool_size) ||
+           (segment->summaries[i] != INDEX_NO_STRING && segment->summaries[i] >= h->pool_size) ||
+           (segment->excerpts[i] != INDEX_NO_STRING && segment->excerpts[i] >= h->pool_size)) {
+            return -1;
         }
     }
 
-    free(*entries);
+    return 0;
+}
+
+/*
+ * Sorts the entries of the builder and lays them out into a single
+ * dynamically allocated block as described by struct index_header.
+ */
+static int segment_from_builder(struct segment_builder *b, const struct stat *dir_info,
+                                struct index_segment *segment) {
+    timing_start(TIMING_STAGE_SORT);
+    struct index_key *keys = index_sort(b->times, b->count);
+    timing_stop(TIMING_STAGE_SORT);
+
+    if(keys == NULL) {
+        return -1;
+    }
+
+    // rounded up to whole 64 bit words, so the pool stays aligned
+    size_t filter_size = (b->name_count * INDEX_FILTER_BITS / 8 + 7) / 8 * 8;
+    if(filter_size == 0) {
+        filter_size = 8;
+    }
+
+    size_t block_size = sizeof(struct index_header)
+        + b->count * (3 * sizeof(int64_t) + 7 * sizeof(uint32_t))
+        + filter_size + b->pool_len;
+
+    struct index_header *h = malloc(block_size);
+
+    if(h == NULL) {
+        free(keys);
+        return -1;
+    }
+
+    memset(h, 0, sizeof(struct index_header));
+    memcpy(h->magic, INDEX_MAGIC, sizeof(h->magic));
+    h->version = INDEX_VERSION;
+    h->header_size = sizeof(struct index_header);
+    h->dir_mtime_sec = dir_info->st_mtim.tv_sec;
+    h->dir_mtime_nsec = dir_info->st_mtim.tv_nsec;
+    h->count = b->count;
+    h->pool_size = b->pool_len;
+    h->options = INDEX_OPTIONS;
+    h->filter_size = filter_size;
+
+    char *p = (char *) h + sizeof(struct index_header);
+    int64_t *times = (int64_t *) p;
+    p += b->count * sizeof(int64_t);
+    int64_t *mtimes = (int64_t *) p;
+    p += b->count * sizeof(int64_t);
+    uint64_t *sizes = (uint64_t *) p;
+    p += b->count * sizeof(uint64_t);
+    uint32_t *titles = (uint32_t *) p;
+    p += b->count * sizeof(uint32_t);
+    uint32_t *links = (uint32_t *) p;
+    p += b->count * sizeof(uint32_t);
+    uint32_t *paths = (uint32_t *) p;
+    p += b->count * sizeof(uint32_t);
+    uint32_t *tags = (uint32_t *) p;
+    p += b->count * sizeof(uint32_t);
+    uint32_t *summaries = (uint32_t *) p;
+    p += b->count * sizeof(uint32_t);
+    uint32_t *excerpts = (uint32_t *) p;
+    p += b->count * sizeof(uint32_t);
+    uint32_t *flags = (uint32_t *) p;
+    p += b->count * sizeof(uint32_t);
+    unsigned char *filter = (unsigned char *) p;
+    p += filter_size;
+
+    // FNV-1a of every entry's path, mtime and size, see search_fingerprint()
+    uint64_t fingerprint = 0xcbf29ce484222325;
+
+    // gather every array in sorted order, the pool stays as is
+    for(size_t i = 0; i < b->count; i++) {
+        size_t pos = keys[i].pos;
+        const char *path = b->pool + b->paths[pos];
+
+        fingerprint = fingerprint_add(fingerprint, path, strlen(path) + 1);
+        fingerprint = fingerprint_add(fingerprint, b->mtimes + pos, sizeof(int64_t));
+        fingerprint = fingerprint_add(fingerprint, b->sizes + pos, sizeof(uint64_t));
+
+        times[i] = b->times[pos];
+        mtimes[i] = b->mtimes[pos];
+        sizes[i] = b->sizes[pos];
+        titles[i] = b->titles[pos];
+        links[i] = b->links[pos];
+        paths[i] = b->paths[pos];
+        tags[i] = b->tags[pos];
+        summaries[i] = b->summaries[pos];
+        excerpts[i] = b->excerpts[pos];
+        flags[i] = b->flags[pos];
+    }
+
+    h->fingerprint = fingerprint;
+
+    memset(filter, 0, filter_size);
+    for(size_t i = 0; i < b->name_count; i++) {
+        filter_add(filter, filter_size, b->names[i]);
+    }
+
+    if(b->pool_len > 0) {
+        memcpy(p, b->pool, b->pool_len);
+    }
+
+    free(keys);
+
+    segment->header = h;
+    segment->mapped = false;
+
+    return segment_init(segment, block_size);
+}
+
+static void segment_free(struct index_segment *segment) {
+    free(segment->shard);
+    segment->shard = NULL;
+
+    if(segment->header == NULL) {
+        return;
+    }
+
+    if(segment->mapped) {
+        munmap((void *) segment->header, segment->block_size);
+    } else {
+        free((void *) segment->header);
+    }
+
+    segment->header = NULL;
+}
+
+/*
+ * Whether segment has been read from the directory described by dir_info
+ * since it has last been changed.
+ */
+static bool segment_current(const struct index_segment *segment, const struct stat *dir_info) {
+    return segment->header->dir_mtime_sec == (int64_t) dir_info->st_mtim.tv_sec &&
+           segment->header->dir_mtime_nsec == (int64_t) dir_info->st_mtim.tv_nsec;
+}
+
+/*
+ * Path of the cache file for the given shard: BLOG_CACHE_DIR/index
+ * for the top level and BLOG_CACHE_DIR/index-yyyy-mm for a shard.
+ */
+static char *index_cache_path(const char *shard) {
+#ifdef BLOG_CACHE_DIR
+    char *path = catn_alloc(4, BLOG_CACHE_DIR, "/index", shard[0] == '\0' ? "" : "-", shard);
+
+    if(path != NULL) {
+        // flatten the shard's path
+        for(char *c = path + strlen(path) - strlen(shard); *c != '\0'; c++) {
+            if(*c == '/') {
+                *c = '-';
+            }
+        }
+    }
+
+    return path;
+#else
+    (void) shard;
+    return NULL;
+#endif
+}
+
+/*
+ * Maps the index cache at cache_path as segment,
+ * regardless of whether it is still current.
+ */
+static int index_cache_load(const char *cache_path, struct index_segment *segment) {
+    int fd = open(cache_path, O_RDONLY);
+
+    if(fd == -1) {
+        return -1;
+    }
+
+    struct stat cache_info;
+
+    if(fstat(fd, &cache_info) == -1 || (size_t) cache_info.st_size < sizeof(struct index_header)) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, cache_info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(map == MAP_FAILED) {
+        return -1;
+    }
+
+    segment->header = map;
+    segment->mapped = true;
+    segment->block_size = cache_info.st_size;
+
+    if(segment_init(segment, cache_info.st_size) == -1) {
+        segment_free(segment);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void index_cache_write(const char *cache_path, const struct index_segment *segment) {
+    char *tmp_path = catn_alloc(2, cache_path, ".XXXXXX");
+
+    if(tmp_path == NULL) {
+        return;
+    }
+
+    int fd = mkstemp(tmp_path);
+
+    if(fd == -1) {
+        free(tmp_path);
+        return;
+    }
+
+    const char *p = (const char *) segment->header;
+    size_t left = segment->block_size;
+
+    while(left > 0) {
+        ssize_t written = write(fd, p, left);
+
+        if(written <= 0) {
+            break;
+        }
+
+        p += written;
+        left -= written;
+    }
+
+    // replace the old cache atomically, so concurrent readers never see a partial file
+    if(close(fd) != 0 || left > 0 || rename(tmp_path, cache_path) == -1) {
+        unlink(tmp_path);
+    }
+
+    free(tmp_path);
+}
+
+#ifdef BLOG_SHARED_INDEX
+static struct shared_slot *shared_table = NULL;
+static int shared_table_fd = -1;
+// fcntl() locks are per process, so threads are serialized separately
+static pthread_mutex_t shared_build_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
+
+static void shared_open(void) {
+    size_t size = sizeof(struct shared_slot) * SHARED_INDEX_SLOTS;
+    int fd = shm_open(BLOG_SHARED_INDEX, O_RDWR | O_CREAT, 0600);
+
+    if(fd == -1) {
+        return;
+    }
+
+    // new objects are empty; extending them zeroes the table, i. e. all slots are unused
+    struct stat info;
+
+    if(fstat(fd, &info) == -1 || ((size_t) info.st_size < size && ftruncate(fd, size) == -1)) {
+        close(fd);
+        return;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if(map == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+
+    shared_table = map;
+    shared_table_fd = fd;
+}
+
+/*
+ * Key of the given shard in the shared table: 1 for the top level
+ * directory and a unique number derived from year and month otherwise.
+ * Returns 0 for anything else.
+ */
+static unsigned long long shared_key(const char *shard) {
+    if(shard[0] == '\0') {
+        return 1;
+    }
+
+    unsigned long long year = 0;
+    unsigned long long month = 0;
+    size_t i;
+
+    for(i = 0; i < 4 && shard[i] >= '0' && shard[i] <= '9'; i++) {
+        year = year * 10 + (shard[i] - '0');
+    }
+
+    if(i != 4 || shard[i++] != '/') {
+        return 0;
+    }
+
+    for(; i < 7 && shard[i] >= '0' && shard[i] <= '9'; i++) {
+        month = month * 10 + (shard[i] - '0');
+    }
+
+    return i == 7 && shard[i] == '\0' ? 2 + year * 100 + month : 0;
+}
+
+/*
+ * Returns the slot of the given shard in the shared table, claiming
+ * an unused one if necessary. Returns NULL if sharing is unavailable.
+ */
+static struct shared_slot *shared_slot(const char *shard) {
+    pthread_once(&shared_once, shared_open);
+
+    unsigned long long key = shared_key(shard);
+
+    if(shared_table == NULL || key == 0) {
+        return NULL;
+    }
+
+    for(size_t probe = 0; probe < SHARED_INDEX_SLOTS; probe++) {
+        struct shared_slot *slot = shared_table + (key + probe) % SHARED_INDEX_SLOTS;
+        unsigned long long expected = 0;
+
+        if(atomic_compare_exchange_strong(&slot->key, &expected, key) || expected == key) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Name of the shared memory object of a slot's generation.
+ */
+static char *shared_name(const struct shared_slot *slot, unsigned long long generation) {
+    char suffix[64];
+
+    snprintf(suffix, sizeof(suffix), "-%llu-%llu",
+             atomic_load_explicit(&slot->key, memory_order_relaxed), generation);
+
+    return catn_alloc(2, BLOG_SHARED_INDEX, suffix);
+}
+
+/*
+ * Maps the segment published in slot if it is still current.
+ */
+static int shared_load(struct shared_slot *slot, const struct stat *dir_info,
+                       struct index_segment *segment) {
+    unsigned long long seq;
+    unsigned long long generation;
+    long long sec;
+    long long nsec;
+
+    // retry until no write happened while reading the slot
+    do {
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        generation = atomic_load_explicit(&slot->generation, memory_order_relaxed);
+        sec = atomic_load_explicit(&slot->mtime_sec, memory_order_relaxed);
+        nsec = atomic_load_explicit(&slot->mtime_nsec, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while((seq & 1) != 0 || atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq);
+
+    if(generation == 0 || sec != (long long) dir_info->st_mtim.tv_sec ||
+       nsec != (long long) dir_info->st_mtim.tv_nsec) {
+        return -1;
+    }
+
+    char *name = shared_name(slot, generation);
+
+    if(name == NULL) {
+        return -1;
+    }
+
+    // may fail if the segment has been replaced in the meantime
+    int fd = shm_open(name, O_RDONLY, 0);
+    free(name);
+
+    if(fd == -1) {
+        return -1;
+    }
+
+    struct stat info;
+
+    if(fstat(fd, &info) == -1 || (size_t) info.st_size < sizeof(struct index_header)) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(map == MAP_FAILED) {
+        return -1;
+    }
+
+    segment->header = map;
+    segment->mapped = true;
+    segment->block_size = info.st_size;
+
+    if(segment_init(segment, info.st_size) == -1 || !segment_current(segment, dir_info)) {
+        segment_free(segment);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Copies segment into a new shared memory object, publishes it in slot
+ * and replaces segment's memory with a read only mapping of the object.
+ * The caller must hold the slot's lock.
+ */
+static void shared_publish(struct shared_slot *slot, struct index_segment *segment) {
+    unsigned long long old = atomic_load_explicit(&slot->generation, memory_order_relaxed);
+    char *name = shared_name(slot, old + 1);
+
+    if(name == NULL) {
+        return;
+    }
+
+    // a leftover of a crashed process may be in the way
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    void *map = MAP_FAILED;
+
+    if(fd != -1 && ftruncate(fd, segment->block_size) == 0) {
+        map = mmap(NULL, segment->block_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    if(fd != -1) {
+        close(fd);
+    }
+
+    if(map == MAP_FAILED) {
+        shm_unlink(name);
+        free(name);
+        return;
+    }
+
+    memcpy(map, segment->header, segment->block_size);
+    mprotect(map, segment->block_size, PROT_READ);
+
+    atomic_store_explicit(&slot->seq, atomic_load_explicit(&slot->seq, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->generation, old + 1, memory_order_relaxed);
+    atomic_store_explicit(&slot->mtime_sec, segment->header->dir_mtime_sec, memory_order_relaxed);
+    atomic_store_explicit(&slot->mtime_nsec, segment->header->dir_mtime_nsec, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, atomic_load_explicit(&slot->seq, memory_order_relaxed) + 1,
+                          memory_order_release);
+
+    free(name);
+
+    // processes still using the old generation keep their mapping
+    if(old > 0 && (name = shared_name(slot, old)) != NULL) {
+        shm_unlink(name);
+        free(name);
+    }
+
+    // use the shared copy, so the memory exists only once
+    if(segment->mapped) {
+        munmap((void *) segment->header, segment->block_size);
+    } else {
+        free((void *) segment->header);
+    }
+
+    segment->header = map;
+    segment->mapped = true;
+    segment_init(segment, segment->block_size);
+}
+
+/*
+ * Takes (lock = true) or releases the lock of a slot which makes
+ * sure only a single thread of all processes builds its segment.
+ */
+static void shared_lock(struct shared_slot *slot, bool lock) {
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = lock ? F_WRLCK : F_UNLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = (char *) slot - (char *) shared_table;
+    fl.l_len = sizeof(struct shared_slot);
+
+    if(lock) {
+        pthread_mutex_lock(&shared_build_lock);
+        // released automatically if the process dies
+        while(fcntl(shared_table_fd, F_SETLKW, &fl) == -1 && errno == EINTR);
+    } else {
+        fcntl(shared_table_fd, F_SETLK, &fl);
+        pthread_mutex_unlock(&shared_build_lock);
+    }
+}
+#endif
+
+/*
+ * Takes the segment of the given shard out of previous if it
+ * is still current, so it can be reused without reading it again.
+ * Otherwise *outdated is set to the shard's segment in previous
+ * (if there is one) which remains there.
+ */
+static int index_reuse(struct index *previous, const char *shard, const struct stat *dir_info,
+                       struct index_segment *segment, const struct index_segment **outdated) {
+    *outdated = NULL;
+
+    size_t total = previous == NULL ? 0 : previous->segment_count + previous->spare_count;
+
+    // spare segments are just as good
+    for(size_t s = 0; s < total; s++) {
+        struct index_segment *p = s < previous->segment_count
+            ? previous->segments + s
+            : previous->spares + (s - previous->segment_count);
+
+        if(p->header != NULL && strcmp(p->shard, shard) == 0 && !segment_current(p, dir_info)) {
+            *outdated = p;
+        } else if(p->header != NULL && strcmp(p->shard, shard) == 0) {
+            *segment = *p;
+            // undo truncation to max_count
+            segment->count = segment->header->count;
+
+            p->header = NULL;
+            p->shard = NULL;
+
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Sets up l for looking up the entries of segment (may be NULL) by path.
+ */
+static void lookup_init(struct segment_lookup *l, const struct index_segment *segment) {
+    l->segment = NULL;
+    l->slots = NULL;
+    l->mask = 0;
+
+    if(segment == NULL || segment->header->count == 0) {
+        return;
+    }
+
+    size_t count = segment->header->count;
+    size_t slot_count = 2;
+
+    // keep the table at most half full
+    while(slot_count < count * 2) {
+        slot_count *= 2;
+    }
+
+    l->slots = calloc(slot_count, sizeof(size_t));
+
+    if(l->slots == NULL) {
+        return;
+    }
+
+    l->segment = segment;
+    l->mask = slot_count - 1;
+
+    for(size_t i = 0; i < count; i++) {
+        size_t slot = lookup_hash(segment->pool + segment->paths[i]) & l->mask;
+
+        while(l->slots[slot] != 0) {
+            slot = (slot + 1) & l->mask;
+        }
+
+        l->slots[slot] = i + 1;
+    }
+}
+
+/*
+ * Position of the entry with the given path (relative to blog_dir)
+ * in the looked up segment or -1 if it isn't in there.
+ */
+static ssize_t lookup_find(const struct segment_lookup *l, const char *path) {
+    if(l->segment == NULL) {
+        return -1;
+    }
+
+    for(size_t slot = lookup_hash(path) & l->mask; l->slots[slot] != 0; slot = (slot + 1) & l->mask) {
+        size_t i = l->slots[slot] - 1;
+
+        if(strcmp(l->segment->pool + l->segment->paths[i], path) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Size of the start of an entry's file read by index_entry_head():
+ * enough for the longest front matter followed by the excerpt.
+ */
+#define INDEX_HEAD_SIZE ((BLOG_FRONT_MATTER ? ENTRY_FRONT_MATTER_MAX : 0) + BLOG_EXCERPT)
+
+/*
+ * Gets the front matter and excerpt of the entry name in the directory
+ * dir_fd which is path relative to blog_dir. They are taken from the looked
+ * up segment if the entry's modification time and size are the same as in
+ * there, else the start of the file is read into buf which must be
+ * INDEX_HEAD_SIZE + ENTRY_EXCERPT_SIZE(BLOG_EXCERPT) bytes large.
+ */
+static void index_entry_head(const struct segment_lookup *l, int dir_fd, const char *name,
+                             const char *path, const struct stat *info, char *buf,
+                             struct entry_head *head) {
+    ssize_t i = lookup_find(l, path);
+
+    memset(head, 0, sizeof(struct entry_head));
+
+    if(i != -1 && l->segment->mtimes[i] == (int64_t) info->st_mtime &&
+       l->segment->sizes[i] == (uint64_t) info->st_size) {
+        const struct index_segment *old = l->segment;
+        struct front_matter *fm = &head->fm;
+
+        if(old->titles[i] != old->paths[i]) {
+            fm->title = old->pool + old->titles[i];
+            fm->title_len = strlen(fm->title);
+        }
+
+        if(old->tags[i] != INDEX_NO_STRING) {
+            fm->tags = old->pool + old->tags[i];
+            fm->tags_len = strlen(fm->tags);
+        }
+
+        if(old->summaries[i] != INDEX_NO_STRING) {
+            fm->summary = old->pool + old->summaries[i];
+            fm->summary_len = strlen(fm->summary);
+        }
+
+        fm->has_date = old->times[i] != old->mtimes[i];
+        fm->date = old->times[i];
+
+        if(old->excerpts[i] != INDEX_NO_STRING) {
+            head->excerpt = old->pool + old->excerpts[i];
+            head->excerpt_len = strlen(head->excerpt);
+        }
+
+        head->flags = old->flags[i];
+
+        return;
+    }
+
+    int fd = openat(dir_fd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    ssize_t len = fd == -1 ? -1 : pread(fd, buf, INDEX_HEAD_SIZE, 0);
+
+    if(fd != -1) {
+        close(fd);
+    }
+
+    if(len <= 0) {
+        return;
+    }
+
+    size_t skip = BLOG_FRONT_MATTER ? entry_front_matter(buf, len, &head->fm) : 0;
+
+    if(BLOG_EXCERPT > 0) {
+        char *excerpt = buf + INDEX_HEAD_SIZE;
+        bool truncated;
+        ssize_t excerpt_len = entry_excerpt(buf + skip, len - skip, (off_t) len == info->st_size,
+                                            BLOG_EXCERPT, excerpt, &truncated);
+
+        if(excerpt_len != -1) {
+            head->excerpt = excerpt;
+            head->excerpt_len = excerpt_len;
+            head->flags = truncated ? INDEX_FLAG_EXCERPT_TRUNCATED : 0;
+        }
+    }
+}
+
+/*
+ * Reads the segment of a shard from the index cache or, failing that, from
+ * its directory dir_name (relative to blog_dir_fd) described by dir_info.
+ * outdated is an outdated segment of the shard or NULL, the front matter
+ * and excerpts of unchanged entries are taken from it.
+ */
+static int index_shard_read(int blog_dir_fd, const char *dir_name, const char *shard,
+                            const struct stat *dir_info, const struct index_segment *outdated,
+                            struct index_segment *segment) {
+    char *cache_path = index_cache_path(shard);
+    struct index_segment cached;
+
+    cached.header = NULL;
+    cached.shard = NULL;
+
+    if(cache_path != NULL) {
+        if(index_cache_load(cache_path, &cached) == 0 && segment_current(&cached, dir_info)) {
+            metrics_add(METRICS_INDEX_CACHE_HITS, 1);
+            *segment = cached;
+            free(cache_path);
+            return 0;
+        }
+
+        metrics_add(METRICS_INDEX_CACHE_MISSES, 1);
+
+        if(outdated == NULL && cached.header != NULL) {
+            outdated = &cached;
+        }
+    }
+
+    struct segment_lookup lookup;
+    lookup_init(&lookup, INDEX_READ_HEADS ? outdated : NULL);
+
+    char *head_buf = INDEX_READ_HEADS ? malloc(INDEX_HEAD_SIZE + ENTRY_EXCERPT_SIZE(BLOG_EXCERPT)) : NULL;
+
+    struct timespec build_start;
+    clock_gettime(CLOCK_MONOTONIC, &build_start);
+
+    struct dir_reader dir;
+
+    if((INDEX_READ_HEADS && head_buf == NULL) || dir_reader_open(&dir, blog_dir_fd, dir_name) == -1) {
+        free(head_buf);
+        free(lookup.slots);
+        segment_free(&cached);
+        free(cache_path);
+        return -1;
+    }
+
+    struct segment_builder b;
+    memset(&b, 0, sizeof(struct segment_builder));
+
+    size_t shard_len = strlen(shard);
+    time_t month_start;
+    time_t month_end;
+
+    // publication times outside the shard's month would break the order of the index
+    if(entry_shard_month(shard, shard_len, &month_start, &month_end)) {
+        b.time_min = month_start;
+        b.time_max = month_end;
+    }
+    const char *name;
+    unsigned char type;
+    int read;
+
+    while((read = dir_reader_next(&dir, &name, &type)) == 1) {
+        // every name make_entry() wouldn't reject right away, so that
+        // index_missing() doesn't turn any other status into a 404
+        if(name[0] != '.' && builder_add_name(&b, name) == -1) {
+            read = -1;
+            break;
+        }
+
+        // subdirectories etc. don't need to be stat()ed just to be skipped
+        if(name[0] == '.' || !maybe_regular(type)) {
+            continue;
+        }
+
+        struct stat file_info;
+
+        // relative to the directory, so the kernel doesn't need to walk the whole path
+        if(entry_stat(dir.fd, name, &file_info) != 0 ||
+           entry_check_file(&file_info) != 200) {
+            continue;
+        }
+
+        // build PATH_INFO for given entry
+        size_t d_name_len = strlen(name);
+        char path_info[shard_len + d_name_len + 3];
+        size_t pos = 0;
+
+        path_info[pos++] = '/';
+        if(shard_len > 0) {
+            memcpy(path_info + pos, shard, shard_len);
+            pos += shard_len;
+            path_info[pos++] = '/';
+        }
+        memcpy(path_info + pos, name, d_name_len + 1);
+
+        if(INDEX_READ_HEADS) {
+            struct entry_head head;
+
+            index_entry_head(&lookup, dir.fd, name, path_info + 1, &file_info, head_buf, &head);
+
+            if(builder_add(&b, path_info, &file_info, &head) == -1) {
+                read = -1;
+                break;
+            }
+        } else if(builder_add(&b, path_info, &file_info, NULL) == -1) {
+            read = -1;
+            break;
+        }
+    }
+
+    dir_reader_close(&dir);
+    free(head_buf);
+    free(lookup.slots);
+    segment_free(&cached);
+
+    // don't build (and cache) an incomplete segment
+    int result = read == -1 ? -1 : segment_from_builder(&b, dir_info, segment);
+    builder_free(&b);
+
+    struct timespec build_end;
+    clock_gettime(CLOCK_MONOTONIC, &build_end);
+    metrics_index_build((build_end.tv_sec - build_start.tv_sec) +
+                        (build_end.tv_nsec - build_start.tv_nsec) / 1e9);
+
+    if(result == 0 && cache_path != NULL) {
+        index_cache_write(cache_path, segment);
+    }
+
+    free(cache_path);
+
+    return result;
+}
+
+/*
+ * Reads the index segment of the given shard (a path relative to blog_dir,
+ * "" for blog_dir itself). Reuses the shard's segment from previous (may be
+ * NULL) or the index cache if it's still valid for the shard's directory.
+ */
+static int index_shard(int blog_dir_fd, const char *shard, struct index *previous,
+                       struct index_segment *segment) {
+    // the top level directory is blog_dir itself
+    const char *dir_name = shard[0] == '\0' ? "." : shard;
+
+    // stat the directory *before* reading it, so that the cache gets
+    // invalidated if it changes while we are still reading
+    struct stat dir_info;
+
+    if(entry_stat(blog_dir_fd, dir_name, &dir_info) == -1) {
+        return -1;
+    }
+
+    const struct index_segment *outdated;
+
+    if(index_reuse(previous, shard, &dir_info, segment, &outdated) == 0) {
+        return 0;
+    }
+
+    // set by the caller on success
+    segment->shard = NULL;
+
+#ifdef BLOG_SHARED_INDEX
+    struct shared_slot *slot = shared_slot(shard);
+
+    if(slot != NULL) {
+        if(shared_load(slot, &dir_info, segment) == 0) {
+            metrics_add(METRICS_INDEX_SHARED_HITS, 1);
+            return 0;
+        }
+
+        shared_lock(slot, true);
+
+        // another process may have built it while we were waiting
+        if(shared_load(slot, &dir_info, segment) == 0) {
+            shared_lock(slot, false);
+            metrics_add(METRICS_INDEX_SHARED_HITS, 1);
+            return 0;
+        }
+    }
+#endif
+
+    int result = index_shard_read(blog_dir_fd, dir_name, shard, &dir_info, outdated, segment);
+
+#ifdef BLOG_SHARED_INDEX
+    if(slot != NULL) {
+        if(result == 0) {
+            shared_publish(slot, segment);
+        }
+
+        shared_lock(slot, false);
+    }
+#endif
+
+    return result;
+}
+
+static bool is_shard_name(const char *name, size_t digits) {
+    size_t i;
+
+    for(i = 0; name[i] != '\0'; i++) {
+        if(name[i] < '0' || name[i] > '9') {
+            return false;
+        }
+    }
+
+    return i == digits;
+}
+
+static int shardsort_r(const void *a, const void *b) {
+    return strcmp(*(char * const *) b, *(char * const *) a);
+}
+
+/*
+ * Appends the names of all subdirectories of dir_name (relative to blog_dir_fd) consisting of
+ * exactly the given number of digits to the shards array, each prefixed
+ * with prefix and sorted in descending order.
+ */
+static int list_shards(int blog_dir_fd, const char *dir_name, const char *prefix, size_t digits,
+                       char ***shards, size_t *count, size_t *size) {
+    struct dir_reader dir;
+
+    if(dir_reader_open(&dir, blog_dir_fd, dir_name) == -1) {
+        return -1;
+    }
+
+    size_t start = *count;
+    const char *name;
+    unsigned char type;
+    int result = 0;
+
+    while(dir_reader_next(&dir, &name, &type) == 1) {
+        if(!maybe_directory(type) || !is_shard_name(name, digits)) {
+            continue;
+        }
+
+        if(*count >= *size) {
+            size_t new_size = *size + BASE_INDEX_SIZE;
+            char **tmp = realloc(*shards, new_size * sizeof(char *));
+
+            if(tmp == NULL) {
+                result = -1;
+                break;
+            }
+
+            *shards = tmp;
+            *size = new_size;
+        }
+
+        char *shard = catn_alloc(2, prefix, name);
+
+        if(shard == NULL) {
+            result = -1;
+            break;
+        }
+
+        (*shards)[(*count)++] = shard;
+    }
+
+    dir_reader_close(&dir);
+
+    qsort(*shards + start, *count - start, sizeof(char *), shardsort_r);
+
+    return result;
+}
+
+/*
+ * Returns all shards of blog_dir, newest first. The first shard is
+ * always "", i. e. blog_dir itself. If sharding is enabled, it is
+ * followed by all yyyy/mm subdirectories in descending order.
+ */
+static char **index_shards(int blog_dir_fd, size_t *count) {
+    size_t size = BASE_INDEX_SIZE;
+    char **shards = malloc(size * sizeof(char *));
+
+    *count = 0;
+
+    if(shards == NULL) {
+        return NULL;
+    }
+
+    shards[(*count)++] = catn_alloc(1, "");
+
+    if(shards[0] == NULL) {
+        free(shards);
+        return NULL;
+    }
+
+    if(BLOG_SHARDED) {
+        size_t years_end;
+
+        list_shards(blog_dir_fd, ".", "", 4, &shards, count, &size);
+        years_end = *count;
+
+        // expand years into months, ignoring years without valid months
+        for(size_t i = 1; i < years_end; i++) {
+            char *prefix = catn_alloc(2, shards[i], "/");
+
+            if(prefix != NULL) {
+                list_shards(blog_dir_fd, shards[i], prefix, 2, &shards, count, &size);
+            }
+
+            free(prefix);
+        }
+
+        // drop the year entries themselves
+        for(size_t i = 1; i < years_end; i++) {
+            free(shards[i]);
+        }
+
+        memmove(shards + 1, shards + years_end, (*count - years_end) * sizeof(char *));
+        *count -= years_end - 1;
+    }
+
+    return shards;
+}
+
+/*
+ * Moves the segments of previous that belong to one of the given shards
+ * (NULL entries are ignored) into the spare segments of index. This way
+ * shards that weren't needed because of max_count don't have to be mapped
+ * or read again once a complete index is built. Whether they are still
+ * current is checked when they are reused.
+ */
+static void index_keep_spares(struct index *index, struct index *previous,
+                              char **shards, size_t shard_count) {
+    size_t total = previous->segment_count + previous->spare_count;
+    size_t kept = 0;
+    struct index_segment *spares = malloc(sizeof(struct index_segment) * (total + 1));
+
+    if(spares == NULL) {
+        return;
+    }
+
+    for(size_t s = 0; s < total; s++) {
+        struct index_segment *p = s < previous->segment_count
+            ? previous->segments + s
+            : previous->spares + (s - previous->segment_count);
+
+        for(size_t i = 0; p->header != NULL && i < shard_count; i++) {
+            if(shards[i] != NULL && strcmp(p->shard, shards[i]) == 0) {
+                spares[kept] = *p;
+                spares[kept].count = p->header->count;
+                kept++;
+
+                p->header = NULL;
+                p->shard = NULL;
+            }
+        }
+    }
+
+    index->spares = spares;
+    index->spare_count = kept;
+}
+
+int make_index(const char *blog_dir, int max_count, struct index *index) {
+    index->count = 0;
+    index->segment_count = 0;
+    index->segments = NULL;
+    index->spare_count = 0;
+    index->spares = NULL;
+
+    return update_index(blog_dir, max_count, index);
+}
+
+int update_index(const char *blog_dir, int max_count, struct index *index) {
+    // segments of the old index are moved into the new one if they are still current
+    struct index previous = *index;
+
+    index->count = 0;
+    index->segment_count = 0;
+    index->segments = NULL;
+    index->spare_count = 0;
+    index->spares = NULL;
+
+    int blog_dir_fd = entry_dir_fd(blog_dir);
+    size_t shard_count;
+    char **shards = blog_dir_fd == -1 ? NULL : index_shards(blog_dir_fd, &shard_count);
+
+    if(shards == NULL) {
+        free_index(&previous);
+        return -1;
+    }
+
+    index->segments = malloc(sizeof(struct index_segment) * shard_count);
+
+    if(index->segments == NULL) {
+        for(size_t i = 0; i < shard_count; i++) {
+            free(shards[i]);
+        }
+        free(shards);
+        free_index(&previous);
+        return -1;
+    }
+
+    // every shard is sorted and shards are ordered newest first,
+    // so concatenating them gives a sorted index. Stop as soon as
+    // we have enough entries, so older shards are never touched.
+    int result = 0;
+    struct timespec now;
+
+    for(size_t i = 0; i < shard_count; i++) {
+        if(result == 0 && (max_count <= 0 || index->count < (size_t) max_count)) {
+            struct index_segment *segment = index->segments + index->segment_count;
+
+            if(index_shard(blog_dir_fd, shards[i], &previous, segment) == 0) {
+                if(segment->shard == NULL) {
+                    segment->shard = shards[i];
+                    shards[i] = NULL;
+                }
+
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                segment->checked = now.tv_sec;
+
+                if(segment->count > 0) {
+                    index->count += segment->count;
+                    index->segment_count++;
+                } else {
+                    segment_free(segment);
+                }
+            } else if(i == 0) {
+                // only blog_dir itself is mandatory
+                result = -1;
+            }
+
+            // only shards that haven't been visited are left
+            free(shards[i]);
+            shards[i] = NULL;
+        }
+    }
+
+    if(result == 0) {
+        index_keep_spares(index, &previous, shards, shard_count);
+    }
+
+    for(size_t i = 0; i < shard_count; i++) {
+        free(shards[i]);
+    }
+
+    free(shards);
+    free_index(&previous);
+
+    if(result == -1) {
+        free_index(index);
+        return -1;
+    }
+
+    // cut off the last segment if we got too many entries
+    if(max_count > 0 && index->count > (size_t) max_count) {
+        size_t excess = index->count - max_count;
+
+        index->segments[index->segment_count - 1].count -= excess;
+        index->count -= excess;
+    }
+
+    return index->count;
+}
+
+/*
+ * Find the segment of the entry at position i of the index
+ * and update i to be the position in that segment.
+ */
+static const struct index_segment *index_locate(const struct index *index, size_t *i) {
+    for(size_t s = 0; s < index->segment_count; s++) {
+        if(*i < index->segments[s].count) {
+            return index->segments + s;
+        }
+
+        *i -= index->segments[s].count;
+    }
+
+    return NULL;
+}
+
+time_t index_time(const struct index *index, size_t i) {
+    const struct index_segment *segment = index_locate(index, &i);
+
+    return segment == NULL ? 0 : (time_t) segment->times[i];
+}
+
+int index_get_entry(const struct index *index, size_t i, const char *blog_dir,
+                    char *script_name, struct entry *entry) {
+    entry->time = 0;
+    // times in the index are already clamped to their shard's month
+    entry->time_min = 0;
+    entry->time_max = 0;
+    entry->mtime = 0;
+    entry->path = NULL;
+    entry->link = NULL;
+    entry->title = NULL;
+    entry->tags = NULL;
+    entry->summary = NULL;
+    entry->text = NULL;
+    entry->text_size = 0;
+    entry->text_markdown = false;
+    entry->text_excerpt = false;
+    entry->text_indexed = false;
+    entry->fd = -1;
+    entry->file_size = -1;
+    // the front matter is already known
+    entry->indexed = true;
+    entry->text_skip = 0;
+
+    const struct index_segment *segment = index_locate(index, &i);
+
+    if(segment == NULL || script_name == NULL) {
+        return 500;
+    }
+
+    entry->time = segment->times[i];
+    entry->mtime = segment->mtimes[i];
+    // may be outdated, entry_get_text() notices that
+    entry->file_size = segment->sizes[i];
+    entry->title = catn_alloc(1, segment->pool + segment->titles[i]);
+    size_t blog_dir_len = strlen(blog_dir);
+    entry->path = catn_alloc(3, blog_dir, blog_dir_len > 0 && blog_dir[blog_dir_len - 1] == '/' ? "" : "/",
+                             segment->pool + segment->paths[i]);
+    // encode SCRIPT_NAME and PATH_INFO together like make_entry() does
+    entry->link = catn_alloc(3, script_name, "/", segment->pool + segment->paths[i]);
+
+    if(entry->title == NULL || entry->path == NULL || entry->link == NULL ||
+       urlencode_realloc(&entry->link, strlen(entry->link) + 1) <= 0) {
+        return 500;
+    }
+
+    if(segment->tags[i] != INDEX_NO_STRING &&
+       (entry->tags = catn_alloc(1, segment->pool + segment->tags[i])) == NULL) {
+        return 500;
+    }
+
+    if(segment->summaries[i] != INDEX_NO_STRING &&
+       (entry->summary = catn_alloc(1, segment->pool + segment->summaries[i])) == NULL) {
+        return 500;
+    }
+
+    return 200;
+}
+
+int index_get_excerpt(const struct index *index, size_t i, struct entry *entry) {
+    const struct index_segment *segment = index_locate(index, &i);
+
+    if(segment == NULL || segment->excerpts[i] == INDEX_NO_STRING) {
+        return -1;
+    }
+
+    entry_unget_text(entry);
+
+    // never written to, see entry_unget_text()
+    entry->text = (char *) segment->pool + segment->excerpts[i];
+    entry->text_size = strlen(entry->text);
+    entry->text_markdown = BLOG_MARKDOWN;
+    entry->text_excerpt = (segment->flags[i] & INDEX_FLAG_EXCERPT_TRUNCATED) != 0;
+    entry->text_indexed = true;
+
+    return 0;
+}
+
+void index_prefetch(const struct index *index, size_t i, const char *blog_dir) {
+    if(BLOG_EXCERPT > 0) {
+        // the files aren't needed
+        return;
+    }
+
+    size_t first = i == 0 ? 0 : i + ENTRY_PREFETCH_DISTANCE - 1;
+
+    if(first >= index->count) {
+        return;
+    }
+
+    int blog_dir_fd = entry_dir_fd(blog_dir);
+
+    if(blog_dir_fd == -1) {
+        return;
+    }
+
+    size_t blog_dir_len = strlen(blog_dir);
+    // same path index_get_entry() constructs, so entry_get_text() finds the prefetched file
+    bool slash = blog_dir_len == 0 || blog_dir[blog_dir_len - 1] != '/';
+
+    for(size_t pos = first; pos < i + ENTRY_PREFETCH_DISTANCE && pos < index->count; pos++) {
+        size_t seg_pos = pos;
+        const struct index_segment *segment = index_locate(index, &seg_pos);
+
+        if(segment == NULL) {
+            return;
+        }
+
+        const char *rel = segment->pool + segment->paths[seg_pos];
+        size_t rel_len = strlen(rel);
+        char path[blog_dir_len + rel_len + 2];
+
+        memcpy(path, blog_dir, blog_dir_len);
+        path[blog_dir_len] = '/';
+        memcpy(path + blog_dir_len + slash, rel, rel_len + 1);
+
+        entry_prefetch(blog_dir_fd, rel, path);
+    }
+}
+
+/*
+ * Whether the len bytes at path name a directory that has a segment,
+ * i. e. are empty (blog_dir itself) or yyyy/mm if sharding is enabled.
+ */
+static bool is_shard_path(const char *path, size_t len) {
+    if(len == 0) {
+        return true;
+    }
+
+    if(!BLOG_SHARDED || len != 7 || path[4] != '/') {
+        return false;
+    }
+
+    for(size_t i = 0; i < len; i++) {
+        if(i != 4 && (path[i] < '0' || path[i] > '9')) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Segment of the shard made up of the len bytes at shard among
+ * the segments and spare segments of index or NULL.
+ */
+static struct index_segment *index_find(struct index *index, const char *shard, size_t len) {
+    for(size_t s = 0; s < index->segment_count + index->spare_count; s++) {
+        struct index_segment *segment = s < index->segment_count
+            ? index->segments + s
+            : index->spares + (s - index->segment_count);
+
+        if(segment->header != NULL && strlen(segment->shard) == len &&
+           strncmp(segment->shard, shard, len) == 0) {
+            return segment;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Maps the segment of shard from the shared index or the index cache
+ * as a spare segment of index if it is current there. The directory
+ * itself is never read, so this is cheap enough for every request.
+ */
+static struct index_segment *index_load_spare(struct index *index, const char *shard,
+                                              const struct stat *dir_info) {
+    struct index_segment segment;
+    segment.header = NULL;
+    segment.shard = NULL;
+
+    int result = -1;
+
+#ifdef BLOG_SHARED_INDEX
+    struct shared_slot *slot = shared_slot(shard);
+
+    if(slot != NULL && shared_load(slot, dir_info, &segment) == 0) {
+        metrics_add(METRICS_INDEX_SHARED_HITS, 1);
+        result = 0;
+    }
+#endif
+
+    char *cache_path = result == 0 ? NULL : index_cache_path(shard);
+
+    if(cache_path != NULL && index_cache_load(cache_path, &segment) == 0) {
+        if(segment_current(&segment, dir_info)) {
+            metrics_add(METRICS_INDEX_CACHE_HITS, 1);
+            result = 0;
+        } else {
+            segment_free(&segment);
+        }
+    }
+
+    free(cache_path);
+
+    struct index_segment *spares = NULL;
+
+    if(result == 0 && (segment.shard = catn_alloc(1, shard)) != NULL) {
+        spares = realloc(index->spares, sizeof(struct index_segment) * (index->spare_count + 1));
+    }
+
+    if(spares == NULL) {
+        segment_free(&segment);
+        return NULL;
+    }
+
+    index->spares = spares;
+    spares[index->spare_count] = segment;
+
+    return spares + index->spare_count++;
+}
+
+bool index_missing(struct index *index, const char *blog_dir, const char *path_info) {
+    if(path_info == NULL || path_info[0] != '/') {
+        return false;
+    }
+
+    // anything before the name must be the shard of a segment,
+    // paths to other directories are left to make_entry()
+    const char *name = strrchr(path_info, '/') + 1;
+    size_t shard_len = name - path_info > 1 ? name - path_info - 2 : 0;
+
+    if(name[0] == '\0' || name[0] == '.' || name - path_info == 2 ||
+       !is_shard_path(path_info + 1, shard_len)) {
+        return false;
+    }
+
+    struct index_segment *segment = index_find(index, path_info + 1, shard_len);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if(segment == NULL || now.tv_sec - segment->checked >= INDEX_MISSING_MAX_AGE) {
+        char shard[8];
+        memcpy(shard, path_info + 1, shard_len);
+        shard[shard_len] = '\0';
+
+        int blog_dir_fd = entry_dir_fd(blog_dir);
+        struct stat dir_info;
+
+        if(blog_dir_fd == -1 || entry_stat(blog_dir_fd, shard_len > 0 ? shard : ".", &dir_info) == -1) {
+            return false;
+        }
+
+        if(segment == NULL) {
+            segment = index_load_spare(index, shard, &dir_info);
+        } else if(!segment_current(segment, &dir_info)) {
+            segment = NULL;
+        }
+
+        if(segment == NULL) {
+            return false;
+        }
+
+        segment->checked = now.tv_sec;
+    }
+
+    if(filter_contains(segment->filter, segment->header->filter_size, lookup_hash(name))) {
+        return false;
+    }
+
+    metrics_add(METRICS_MISSING_REJECTS, 1);
+    return true;
+}
+
+void free_index(struct index *index) {
+    for(size_t s = 0; s < index->segment_count; s++) {
+        segment_free(index->segments + s);
+    }
+
+    for(size_t s = 0; s < index->spare_count; s++) {
+        segment_free(index->spares + s);
+    }
+
+    free(index->segments);
+    free(index->spares);
+
+    index->segments = NULL;
+    index->segment_count = 0;
+    index->spares = NULL;
+    index->spare_count = 0;
+    index->count = 0;
 }
@@ -1,6 +1,17 @@
 /*!
  * @file index.h
  * @brief Construction and destruction of entry indices
+ *
+ * An index is stored in a struct-of-arrays layout: publication times,
+ * sizes and string offsets of all entries are kept in separate, contiguous
+ * arrays while the strings themselves are stored in a single string pool.
+ * This way sorting and scanning the index only touches the data that is
+ * actually needed. An index consists of one or more segments (one per
+ * directory read) which use the same layout in memory as the index cache
+ * files on disk, so cached segments are used directly via `mmap()`.
+ *
+ * Use `index_get_entry()` to get a regular `struct entry` for an index
+ * position, e. g. to pass it to the template.
  */
 
 #ifndef STERNENBLOG_INDEX_H
@@ -8,34 +19,274 @@
 
 #include "core.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*!
+ * @brief Header of an index segment
+ *
+ * Every index segment (both in memory and in a cache file) starts
+ * with this header. It is followed by the arrays `times`, `mtimes`,
+ * `sizes`, `titles`, `links`, `paths`, `tags`, `summaries`, `excerpts`
+ * and `flags` (in this order) with `count` elements each, the Bloom
+ * filter of `filter_size` bytes and the string pool of `pool_size` bytes.
+ *
+ * @see struct index_segment
+ */
+struct index_header {
+    char magic[8];          //!< `"sbindex"` including the `NUL` byte
+    uint32_t version;       //!< version of the layout
+    uint32_t header_size;   //!< `sizeof(struct index_header)`
+    int64_t dir_mtime_sec;  //!< modification time (seconds) of the directory the segment was read from
+    int64_t dir_mtime_nsec; //!< modification time (nanoseconds) of the directory the segment was read from
+    uint64_t count;         //!< number of entries in the segment
+    uint64_t pool_size;     //!< size of the string pool in bytes
+    uint64_t options;       //!< settings affecting the contents the segment was built with
+    uint64_t filter_size;   //!< size of the Bloom filter in bytes, a multiple of 8
+    uint64_t fingerprint;   //!< hash of the paths, modification times and sizes of the entries
+};
+
+/*!
+ * @brief Offset of a missing optional string in an index segment
+ */
+#define INDEX_NO_STRING UINT32_MAX
+
+/*!
+ * @brief Flag of an entry whose excerpt is only part of its text
+ *
+ * @see index_get_excerpt
+ */
+#define INDEX_FLAG_EXCERPT_TRUNCATED 1
+
+/*!
+ * @brief Seconds `index_missing()` trusts a segment without checking its directory
+ *
+ * @see index_missing
+ */
+#define INDEX_MISSING_MAX_AGE 1
+
+/*!
+ * @brief Sorted entries of a single directory
+ *
+ * All pointers point into a single block of memory starting with
+ * `header` which is either dynamically allocated or a mapped index
+ * cache file. Entries are sorted by publication time, newest first.
+ *
+ * String members are offsets into `pool` pointing to `NUL`
+ * terminated strings or `INDEX_NO_STRING` for optional ones.
+ */
+struct index_segment {
+    const struct index_header *header; //!< start of the segment's memory
+    size_t block_size;                 //!< size of the segment's memory
+    bool mapped;                       //!< whether the memory is mapped using `mmap()`
+    size_t count;                      //!< number of entries in use (may be less than `header->count`)
+    const int64_t *times;              //!< publication times of entries, see `struct entry`
+    const int64_t *mtimes;             //!< modification times of the entries' files
+    const uint64_t *sizes;             //!< sizes of the entries' files
+    const uint32_t *titles;            //!< titles of entries
+    const uint32_t *links;             //!< `PATH_INFO` of entries, url encoded
+    const uint32_t *paths;             //!< paths to the entries relative to `blog_dir`
+    const uint32_t *tags;              //!< tags of entries (optional)
+    const uint32_t *summaries;         //!< summaries of entries (optional)
+    const uint32_t *excerpts;          //!< excerpts of entries (optional)
+    const uint32_t *flags;             //!< `INDEX_FLAG_*` bits of entries
+    const unsigned char *filter;       //!< Bloom filter of the names in the directory, see `index_missing()`
+    const char *pool;                  //!< string pool
+    char *shard;                       //!< directory the segment was read from, relative to `blog_dir`
+    int64_t checked;                   //!< `CLOCK_MONOTONIC` seconds the directory was last found unchanged at
+};
+
+/*!
+ * @brief Index of entries
+ *
+ * Ordered list of segments, together sorted newest first.
+ *
+ * @see make_index
+ * @see index_get_entry
+ * @see free_index
+ */
+struct index {
+    size_t count;                    //!< total number of entries
+    size_t segment_count;            //!< number of segments
+    struct index_segment *segments;  //!< dynamically allocated array of segments
+    size_t spare_count;              //!< number of spare segments
+    struct index_segment *spares;    //!< segments kept for `index_missing()` which aren't listed, dynamically allocated
+};
 
 /*!
  * @brief Build index of given `blog_dir`
  *
- * Allocates an array of entries, reads `blog_dir` and adds a `struct entry` to the
- * array for every file for which `make_entry()` reports no error. It doesn't enter
- * subdirectories.
+ * Reads `blog_dir` and adds every file to the index which passes the same checks
+ * `make_entry()` does. It doesn't enter subdirectories unless sharding is enabled.
+ * All directories and files are accessed relative to the descriptor returned by
+ * `entry_dir_fd()`, so the path to `blog_dir` is only resolved once per process.
+ *
+ * If `BLOG_SHARDED` is enabled, entries may additionally be stored in shard
+ * directories named `yyyy/mm` below `blog_dir`. Every shard is read and sorted
+ * on its own, shards are then concatenated newest first, i. e. the shard an entry
+ * is stored in takes precedence over its publication time when ordering entries
+ * of different shards. Files directly in `blog_dir` are treated as the newest shard.
+ * If `max_count` is positive, shards are only read until `max_count` entries have
+ * been collected, so older shards are never touched for the index page and feeds.
+ *
+ * If `BLOG_CACHE_DIR` is defined, the segment of every directory read is
+ * stored there and mapped again as long as the modification time of the directory stays
+ * the same. Since only adding, removing or renaming files changes it, modification
+ * times of entries that have been edited or touched in place are picked up only
+ * after the directory itself has been touched.
+ *
+ * If `BLOG_FRONT_MATTER` is enabled, the front matter of every entry (see
+ * `entry_front_matter()`) is stored in the segment and its `date` is used
+ * for sorting, so rendering the index and feeds doesn't need to read any
+ * entry just for its metadata. When a directory is read again, the front
+ * matter of entries whose modification time and size are unchanged is
+ * taken from the outdated segment (of `update_index()`'s index or the
+ * index cache), so only new and changed files are opened. Like the
+ * modification times, front matter edited in place is thus only picked
+ * up once the directory has been touched, while `make_entry()` always
+ * reads the current one.
  *
- * Note that it's error handling is very simple and it doesn't distinguish between an
- * error occuring and the end of the directory.
+ * If `BLOG_EXCERPT` is positive, the excerpt of every entry (see
+ * `entry_excerpt()`) is stored in the segment as well and updated
+ * the same way, so it can be used by `index_get_excerpt()`.
+ *
+ * If `BLOG_SHARED_INDEX` is defined, segments are additionally published in
+ * POSIX shared memory. Segments found there are mapped read-only, otherwise
+ * a lock makes sure only a single process reads a changed directory while
+ * the others wait for its result.
+ *
+ * Directories are read in large batches using `getdents64()` on Linux. Files
+ * which the directory entry already identifies as something other than a
+ * regular file or a symbolic link, e. g. subdirectories, are skipped without
+ * calling `stat()` on them. If reading a directory fails, its segment is
+ * skipped, rather than it being indexed partially.
  *
  * @param blog_dir path to the directory entries are stored in
- * @param script_name the value of the `SCRIPT_NAME` environment variable
- * @param get_text whether to call `entry_get_text()` on successfully constructed entries
- * @param entries pointer to an array that should be used
- * @return size of the dynamically allocated entries array
+ * @param max_count maximum number of entries to include, `0` for no limit
+ * @param index index structure to initialize
+ * @return number of entries in the index or -1 on error
  * @see free_index
+ * @see index_get_entry
+ */
+int make_index(const char *blog_dir, int max_count, struct index *index);
+
+/*!
+ * @brief Bring an existing index up to date
+ *
+ * Rebuilds `index` like `make_index()` would, but segments of directories
+ * which haven't been modified since they were read are reused without
+ * accessing the index cache or reading the directory again. This way a
+ * process serving multiple requests can keep its index warm while only
+ * having to `stat()` the directories involved for every request. Segments
+ * of shards that aren't needed because of `max_count` are kept as spare
+ * segments, so alternating between limited and complete indexes doesn't
+ * map or read the older shards again every time.
+ *
+ * @param blog_dir path to the directory entries are stored in
+ * @param max_count maximum number of entries to include, `0` for no limit
+ * @param index index built by `make_index()` or `update_index()`
+ * @return number of entries in the index or -1 on error, in which
+ *         case `index` is empty
+ * @see make_index
+ */
+int update_index(const char *blog_dir, int max_count, struct index *index);
+
+/*!
+ * @brief Publication time of an entry in the index
+ *
+ * @param index index built by `make_index()`
+ * @param i position of the entry, must be less than `index->count`
+ * @return `date` of the entry's front matter or its modification time
+ */
+time_t index_time(const struct index *index, size_t i);
+
+/*!
+ * @brief Construct a `struct entry` for an entry in the index
+ *
+ * Compatibility accessor which populates a regular `struct entry` like
+ * `make_entry()` would from the index data without touching the file system.
+ * Like with `make_entry()`, `free_entry()` must be called on the entry afterwards.
+ *
+ * @param index index built by `make_index()`
+ * @param i position of the entry, must be less than `index->count`
+ * @param blog_dir path to the directory entries are stored in
+ * @param script_name the value of the `SCRIPT_NAME` environment variable
+ * @param entry uninitialized entry structure to update
+ * @return 200 on success, 500 on error
+ */
+int index_get_entry(const struct index *index, size_t i, const char *blog_dir,
+                    char *script_name, struct entry *entry);
+
+/*!
+ * @brief Use the excerpt of an entry in the index as its text
+ *
+ * Points `entry->text` to the excerpt of the entry at position `i` stored in
+ * the index if `BLOG_EXCERPT` is enabled, so it can be output without reading
+ * the entry's file. `entry->text_excerpt` is set if the excerpt is only part
+ * of the entry's text, `entry->text_markdown` if `BLOG_MARKDOWN` is enabled.
+ * The text belongs to the index and stays valid until it is freed, calling
+ * `entry_unget_text()` afterwards is still allowed.
+ *
+ * @param index index built by `make_index()`
+ * @param i position of the entry, must be less than `index->count`
+ * @param entry entry constructed using `index_get_entry()` for the same position
+ * @return 0 on success, -1 if there is no excerpt for the entry
+ */
+int index_get_excerpt(const struct index *index, size_t i, struct entry *entry);
+
+/*!
+ * @brief Prefetch the entries following an index position
+ *
+ * Meant to be called for every position while iterating `index`:
+ * Calls `entry_prefetch()` for the entry `ENTRY_PREFETCH_DISTANCE - 1`
+ * positions ahead of `i` or, if `i` is `0`, for all entries up to it.
+ * `entry_prefetch_clear()` should be called after the iteration.
+ * Does nothing if `BLOG_EXCERPT` is enabled, since the index page
+ * and feeds use the excerpts stored in the index then.
+ *
+ * @param index index built by `make_index()`
+ * @param i current position in the index
+ * @param blog_dir path to the directory entries are stored in
+ */
+void index_prefetch(const struct index *index, size_t i, const char *blog_dir);
+
+/*!
+ * @brief Check whether a `PATH_INFO` definitely doesn't name an entry
+ *
+ * Every segment contains a Bloom filter of the names of all files in its
+ * directory (including those that are not entries, so `make_entry()` can
+ * still tell them apart). If the name of the file `path_info` refers to is
+ * not in the filter of its directory's segment, `make_entry()` would return
+ * 404 for it, so requests probing for missing entries can be answered
+ * without accessing the file system at all. False positives (about 0.1 %)
+ * merely mean `make_entry()` has to be called.
+ *
+ * If `index` has no segment for the directory, e. g. because no index
+ * page has been served by the process yet, the directory's segment is
+ * mapped from `BLOG_SHARED_INDEX` or `BLOG_CACHE_DIR` if it is current
+ * there and kept as a spare segment of `index`. The directory is never
+ * read for this, so without a current segment `false` is returned.
+ *
+ * A segment is trusted for `INDEX_MISSING_MAX_AGE` seconds after its
+ * directory has last been found unchanged by `update_index()` or this
+ * function, afterwards the directory is `stat()`ed again. Entries are thus
+ * found at most that long after they've been added.
+ *
+ * @param index index built by `make_index()` or `update_index()`, may be empty
+ * @param blog_dir path to the directory entries are stored in
+ * @param path_info `PATH_INFO` of the request
+ * @return `true` if `path_info` doesn't name an entry, `false` if it
+ *         may name one or the index doesn't cover its directory
  */
-int make_index(const char *blog_dir, char *script_name, bool get_text, struct entry *entries[]);
+bool index_missing(struct index *index, const char *blog_dir, const char *path_info);
 
 /*!
  * @brief Free dynamically allocated index
  *
- * Call `free_entry()` for every entry and free entire array afterwards.
+ * Frees or unmaps all segments of the index.
  *
- * @param entries pointer to array of entries
- * @param count size of the given array
+ * @param index index built by `make_index()`
  */
-void free_index(struct entry *entries[], int count);
+void free_index(struct index *index);
 
 #endif
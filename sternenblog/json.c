@@ -0,0 +1,135 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json.h"
+
+/*
+ * Whether any byte of w is a control character, a quote or a backslash.
+ * May give false positives after a matching byte, but no false negatives.
+ */
+static bool json_needs_escape(uint64_t w) {
+    const uint64_t ones = 0x0101010101010101;
+    const uint64_t high = 0x8080808080808080;
+    uint64_t quote = w ^ (ones * '"');
+    uint64_t backslash = w ^ (ones * '\\');
+
+    // subtracting n from a byte below n borrows into its (clear) high bit
+    return (((w - ones * 0x20) & ~w) |
+            ((quote - ones) & ~quote) |
+            ((backslash - ones) & ~backslash)) & high;
+}
+
+static void json_separate(struct json_context *ctx) {
+    if(ctx->separate) {
+        fputc(',', ctx->out);
+    }
+}
+
+void new_json_context(struct json_context *ctx) {
+    ctx->out = stdout;
+    ctx->separate = false;
+}
+
+void json_open_object(struct json_context *ctx) {
+    json_separate(ctx);
+    fputc('{', ctx->out);
+    ctx->separate = false;
+}
+
+void json_close_object(struct json_context *ctx) {
+    fputc('}', ctx->out);
+    ctx->separate = true;
+}
+
+void json_open_array(struct json_context *ctx) {
+    json_separate(ctx);
+    fputc('[', ctx->out);
+    ctx->separate = false;
+}
+
+void json_close_array(struct json_context *ctx) {
+    fputc(']', ctx->out);
+    ctx->separate = true;
+}
+
+void json_key(struct json_context *ctx, const char *key) {
+    json_string(ctx, key);
+    fputc(':', ctx->out);
+    ctx->separate = false;
+}
+
+void json_string(struct json_context *ctx, const char *str) {
+    json_open_string(ctx);
+    json_escaped(ctx, str, strlen(str));
+    json_close_string(ctx);
+}
+
+void json_open_string(struct json_context *ctx) {
+    json_separate(ctx);
+    fputc('"', ctx->out);
+}
+
+void json_escaped(struct json_context *ctx, const char *str, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    size_t start = 0;
+
+    // write runs of characters that don't need escaping at once
+    for(size_t i = 0; i < len; i++) {
+        // skip 8 bytes at once while none of them needs escaping
+        while(i + sizeof(uint64_t) <= len) {
+            uint64_t w;
+            memcpy(&w, str + i, sizeof(w));
+
+            if(json_needs_escape(w)) {
+                break;
+            }
+
+            i += sizeof(w);
+        }
+
+        if(i == len) {
+            break;
+        }
+
+        unsigned char c = str[i];
+
+        if(c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        fwrite(str + start, 1, i - start, ctx->out);
+        start = i + 1;
+
+        switch(c) {
+            case '"':
+                fputs("\\\"", ctx->out);
+                break;
+            case '\\':
+                fputs("\\\\", ctx->out);
+                break;
+            case '\n':
+                fputs("\\n", ctx->out);
+                break;
+            case '\r':
+                fputs("\\r", ctx->out);
+                break;
+            case '\t':
+                fputs("\\t", ctx->out);
+                break;
+            default:
+                fputs("\\u00", ctx->out);
+                fputc(hex[c >> 4], ctx->out);
+                fputc(hex[c & 0xf], ctx->out);
+                break;
+        }
+    }
+
+    fwrite(str + start, 1, len - start, ctx->out);
+}
+
+void json_close_string(struct json_context *ctx) {
+    fputc('"', ctx->out);
+    ctx->separate = true;
+}
@@ -0,0 +1,117 @@
+/*!
+ * @file json.h
+ * @brief Simple library for constructing JSON documents
+ *
+ * Counterpart of xml.h for JSON: Objects, arrays, keys and strings are
+ * written to `ctx->out` as they are output, so documents of any size can
+ * be streamed without building them in memory first. The only state kept
+ * is whether the next key or value needs to be separated from the previous
+ * one by a comma, so no memory is allocated at all.
+ *
+ * Like xml.h, it doesn't check that the document is well-formed: Keys
+ * should only be used in objects and every opened object, array or string
+ * must be closed again by the caller. Its output is always "minified".
+ *
+ * A document like `{"title":"Hello","tags":["c","web"]}` is produced by:
+ *
+ * ```
+ * struct json_context ctx;
+ * new_json_context(&ctx);
+ *
+ * json_open_object(&ctx);
+ * json_key(&ctx, "title");
+ * json_string(&ctx, "Hello");
+ * json_key(&ctx, "tags");
+ * json_open_array(&ctx);
+ * json_string(&ctx, "c");
+ * json_string(&ctx, "web");
+ * json_close_array(&ctx);
+ * json_close_object(&ctx);
+ * ```
+ */
+
+#ifndef STERNENBLOG_JSON_H
+#define STERNENBLOG_JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*!
+ * @brief State and configuration of JSON generation
+ *
+ * @see new_json_context
+ */
+struct json_context {
+    FILE *out;     //!< where to write output, defaults to `stdout`
+    bool separate; //!< whether the next key or value needs to be preceded by a comma
+};
+
+/*!
+ * @brief Initialize the `json_context` structure
+ *
+ * Sets up `ctx` to output to `stdout` at the start of a document. Since
+ * no memory is allocated, there is no function to clean it up again.
+ */
+void new_json_context(struct json_context *ctx);
+
+/*!
+ * @brief Start an object, i. e. output `{`
+ */
+void json_open_object(struct json_context *ctx);
+
+/*!
+ * @brief End the object opened last, i. e. output `}`
+ */
+void json_close_object(struct json_context *ctx);
+
+/*!
+ * @brief Start an array, i. e. output `[`
+ */
+void json_open_array(struct json_context *ctx);
+
+/*!
+ * @brief End the array opened last, i. e. output `]`
+ */
+void json_close_array(struct json_context *ctx);
+
+/*!
+ * @brief Output the key of the next member of an object
+ *
+ * Outputs `key` as a string followed by a colon. The next call must
+ * output the member's value.
+ */
+void json_key(struct json_context *ctx, const char *key);
+
+/*!
+ * @brief Output a string value
+ *
+ * Equivalent to `json_open_string()`, `json_escaped()`
+ * for all of `str` and `json_close_string()`.
+ */
+void json_string(struct json_context *ctx, const char *str);
+
+/*!
+ * @brief Start a string value, i. e. output the opening quote
+ *
+ * The contents of the string can then be output piece by piece
+ * using `json_escaped()` before calling `json_close_string()`.
+ */
+void json_open_string(struct json_context *ctx);
+
+/*!
+ * @brief Output part of a string value
+ *
+ * Outputs `len` bytes of `str` escaped for use in a JSON string: Quotes,
+ * backslashes and control characters are escaped, all other bytes are
+ * passed through as is, so `str` is expected to be valid UTF-8. Must only
+ * be called between `json_open_string()` and `json_close_string()`.
+ */
+void json_escaped(struct json_context *ctx, const char *str, size_t len);
+
+/*!
+ * @brief End a string value, i. e. output the closing quote
+ */
+void json_close_string(struct json_context *ctx);
+
+#endif
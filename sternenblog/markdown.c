@@ -0,0 +1,1002 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "core.h"
+#include "markdown.h"
+#include "xml.h"
+
+/*!
+ * @brief Maximum nesting depth of emphasis and links
+ *
+ * Inline markup nested deeper is output literally, which
+ * bounds the recursion of the inline renderer.
+ */
+#define MD_MAX_NESTING 16
+
+enum md_block_type {
+    MD_NONE,
+    MD_PARAGRAPH,
+    MD_HEADING,
+    MD_QUOTE,
+    MD_LIST_ITEM,
+    MD_CODE,
+    MD_HTML,
+    MD_RULE
+};
+
+/*
+ * State of the block level scanner. Nothing of the document is copied:
+ * The text of the open paragraph or list item is rendered directly from
+ * the document once its last line is known, code and HTML is written
+ * line by line.
+ */
+struct md_state {
+    FILE *out;
+    enum md_block_type open;  // block following lines may belong to
+    const char *text;         // start of the open paragraph or list item
+    const char *text_end;     // end of its last line
+    bool quote;               // inside a block quote
+    int list;                 // 0 outside of a list, 1 if unordered, 2 if ordered
+    size_t blank_lines;       // blank lines in a code block not written yet
+    size_t fence_len;         // length of the open code block's fence, 0 if indented
+    char fence_char;
+    const char *html_end;     // closing tag ending the open HTML block
+};
+
+static size_t md_run(const char *s, size_t len, char c) {
+    size_t n = 0;
+
+    while(n < len && s[n] == c) {
+        n++;
+    }
+
+    return n;
+}
+
+/*
+ * Returns the number of bytes of leading whitespace and
+ * stores its width in columns (tabs stop at multiples of 4).
+ */
+static size_t md_indent(const char *s, size_t len, size_t *width) {
+    size_t i = 0;
+
+    *width = 0;
+
+    for(; i < len && (s[i] == ' ' || s[i] == '\t'); i++) {
+        *width = s[i] == '\t' ? (*width + 4) / 4 * 4 : *width + 1;
+    }
+
+    return i;
+}
+
+// all of s consists of c with optional spaces in between (if allowed)
+static bool md_only(const char *s, size_t len, char c, bool spaces) {
+    for(size_t i = 0; i < len; i++) {
+        if(s[i] != c && !(s[i] == ' ' && (spaces || i + md_run(s + i, len - i, ' ') == len))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool md_rule(const char *s, size_t len) {
+    if(s[0] != '*' && s[0] != '-' && s[0] != '_') {
+        return false;
+    }
+
+    size_t count = 0;
+
+    for(size_t i = 0; i < len; i++) {
+        count += s[i] == s[0];
+    }
+
+    return count >= 3 && md_only(s, len, s[0], true);
+}
+
+/*
+ * Returns the level of an ATX heading and stores its
+ * content in *content or returns 0 if s isn't one.
+ */
+static int md_heading(const char *s, size_t len, const char **content, size_t *content_len) {
+    size_t level = md_run(s, len, '#');
+
+    if(level == 0 || level > 6 || (level < len && s[level] != ' ' && s[level] != '\t')) {
+        return 0;
+    }
+
+    const char *start = s + level;
+    const char *end = s + len;
+
+    while(start < end && (*start == ' ' || *start == '\t')) {
+        start++;
+    }
+
+    while(end > start && end[-1] == ' ') {
+        end--;
+    }
+
+    // optional closing sequence
+    const char *hashes = end;
+
+    while(hashes > start && hashes[-1] == '#') {
+        hashes--;
+    }
+
+    if(hashes == start || hashes[-1] == ' ') {
+        end = hashes;
+
+        while(end > start && end[-1] == ' ') {
+            end--;
+        }
+    }
+
+    *content = start;
+    *content_len = end - start;
+
+    return level;
+}
+
+/*
+ * Returns 1 for an unordered and 2 for an ordered list marker and
+ * stores the marker's length including the following space or
+ * returns 0 if s doesn't start with a list marker.
+ */
+static int md_list_marker(const char *s, size_t len, long *number, size_t *marker_len) {
+    size_t i = 0;
+    int type = 1;
+
+    if(s[0] == '-' || s[0] == '*' || s[0] == '+') {
+        i = 1;
+    } else {
+        long n = 0;
+
+        while(i < len && i < 9 && isdigit((unsigned char) s[i])) {
+            n = n * 10 + (s[i] - '0');
+            i++;
+        }
+
+        if(i == 0 || i >= len || (s[i] != '.' && s[i] != ')')) {
+            return 0;
+        }
+
+        *number = n;
+        type = 2;
+        i++;
+    }
+
+    if(i < len && s[i] != ' ' && s[i] != '\t') {
+        return 0;
+    }
+
+    *marker_len = i + md_run(s + i, len - i, ' ');
+
+    return type;
+}
+
+// returns the length of a code fence or 0
+static size_t md_fence(const char *s, size_t len) {
+    if(s[0] != '`' && s[0] != '~') {
+        return 0;
+    }
+
+    size_t n = md_run(s, len, s[0]);
+
+    if(n < 3 || (s[0] == '`' && memchr(s + n, '`', len - n) != NULL)) {
+        return 0;
+    }
+
+    return n;
+}
+
+static bool md_html_start(const char *s, size_t len) {
+    return len > 1 && s[0] == '<' &&
+        (isalpha((unsigned char) s[1]) || s[1] == '/' || s[1] == '!' || s[1] == '?');
+}
+
+static bool md_contains(const char *s, size_t len, const char *needle) {
+    size_t needle_len = strlen(needle);
+
+    for(size_t i = 0; i + needle_len <= len; i++) {
+        if(strncasecmp(s + i, needle, needle_len) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Returns the closing tag of a HTML block which may contain blank
+ * lines (since they are significant in it) or NULL for other tags.
+ */
+static const char *md_html_end(const char *s, size_t len) {
+    static const char *tags[][2] = {
+        { "<pre", "</pre>" },
+        { "<script", "</script>" },
+        { "<style", "</style>" },
+        { "<textarea", "</textarea>" },
+    };
+
+    for(size_t i = 0; i < sizeof(tags) / sizeof(tags[0]); i++) {
+        size_t tag_len = strlen(tags[i][0]);
+
+        if(len >= tag_len && strncasecmp(s, tags[i][0], tag_len) == 0 &&
+           (len == tag_len || s[tag_len] == '>' || isspace((unsigned char) s[tag_len]))) {
+            return tags[i][1];
+        }
+    }
+
+    return NULL;
+}
+
+static void md_escaped_char(FILE *out, char c) {
+    switch(c) {
+        case '&':
+            fputs("&amp;", out);
+            break;
+        case '<':
+            fputs("&lt;", out);
+            break;
+        case '>':
+            fputs("&gt;", out);
+            break;
+        case '\"':
+            fputs("&quot;", out);
+            break;
+        default:
+            fputc(c, out);
+            break;
+    }
+}
+
+static void md_escaped(FILE *out, const char *s, size_t len) {
+    size_t start = 0;
+
+    // write everything up to the next character that needs escaping at once
+    for(size_t i = 0; i < len; i++) {
+        if(s[i] == '&' || s[i] == '<' || s[i] == '>' || s[i] == '"') {
+            fwrite(s + start, 1, i - start, out);
+            md_escaped_char(out, s[i]);
+            start = i + 1;
+        }
+    }
+
+    fwrite(s + start, 1, len - start, out);
+}
+
+/*
+ * Returns the number of characters starting at s[i] which
+ * can't start inline markup and don't need escaping.
+ */
+static size_t md_plain(const char *s, size_t i, size_t len) {
+    size_t k = i;
+
+    for(; k < len; k++) {
+        switch(s[k]) {
+            case ' ':
+                // significant in front of line breaks only
+                if(k + 1 < len && s[k + 1] != ' ' && s[k + 1] != '\r' && s[k + 1] != '\n') {
+                    continue;
+                }
+                return k - i;
+            case '\\':
+            case '\r':
+            case '\n':
+            case '`':
+            case '*':
+            case '_':
+            case '!':
+            case '[':
+            case '<':
+            case '>':
+            case '&':
+            case '"':
+                return k - i;
+            default:
+                break;
+        }
+    }
+
+    return k - i;
+}
+
+/*
+ * Returns the position of the next run of exactly n
+ * characters c at or after from or len if there is none.
+ */
+static size_t md_find_run(const char *s, size_t from, size_t len, char c, size_t n) {
+    size_t k = from;
+
+    while(k < len) {
+        if(s[k] == c) {
+            size_t run = md_run(s + k, len - k, c);
+
+            if(run == n) {
+                return k;
+            }
+
+            k += run;
+        } else {
+            k++;
+        }
+    }
+
+    return len;
+}
+
+static void md_inline(const struct md_state *st, const char *s, size_t len, int depth);
+
+static void md_code_span(FILE *out, const char *s, size_t len) {
+    // a single space is stripped from both sides
+    if(len >= 2 && s[0] == ' ' && s[len - 1] == ' ' && md_run(s, len, ' ') < len) {
+        s++;
+        len -= 2;
+    }
+
+    fputs("<code>", out);
+
+    for(size_t i = 0; i < len; i++) {
+        md_escaped_char(out, s[i] == '\n' ? ' ' : s[i]);
+    }
+
+    fputs("</code>", out);
+}
+
+/*
+ * Renders emphasis starting at s[i] if it is closed later on
+ * and returns the number of bytes consumed, 0 otherwise.
+ */
+static size_t md_emphasis(const struct md_state *st, const char *s, size_t i, size_t len, int depth) {
+    FILE *out = st->out;
+    static const char *open_tags[] = { "<em>", "<strong>", "<strong><em>" };
+    static const char *close_tags[] = { "</em>", "</strong>", "</em></strong>" };
+    char c = s[i];
+    size_t run = md_run(s + i, len - i, c);
+
+    if(run > 3 || i + run >= len || isspace((unsigned char) s[i + run]) ||
+       (c == '_' && i > 0 && isalnum((unsigned char) s[i - 1]))) {
+        return 0;
+    }
+
+    size_t k = i + run;
+
+    while(k < len) {
+        if(s[k] == '\\') {
+            k += 2;
+        } else if(s[k] == '`') {
+            // delimiters in code spans don't count
+            size_t ticks = md_run(s + k, len - k, '`');
+            size_t close = md_find_run(s, k + ticks, len, '`', ticks);
+
+            k = close < len ? close + ticks : k + ticks;
+        } else if(s[k] == c) {
+            size_t close = md_run(s + k, len - k, c);
+
+            if(close == run && !isspace((unsigned char) s[k - 1]) &&
+               !(c == '_' && k + close < len && isalnum((unsigned char) s[k + close]))) {
+                break;
+            }
+
+            k += close;
+        } else {
+            k++;
+        }
+    }
+
+    if(k >= len) {
+        return 0;
+    }
+
+    fputs(open_tags[run - 1], out);
+    md_inline(st, s + i + run, k - i - run, depth + 1);
+    fputs(close_tags[run - 1], out);
+
+    return k + run - i;
+}
+
+/*
+ * Renders a link or image (s points to its "[") and returns
+ * the number of bytes consumed or 0 if it isn't one.
+ */
+static size_t md_link(const struct md_state *st, const char *s, size_t len, bool image, int depth) {
+    FILE *out = st->out;
+    size_t brackets = 0;
+    size_t k;
+
+    for(k = 0; k < len; k++) {
+        if(s[k] == '\\') {
+            k++;
+        } else if(s[k] == '[') {
+            brackets++;
+        } else if(s[k] == ']' && --brackets == 0) {
+            break;
+        }
+    }
+
+    if(k + 1 >= len || s[k + 1] != '(') {
+        return 0;
+    }
+
+    size_t text_len = k - 1;
+    size_t p = k + 2;
+    size_t url_start, url_end;
+    size_t title_start = 0, title_end = 0;
+
+    while(p < len && isspace((unsigned char) s[p])) {
+        p++;
+    }
+
+    if(p < len && s[p] == '<') {
+        url_start = ++p;
+
+        while(p < len && s[p] != '>' && s[p] != '\n') {
+            p++;
+        }
+
+        if(p >= len || s[p] != '>') {
+            return 0;
+        }
+
+        url_end = p++;
+    } else {
+        size_t parens = 0;
+
+        url_start = p;
+
+        while(p < len && !isspace((unsigned char) s[p])) {
+            if(s[p] == '(') {
+                parens++;
+            } else if(s[p] == ')') {
+                if(parens == 0) {
+                    break;
+                }
+
+                parens--;
+            }
+
+            p++;
+        }
+
+        url_end = p;
+    }
+
+    while(p < len && isspace((unsigned char) s[p])) {
+        p++;
+    }
+
+    if(p < len && (s[p] == '"' || s[p] == '\'')) {
+        char quote = s[p];
+
+        title_start = ++p;
+
+        while(p < len && s[p] != quote) {
+            p++;
+        }
+
+        if(p >= len) {
+            return 0;
+        }
+
+        title_end = p++;
+
+        while(p < len && isspace((unsigned char) s[p])) {
+            p++;
+        }
+    }
+
+    if(p >= len || s[p] != ')') {
+        return 0;
+    }
+
+    fputs(image ? "<img src=\"" : "<a href=\"", out);
+    md_escaped(out, s + url_start, url_end - url_start);
+    fputc('"', out);
+
+    if(title_end > title_start) {
+        fputs(" title=\"", out);
+        md_escaped(out, s + title_start, title_end - title_start);
+        fputc('"', out);
+    }
+
+    if(image) {
+        fputs(" alt=\"", out);
+        md_escaped(out, s + 1, text_len);
+        fputs("\">", out);
+    } else {
+        fputc('>', out);
+        md_inline(st, s + 1, text_len, depth + 1);
+        fputs("</a>", out);
+    }
+
+    return p + 1;
+}
+
+/*
+ * Renders an autolink or passes through a HTML tag (s points to its "<")
+ * and returns the number of bytes consumed or 0 if it is neither.
+ */
+static size_t md_angle(FILE *out, const char *s, size_t len) {
+    size_t k = 1;
+
+    while(k < len && s[k] != '>' && s[k] != '<' && !isspace((unsigned char) s[k])) {
+        k++;
+    }
+
+    if(k < len && s[k] == '>' && k > 1) {
+        const char *colon = memchr(s + 1, ':', k - 1);
+        const char *at = memchr(s + 1, '@', k - 1);
+
+        if(colon != NULL && colon > s + 1 && isalpha((unsigned char) s[1])) {
+            fputs("<a href=\"", out);
+            md_escaped(out, s + 1, k - 1);
+            fputs("\">", out);
+            md_escaped(out, s + 1, k - 1);
+            fputs("</a>", out);
+            return k + 1;
+        } else if(at != NULL) {
+            fputs("<a href=\"mailto:", out);
+            md_escaped(out, s + 1, k - 1);
+            fputs("\">", out);
+            md_escaped(out, s + 1, k - 1);
+            fputs("</a>", out);
+            return k + 1;
+        }
+    }
+
+    if(!md_html_start(s, len)) {
+        return 0;
+    }
+
+    const char *close = memchr(s, '>', len);
+
+    if(close == NULL) {
+        return 0;
+    }
+
+    fwrite(s, 1, close - s + 1, out);
+
+    return close - s + 1;
+}
+
+// returns the length of the entity s starts with or 0
+static size_t md_entity(const char *s, size_t len) {
+    size_t k = 1;
+
+    if(k < len && s[k] == '#') {
+        k++;
+    }
+
+    size_t start = k;
+
+    while(k < len && k < 32 && isalnum((unsigned char) s[k])) {
+        k++;
+    }
+
+    return k > start && k < len && s[k] == ';' ? k + 1 : 0;
+}
+
+/*
+ * Renders the inline markup of text which may span multiple lines.
+ * The indentation of continuation lines and, if the text is part
+ * of a block quote, their block quote markers are skipped.
+ */
+static void md_inline(const struct md_state *st, const char *s, size_t len, int depth) {
+    FILE *out = st->out;
+    bool nest = depth < MD_MAX_NESTING;
+    size_t i = 0;
+
+    while(i < len) {
+        size_t n = 0;
+
+        switch(s[i]) {
+            case '\\':
+                if(i + 1 < len && (s[i + 1] == '\n' || s[i + 1] == '\r')) {
+                    fputs("<br>", out);
+                    n = 1;
+                } else if(i + 1 < len && ispunct((unsigned char) s[i + 1])) {
+                    md_escaped_char(out, s[i + 1]);
+                    n = 2;
+                }
+                break;
+            case ' ':
+                n = md_run(s + i, len - i, ' ');
+
+                size_t eol = i + n < len && s[i + n] == '\r' ? i + n + 1 : i + n;
+
+                if(eol < len && s[eol] == '\n') {
+                    if(n >= 2) {
+                        fputs("<br>", out);
+                    }
+                } else if(i + n < len) {
+                    fwrite(s + i, 1, n, out);
+                }
+                break;
+            case '\r':
+                // dropped in front of a newline
+                n = i + 1 < len && s[i + 1] == '\n';
+                break;
+            case '\n':
+                fputc('\n', out);
+                n = 1;
+
+                // skip the indentation of the next line
+                while(i + n < len && (s[i + n] == ' ' || s[i + n] == '\t')) {
+                    n++;
+                }
+
+                if(st->quote) {
+                    if(i + n < len && s[i + n] == '>') {
+                        n++;
+                        n += i + n < len && s[i + n] == ' ';
+                    }
+                }
+                break;
+            case '`':
+                n = md_run(s + i, len - i, '`');
+
+                size_t close = md_find_run(s, i + n, len, '`', n);
+
+                if(close < len) {
+                    md_code_span(out, s + i + n, close - i - n);
+                    n = close + n - i;
+                } else {
+                    fwrite(s + i, 1, n, out);
+                }
+                break;
+            case '*':
+            case '_':
+                n = nest ? md_emphasis(st, s, i, len, depth) : 0;
+
+                if(n == 0) {
+                    n = md_run(s + i, len - i, s[i]);
+                    fwrite(s + i, 1, n, out);
+                }
+                break;
+            case '!':
+                if(nest && i + 1 < len && s[i + 1] == '[') {
+                    n = md_link(st, s + i + 1, len - i - 1, true, depth);
+                    n += n > 0;
+                }
+                break;
+            case '[':
+                n = nest ? md_link(st, s + i, len - i, false, depth) : 0;
+                break;
+            case '<':
+                n = md_angle(out, s + i, len - i);
+                break;
+            case '&':
+                n = md_entity(s + i, len - i);
+
+                if(n > 0) {
+                    fwrite(s + i, 1, n, out);
+                }
+                break;
+        }
+
+        if(n == 0 && (n = md_plain(s, i, len)) > 0) {
+            fwrite(s + i, 1, n, out);
+        } else if(n == 0) {
+            md_escaped_char(out, s[i]);
+            n = 1;
+        }
+
+        i += n;
+    }
+}
+
+// closes the open paragraph, list item, code or HTML block
+static void md_close_block(struct md_state *st) {
+    switch(st->open) {
+        case MD_PARAGRAPH:
+            fputs("<p>", st->out);
+            md_inline(st, st->text, st->text_end - st->text, 0);
+            fputs("</p>\n", st->out);
+            break;
+        case MD_LIST_ITEM:
+            fputs("<li>", st->out);
+            md_inline(st, st->text, st->text_end - st->text, 0);
+            fputs("</li>\n", st->out);
+            break;
+        case MD_CODE:
+            // trailing blank lines are dropped
+            fputs("</code></pre>\n", st->out);
+            st->blank_lines = 0;
+            st->fence_len = 0;
+            break;
+        default:
+            break;
+    }
+
+    st->open = MD_NONE;
+    st->html_end = NULL;
+}
+
+// also closes the block quote and, unless keep_list is set, the list
+static void md_close(struct md_state *st, bool keep_list) {
+    md_close_block(st);
+
+    if(st->quote) {
+        fputs("</blockquote>\n", st->out);
+        st->quote = false;
+    }
+
+    if(st->list != 0 && !keep_list) {
+        fputs(st->list == 1 ? "</ul>\n" : "</ol>\n", st->out);
+        st->list = 0;
+    }
+}
+
+static void md_code_line(struct md_state *st, const char *s, size_t len) {
+    if(len == 0) {
+        // only written if the code block continues
+        st->blank_lines++;
+        return;
+    }
+
+    for(; st->blank_lines > 0; st->blank_lines--) {
+        fputc('\n', st->out);
+    }
+
+    md_escaped(st->out, s, len);
+    fputc('\n', st->out);
+}
+
+static void md_open_text(struct md_state *st, enum md_block_type type, const char *text, size_t len) {
+    st->open = type;
+    st->text = text;
+    st->text_end = text + len;
+}
+
+static void md_html_line(struct md_state *st, const char *l, size_t len, const char *s, size_t slen) {
+    fwrite(l, 1, len, st->out);
+    fputc('\n', st->out);
+
+    st->open = MD_HTML;
+    st->html_end = md_html_end(s, slen);
+
+    if(st->html_end != NULL && md_contains(s, slen, st->html_end)) {
+        st->html_end = NULL;
+    }
+}
+
+static void md_line(struct md_state *st, const char *l, size_t len) {
+    FILE *out = st->out;
+    size_t width;
+    size_t ind = md_indent(l, len, &width);
+    const char *s = l + ind;
+    size_t slen = len - ind;
+
+    if(st->open == MD_CODE && st->fence_len > 0) {
+        if(width < 4 && md_run(s, slen, st->fence_char) >= st->fence_len &&
+           md_only(s, slen, st->fence_char, false)) {
+            md_close_block(st);
+        } else {
+            md_code_line(st, l, len);
+        }
+
+        return;
+    }
+
+    if(st->html_end != NULL) {
+        fwrite(l, 1, len, out);
+        fputc('\n', out);
+
+        if(md_contains(l, len, st->html_end)) {
+            md_close_block(st);
+        }
+
+        return;
+    }
+
+    if(slen == 0) {
+        if(st->open == MD_CODE) {
+            md_code_line(st, s, 0);
+        } else {
+            // lists continue after blank lines
+            md_close(st, true);
+        }
+
+        return;
+    }
+
+    bool in_text = st->open == MD_PARAGRAPH || st->open == MD_LIST_ITEM || st->quote;
+
+    if(width >= 4 && !in_text) {
+        if(st->open != MD_CODE) {
+            md_close(st, false);
+            fputs("<pre><code>", out);
+            st->open = MD_CODE;
+        }
+
+        // strip exactly four columns of indentation
+        size_t strip = 0;
+        for(size_t w = 0; w < 4; strip++) {
+            w = l[strip] == '\t' ? (w + 4) / 4 * 4 : w + 1;
+        }
+
+        md_code_line(st, l + strip, len - strip);
+        return;
+    }
+
+    if(st->open == MD_CODE) {
+        md_close_block(st);
+    }
+
+    if(st->open == MD_HTML) {
+        md_html_line(st, l, len, s, slen);
+        return;
+    }
+
+    enum md_block_type type = MD_PARAGRAPH;
+    const char *content = s;
+    size_t content_len = slen;
+    size_t fence_len = 0;
+    long number = 1;
+    size_t marker_len;
+    int level = 0;
+    int list = 0;
+
+    if(width >= 4) {
+        // lazy continuation of the open paragraph
+    } else if((fence_len = md_fence(s, slen)) > 0) {
+        type = MD_CODE;
+    } else if(st->open == MD_PARAGRAPH && !st->quote &&
+              (md_only(s, slen, '=', false) || md_only(s, slen, '-', false))) {
+        // setext heading underlining the paragraph
+        level = s[0] == '=' ? 1 : 2;
+
+        fprintf(out, "<h%d>", level);
+        md_inline(st, st->text, st->text_end - st->text, 0);
+        fprintf(out, "</h%d>\n", level);
+
+        st->open = MD_NONE;
+        return;
+    } else if((level = md_heading(s, slen, &content, &content_len)) > 0) {
+        type = MD_HEADING;
+    } else if(md_rule(s, slen)) {
+        type = MD_RULE;
+    } else if(s[0] == '>') {
+        type = MD_QUOTE;
+        content = s + 1;
+        content_len = slen - 1;
+
+        if(content_len > 0 && content[0] == ' ') {
+            content++;
+            content_len--;
+        }
+    } else if((list = md_list_marker(s, slen, &number, &marker_len)) > 0) {
+        type = MD_LIST_ITEM;
+        content = s + marker_len;
+        content_len = slen - marker_len;
+    } else if(md_html_start(s, slen)) {
+        type = MD_HTML;
+    }
+
+    if(type == MD_PARAGRAPH && in_text) {
+        // continuation line, also lazily continues quotes and list items
+        if(st->open == MD_NONE) {
+            md_open_text(st, MD_PARAGRAPH, s, slen);
+        } else {
+            st->text_end = s + slen;
+        }
+
+        return;
+    }
+
+    if(type == MD_QUOTE && st->quote) {
+        // empty lines separate paragraphs in block quotes
+        if(content_len == 0) {
+            md_close_block(st);
+        } else if(st->open == MD_PARAGRAPH) {
+            st->text_end = content + content_len;
+        } else {
+            md_open_text(st, MD_PARAGRAPH, content, content_len);
+        }
+
+        return;
+    }
+
+    md_close(st, type == MD_LIST_ITEM && list == st->list);
+
+    switch(type) {
+        case MD_CODE:
+            content = s + fence_len;
+            content_len = slen - fence_len;
+            content += md_indent(content, content_len, &width);
+            content_len = s + slen - content;
+
+            fputs("<pre><code", out);
+
+            // only use the first word as language
+            size_t info_len = 0;
+
+            while(info_len < content_len && !isspace((unsigned char) content[info_len])) {
+                info_len++;
+            }
+
+            if(info_len > 0) {
+                fputs(" class=\"language-", out);
+                md_escaped(out, content, info_len);
+                fputc('"', out);
+            }
+
+            fputc('>', out);
+
+            st->open = MD_CODE;
+            st->fence_len = fence_len;
+            st->fence_char = s[0];
+            break;
+        case MD_HEADING:
+            fprintf(out, "<h%d>", level);
+            md_inline(st, content, content_len, 0);
+            fprintf(out, "</h%d>\n", level);
+            break;
+        case MD_RULE:
+            fputs("<hr>\n", out);
+            break;
+        case MD_QUOTE:
+            fputs("<blockquote>\n", out);
+            st->quote = true;
+
+            if(content_len > 0) {
+                md_open_text(st, MD_PARAGRAPH, content, content_len);
+            }
+            break;
+        case MD_LIST_ITEM:
+            if(st->list == 0) {
+                if(list == 1) {
+                    fputs("<ul>\n", out);
+                } else if(number != 1) {
+                    fprintf(out, "<ol start=\"%ld\">\n", number);
+                } else {
+                    fputs("<ol>\n", out);
+                }
+
+                st->list = list;
+            }
+
+            md_open_text(st, MD_LIST_ITEM, content, content_len);
+            break;
+        case MD_HTML:
+            md_html_line(st, l, len, s, slen);
+            break;
+        default:
+            md_open_text(st, MD_PARAGRAPH, s, slen);
+            break;
+    }
+}
+
+int markdown_to_html(struct xml_context *ctx, const char *md, size_t size) {
+    struct md_state st;
+    const char *end = md + size;
+
+    memset(&st, 0, sizeof(struct md_state));
+    st.out = ctx->out;
+    st.open = MD_NONE;
+
+    for(const char *line = md; line < end;) {
+        const char *newline = memchr(line, '\n', end - line);
+        size_t len = (newline == NULL ? end : newline) - line;
+
+        md_line(&st, line, len > 0 && line[len - 1] == '\r' ? len - 1 : len);
+
+        line = newline == NULL ? end : newline + 1;
+    }
+
+    md_close(&st, false);
+
+    return ferror(st.out) ? -1 : 0;
+}
+
+void markdown_entry_text(struct xml_context *ctx, const struct entry *entry) {
+    if(entry->text_markdown) {
+        markdown_to_html(ctx, entry->text, entry->text_size);
+    } else {
+        xml_raw(ctx, entry->text);
+    }
+}
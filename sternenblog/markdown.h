@@ -0,0 +1,59 @@
+/*!
+ * @file markdown.h
+ * @brief Convert entries written in Markdown to HTML
+ *
+ * Supports the commonly used subset of Markdown:
+ *
+ * * ATX (`# Heading`) and setext (underlined) headings
+ * * paragraphs and hard line breaks (two trailing spaces or a backslash)
+ * * block quotes containing paragraphs
+ * * unordered (`-`, `*`, `+`) and ordered (`1.`, `1)`) lists, not nested
+ * * fenced (`` ``` `` or `~~~`) and indented code blocks
+ * * horizontal rules (`***`, `---` or `___`)
+ * * emphasis, strong emphasis, code spans, links, images,
+ *   autolinks (`<https://…>`) and backslash escapes
+ *
+ * Since entries are trusted, HTML is passed through: A line starting
+ * with a tag starts a raw HTML block which is copied verbatim up to
+ * the next blank line and tags as well as entities are allowed
+ * inline. Consequently HTML entries mostly render unchanged.
+ *
+ * The conversion is done in a single pass over the document: Every block
+ * is written as soon as its last line has been seen and its inline markup
+ * is rendered directly from the document, so nothing is copied or built
+ * up in memory. Memory use is constant regardless of the document's size,
+ * nesting of inline markup is limited to a depth of 16.
+ */
+
+#ifndef STERNENBLOG_MARKDOWN_H
+#define STERNENBLOG_MARKDOWN_H
+
+#include "core.h"
+#include "xml.h"
+
+/*!
+ * @brief Convert a Markdown document to HTML
+ *
+ * The generated HTML fragment is written to `ctx->out` as the
+ * document is scanned, without touching the tag stack of `ctx`.
+ * Empty elements are written without a closing slash (`<hr>`).
+ *
+ * @param ctx context to write the HTML to
+ * @param md Markdown document, doesn't need to be `NUL` terminated
+ * @param size size of `md` in bytes
+ * @return 0 on success, -1 if writing to `ctx->out` failed
+ */
+int markdown_to_html(struct xml_context *ctx, const char *md, size_t size);
+
+/*!
+ * @brief Output the text of an entry
+ *
+ * Writes `entry->text` to `ctx` like `xml_raw()` unless it is Markdown
+ * (`entry->text_markdown`), which is converted using `markdown_to_html()`
+ * while it is written. Templates should use it to output entries.
+ *
+ * @see entry_get_text
+ */
+void markdown_entry_text(struct xml_context *ctx, const struct entry *entry);
+
+#endif
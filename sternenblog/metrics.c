@@ -0,0 +1,153 @@
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "cgiutil.h"
+#include "core.h"
+#include "metrics.h"
+
+/*!
+ * @brief Number of distinct page types
+ */
+#define METRICS_PAGE_TYPES 3
+
+/*!
+ * @brief HTTP status codes requests are counted by
+ *
+ * Same set of codes `http_status_line()` knows about,
+ * any other status is counted as 500 like it is sent.
+ */
+static const int statuses[] = { 200, 400, 401, 403, 404, 500 };
+
+#define METRICS_STATUSES (sizeof(statuses) / sizeof(statuses[0]))
+
+/*!
+ * @brief Upper bounds of the latency histogram buckets in seconds
+ */
+static const double buckets[] = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1
+};
+
+#define METRICS_BUCKETS (sizeof(buckets) / sizeof(buckets[0]))
+
+static const char *counter_names[METRICS_COUNTER_COUNT] = {
+    "sternenblog_index_cache_hits_total",
+    "sternenblog_index_cache_misses_total",
+    "sternenblog_index_shared_hits_total",
+    "sternenblog_entries_served_total",
+    "sternenblog_entry_bytes_served_total",
+    "sternenblog_markdown_renders_total",
+    "sternenblog_missing_rejects_total"
+};
+
+static const char *counter_help[METRICS_COUNTER_COUNT] = {
+    "Index segments used from the index cache.",
+    "Index segments missing or outdated in the index cache.",
+    "Index segments mapped from the shared index of another process.",
+    "Entry texts read to be served.",
+    "Bytes of entry texts read to be served.",
+    "Entries converted from Markdown to HTML.",
+    "Requests for missing entries answered without accessing them."
+};
+
+static atomic_ullong counters[METRICS_COUNTER_COUNT];
+static atomic_ullong requests[METRICS_PAGE_TYPES][METRICS_STATUSES];
+// histogram buckets are not cumulative internally, the last one is +Inf
+static atomic_ullong latency_buckets[METRICS_BUCKETS + 1];
+static atomic_ullong latency_sum_us;
+static atomic_ullong index_builds;
+static atomic_ullong index_build_us;
+
+static unsigned long long to_us(double seconds) {
+    return seconds > 0 ? (unsigned long long) (seconds * 1e6) : 0;
+}
+
+static size_t status_pos(int status) {
+    for(size_t i = 0; i < METRICS_STATUSES; i++) {
+        if(statuses[i] == status) {
+            return i;
+        }
+    }
+
+    return METRICS_STATUSES - 1;
+}
+
+static const char *page_type_name(enum page_type page_type) {
+    switch(page_type) {
+        case PAGE_TYPE_ENTRY:
+            return "entry";
+        case PAGE_TYPE_INDEX:
+            return "index";
+        case PAGE_TYPE_ERROR:
+        default:
+            return "error";
+    }
+}
+
+void metrics_add(enum metrics_counter counter, unsigned long long n) {
+    atomic_fetch_add_explicit(&counters[counter], n, memory_order_relaxed);
+}
+
+void metrics_index_build(double seconds) {
+    atomic_fetch_add_explicit(&index_builds, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&index_build_us, to_us(seconds), memory_order_relaxed);
+}
+
+void metrics_request(enum page_type page_type, int status, double seconds) {
+    size_t bucket = 0;
+
+    while(bucket < METRICS_BUCKETS && seconds > buckets[bucket]) {
+        bucket++;
+    }
+
+    atomic_fetch_add_explicit(&requests[page_type % METRICS_PAGE_TYPES][status_pos(status)],
+                              1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&latency_buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&latency_sum_us, to_us(seconds), memory_order_relaxed);
+}
+
+static unsigned long long load(atomic_ullong *value) {
+    return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+void metrics_write(FILE *out) {
+    fputs("# HELP sternenblog_requests_total Requests handled by page type and status.\n"
+          "# TYPE sternenblog_requests_total counter\n", out);
+
+    for(int p = 0; p < METRICS_PAGE_TYPES; p++) {
+        for(size_t s = 0; s < METRICS_STATUSES; s++) {
+            // label with the code actually sent in the Status header
+            fprintf(out, "sternenblog_requests_total{page_type=\"%s\",status=\"%.3s\"} %llu\n",
+                    page_type_name(p), http_status_line(statuses[s]), load(&requests[p][s]));
+        }
+    }
+
+    fputs("# HELP sternenblog_request_duration_seconds Time spent handling requests.\n"
+          "# TYPE sternenblog_request_duration_seconds histogram\n", out);
+
+    unsigned long long cumulative = 0;
+
+    for(size_t b = 0; b < METRICS_BUCKETS; b++) {
+        cumulative += load(&latency_buckets[b]);
+        fprintf(out, "sternenblog_request_duration_seconds_bucket{le=\"%g\"} %llu\n",
+                buckets[b], cumulative);
+    }
+
+    cumulative += load(&latency_buckets[METRICS_BUCKETS]);
+    fprintf(out, "sternenblog_request_duration_seconds_bucket{le=\"+Inf\"} %llu\n", cumulative);
+    fprintf(out, "sternenblog_request_duration_seconds_sum %.6f\n", load(&latency_sum_us) / 1e6);
+    fprintf(out, "sternenblog_request_duration_seconds_count %llu\n", cumulative);
+
+    fputs("# HELP sternenblog_index_builds_total Directories read to build index segments.\n"
+          "# TYPE sternenblog_index_builds_total counter\n", out);
+    fprintf(out, "sternenblog_index_builds_total %llu\n", load(&index_builds));
+
+    fputs("# HELP sternenblog_index_build_seconds_total Time spent reading directories to build index segments.\n"
+          "# TYPE sternenblog_index_build_seconds_total counter\n", out);
+    fprintf(out, "sternenblog_index_build_seconds_total %.6f\n", load(&index_build_us) / 1e6);
+
+    for(int c = 0; c < METRICS_COUNTER_COUNT; c++) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+                counter_names[c], counter_help[c], counter_names[c],
+                counter_names[c], load(&counters[c]));
+    }
+}
@@ -0,0 +1,75 @@
+/*!
+ * @file metrics.h
+ * @brief Request and index counters in the Prometheus text format
+ *
+ * metrics.h keeps process wide counters about served requests, index
+ * builds and entries served. All counters are updated using relaxed
+ * lock-free atomic operations, so they can be updated from concurrently
+ * running requests without slowing them down.
+ *
+ * The counters are exposed by `main()` at `BLOG_METRICS_PATH` if it is set.
+ * Note that they only cover requests handled by the current process, so
+ * they are only really useful if sternenblog is running persistently.
+ */
+
+#ifndef STERNENBLOG_METRICS_H
+#define STERNENBLOG_METRICS_H
+
+#include <stdio.h>
+
+#include "core.h"
+
+/*!
+ * @brief Simple counters
+ *
+ * @see metrics_add
+ */
+enum metrics_counter {
+    METRICS_INDEX_CACHE_HITS,    //!< index segments used from the index cache
+    METRICS_INDEX_CACHE_MISSES,  //!< index segments not found (or outdated) in the index cache
+    METRICS_INDEX_SHARED_HITS,   //!< index segments mapped from the shared index
+    METRICS_ENTRIES_SERVED,      //!< entry texts read to be served
+    METRICS_BYTES_SERVED,        //!< bytes of entry texts read to be served
+    METRICS_MARKDOWN_RENDERS,    //!< entries converted from Markdown to HTML
+    METRICS_MISSING_REJECTS,     //!< requests for missing entries answered using the index only
+    METRICS_COUNTER_COUNT        //!< number of counters
+};
+
+/*!
+ * @brief Increase a counter
+ *
+ * @param counter the counter to update
+ * @param n amount to add
+ */
+void metrics_add(enum metrics_counter counter, unsigned long long n);
+
+/*!
+ * @brief Record a directory being read to build an index segment
+ *
+ * @param seconds wall clock time it took to read the directory and sort its entries
+ */
+void metrics_index_build(double seconds);
+
+/*!
+ * @brief Record a finished request
+ *
+ * Counts the request by `page_type` and `status` and adds
+ * its duration to the latency histogram.
+ *
+ * @param page_type type of the page that has been served
+ * @param status HTTP status of the response
+ * @param seconds wall clock time it took to handle the request
+ */
+void metrics_request(enum page_type page_type, int status, double seconds);
+
+/*!
+ * @brief Output all metrics
+ *
+ * Prints all metrics in the Prometheus text exposition format
+ * (version 0.0.4) to `out`.
+ *
+ * @param out where to write the metrics
+ */
+void metrics_write(FILE *out);
+
+#endif
@@ -0,0 +1,1154 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "core.h"
+#include "../config.h"
+#include "entry.h"
+#include "index.h"
+#include "search.h"
+#include "stringutil.h"
+#include "timeutil.h"
+
+#ifndef BLOG_FRONT_MATTER
+#define BLOG_FRONT_MATTER 0
+#endif
+
+#ifndef BLOG_SEARCH
+#define BLOG_SEARCH 0
+#endif
+
+#ifndef BLOG_ARCHIVE
+#define BLOG_ARCHIVE 0
+#endif
+
+/*!
+ * @brief Magic bytes identifying a search index
+ */
+#define SEARCH_MAGIC "sbterms"
+
+/*!
+ * @brief Version of the search index layout
+ *
+ * Must be incremented whenever the layout described by
+ * `struct search_header`, the splitting into terms or the
+ * publication times the archive keys are made of change.
+ */
+#define SEARCH_VERSION 2
+
+/*!
+ * @brief Settings the search index's contents depend on
+ */
+#define SEARCH_OPTIONS ((uint64_t) BLOG_ARCHIVE << 2 | BLOG_SEARCH << 1 | BLOG_FRONT_MATTER)
+
+/*!
+ * @brief Marks an entry of the outdated search index that isn't reused
+ */
+#define SEARCH_NO_DOC UINT32_MAX
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/*
+ * Posting list of a term while building the search index.
+ */
+struct builder_term {
+    uint32_t term;  // offset of the term in the pool
+    uint32_t count; // number of entries in docs
+    uint32_t size;  // allocated size of docs
+    bool unsorted;  // whether docs needs to be sorted
+    uint32_t *docs;
+};
+
+/*
+ * Terms and their posting lists, indexed by a hash table
+ * of term positions plus one (0 marks a free slot).
+ */
+struct search_builder {
+    char *pool;
+    size_t pool_len;
+    size_t pool_size;
+    struct builder_term *terms;
+    size_t term_count;
+    size_t term_size;
+    uint32_t *table;
+    size_t table_size;
+};
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+
+    for(size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static bool is_term_char(unsigned char c) {
+    return c >= 0x80 || (c >= '0' && c <= '9') ||
+           (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static bool is_entity_char(unsigned char c) {
+    return c == '#' || (c >= '0' && c <= '9') ||
+           (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+size_t search_next_term(const char **text, const char *end, char term[SEARCH_TERM_MAX + 1]) {
+    const char *p = *text;
+
+    while(p < end) {
+        unsigned char c = *p;
+
+        if(c == '<' && p + 1 < end && (p[1] == '/' || p[1] == '!' || p[1] == '?' ||
+                                       (is_term_char(p[1]) && (unsigned char) p[1] < 0x80))) {
+            const char *close = memchr(p, '>', end - p);
+            p = close == NULL ? end : close + 1;
+        } else if(c == '&') {
+            const char *q = p + 1;
+
+            while(q < end && q - p <= 10 && is_entity_char(*q)) {
+                q++;
+            }
+
+            p = q < end && *q == ';' ? q + 1 : p + 1;
+        } else if(is_term_char(c)) {
+            size_t len = 0;
+
+            for(; p < end && is_term_char(*p); p++) {
+                if(len < SEARCH_TERM_MAX) {
+                    term[len++] = *p >= 'A' && *p <= 'Z' ? *p - 'A' + 'a' : *p;
+                }
+            }
+
+            if(len >= SEARCH_TERM_MIN) {
+                term[len] = '\0';
+                *text = p;
+                return len;
+            }
+        } else {
+            p++;
+        }
+    }
+
+    *text = end;
+    return 0;
+}
+
+/*
+ * Decodes the next variable length integer of a posting list and adds
+ * it to *doc. Returns -1 at the end of the list or for a truncated one.
+ */
+static int posting_next(const unsigned char **p, const unsigned char *end, uint32_t *doc) {
+    uint32_t delta = 0;
+
+    for(unsigned shift = 0; *p < end && shift < 32; shift += 7) {
+        unsigned char byte = *(*p)++;
+        delta |= (uint32_t) (byte & 0x7f) << shift;
+
+        if(!(byte & 0x80)) {
+            *doc += delta;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static size_t varint_size(uint32_t value) {
+    size_t size = 1;
+
+    while(value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+
+    return size;
+}
+
+static unsigned char *varint_write(unsigned char *p, uint32_t value) {
+    while(value >= 0x80) {
+        *p++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+
+    *p++ = value;
+    return p;
+}
+
+/*
+ * Identifies the entries of index by their paths, modification times
+ * and sizes, so a search index built for them can be recognized. Only
+ * the fingerprints the segments were built with are combined, so this
+ * doesn't depend on the number of entries.
+ */
+static uint64_t search_fingerprint(const struct index *index) {
+    uint64_t hash = FNV_OFFSET;
+
+    for(size_t s = 0; s < index->segment_count; s++) {
+        const struct index_segment *segment = index->segments + s;
+        uint64_t count = segment->count;
+
+        hash = fnv1a(hash, &segment->header->fingerprint, sizeof(uint64_t));
+        hash = fnv1a(hash, &count, sizeof(uint64_t));
+    }
+
+    return hash;
+}
+
+static bool search_current(const struct search_index *search, const struct index *index,
+                           uint64_t fingerprint) {
+    return search->header != NULL && search->header->fingerprint == fingerprint &&
+           search->header->doc_count == index->count;
+}
+
+/*
+ * Points the members of search to the right locations in
+ * search->header which must be a block of block_size bytes.
+ * Fails if the block is not a valid search index.
+ */
+static int search_init(struct search_index *search, size_t block_size) {
+    const struct search_header *h = search->header;
+
+    if(block_size < sizeof(struct search_header) ||
+       memcmp(h->magic, SEARCH_MAGIC, sizeof(h->magic)) != 0 ||
+       h->version != SEARCH_VERSION ||
+       h->header_size != sizeof(struct search_header) ||
+       h->options != SEARCH_OPTIONS) {
+        return -1;
+    }
+
+    size_t doc_size = 2 * sizeof(int64_t) + sizeof(uint32_t);
+    size_t term_size = 3 * sizeof(uint32_t);
+    size_t left = block_size - sizeof(struct search_header);
+
+    if(h->doc_count > left / doc_size) {
+        return -1;
+    }
+
+    left -= h->doc_count * doc_size;
+
+    if(left < sizeof(uint32_t) || h->term_count > (left - sizeof(uint32_t)) / term_size) {
+        return -1;
+    }
+
+    left -= h->term_count * term_size + sizeof(uint32_t);
+
+    if(h->pool_size > left || h->postings_size != left - h->pool_size) {
+        return -1;
+    }
+
+    const char *p = (const char *) h + sizeof(struct search_header);
+
+    search->block_size = block_size;
+    search->mtimes = (const int64_t *) p;
+    p += h->doc_count * sizeof(int64_t);
+    search->sizes = (const uint64_t *) p;
+    p += h->doc_count * sizeof(uint64_t);
+    search->paths = (const uint32_t *) p;
+    p += h->doc_count * sizeof(uint32_t);
+    search->terms = (const uint32_t *) p;
+    p += h->term_count * sizeof(uint32_t);
+    search->counts = (const uint32_t *) p;
+    p += h->term_count * sizeof(uint32_t);
+    search->postings = (const uint32_t *) p;
+    p += (h->term_count + 1) * sizeof(uint32_t);
+    search->pool = p;
+    p += h->pool_size;
+    search->posting_data = (const unsigned char *) p;
+
+    // make sure no string can run past the end of the pool
+    if(h->pool_size > 0 && search->pool[h->pool_size - 1] != '\0') {
+        return -1;
+    }
+
+    for(size_t i = 0; i < h->doc_count; i++) {
+        if(search->paths[i] >= h->pool_size) {
+            return -1;
+        }
+    }
+
+    if(search->postings[0] != 0 || search->postings[h->term_count] != h->postings_size) {
+        return -1;
+    }
+
+    for(size_t t = 0; t < h->term_count; t++) {
+        if(search->terms[t] >= h->pool_size || search->postings[t] > search->postings[t + 1]) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void free_search_index(struct search_index *search) {
+    if(search->header != NULL) {
+        if(search->mapped) {
+            munmap((void *) search->header, search->block_size);
+        } else {
+            free((void *) search->header);
+        }
+    }
+
+    memset(search, 0, sizeof(struct search_index));
+}
+
+static int builder_add_string(struct search_builder *b, const char *str, size_t len, uint32_t *off) {
+    if(b->pool_len + len + 1 > b->pool_size) {
+        size_t size = b->pool_size == 0 ? 4096 : b->pool_size;
+
+        while(size < b->pool_len + len + 1) {
+            size *= 2;
+        }
+
+        // offsets into the pool are 32 bit
+        if(size - 1 > UINT32_MAX) {
+            return -1;
+        }
+
+        char *pool = realloc(b->pool, size);
+
+        if(pool == NULL) {
+            return -1;
+        }
+
+        b->pool = pool;
+        b->pool_size = size;
+    }
+
+    memcpy(b->pool + b->pool_len, str, len);
+    b->pool[b->pool_len + len] = '\0';
+    *off = b->pool_len;
+    b->pool_len += len + 1;
+
+    return 0;
+}
+
+static int builder_grow_table(struct search_builder *b) {
+    size_t size = b->table_size == 0 ? 1024 : 2 * b->table_size;
+    uint32_t *table = calloc(size, sizeof(uint32_t));
+
+    if(table == NULL) {
+        return -1;
+    }
+
+    for(size_t t = 0; t < b->term_count; t++) {
+        const char *term = b->pool + b->terms[t].term;
+        size_t slot = fnv1a(FNV_OFFSET, term, strlen(term)) & (size - 1);
+
+        while(table[slot] != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+
+        table[slot] = t + 1;
+    }
+
+    free(b->table);
+    b->table = table;
+    b->table_size = size;
+
+    return 0;
+}
+
+/*
+ * Returns the position of term in b->terms, adding it if necessary.
+ */
+static ssize_t builder_term(struct search_builder *b, const char *term, size_t len) {
+    // keep the hash table at most half full
+    if(2 * (b->term_count + 1) > b->table_size && builder_grow_table(b) == -1) {
+        return -1;
+    }
+
+    size_t mask = b->table_size - 1;
+    size_t slot = fnv1a(FNV_OFFSET, term, len) & mask;
+
+    for(; b->table[slot] != 0; slot = (slot + 1) & mask) {
+        const char *other = b->pool + b->terms[b->table[slot] - 1].term;
+
+        if(strncmp(other, term, len) == 0 && other[len] == '\0') {
+            return b->table[slot] - 1;
+        }
+    }
+
+    if(b->term_count == b->term_size) {
+        size_t size = b->term_size == 0 ? 1024 : 2 * b->term_size;
+        struct builder_term *terms = realloc(b->terms, size * sizeof(struct builder_term));
+
+        if(terms == NULL) {
+            return -1;
+        }
+
+        b->terms = terms;
+        b->term_size = size;
+    }
+
+    struct builder_term *t = b->terms + b->term_count;
+
+    if(builder_add_string(b, term, len, &t->term) == -1) {
+        return -1;
+    }
+
+    t->count = 0;
+    t->size = 0;
+    t->unsorted = false;
+    t->docs = NULL;
+
+    b->table[slot] = ++b->term_count;
+
+    return b->term_count - 1;
+}
+
+static int builder_post(struct search_builder *b, size_t term, uint32_t doc) {
+    struct builder_term *t = b->terms + term;
+
+    if(t->count > 0) {
+        uint32_t last = t->docs[t->count - 1];
+
+        // a term occurring multiple times in an entry
+        if(last == doc) {
+            return 0;
+        } else if(last > doc) {
+            t->unsorted = true;
+        }
+    }
+
+    if(t->count == t->size) {
+        uint32_t size = t->size == 0 ? 4 : 2 * t->size;
+        uint32_t *docs = realloc(t->docs, size * sizeof(uint32_t));
+
+        if(docs == NULL) {
+            return -1;
+        }
+
+        t->docs = docs;
+        t->size = size;
+    }
+
+    t->docs[t->count++] = doc;
+
+    return 0;
+}
+
+static int builder_add_text(struct search_builder *b, const char *text, size_t size, uint32_t doc) {
+    const char *end = text + size;
+    char term[SEARCH_TERM_MAX + 1];
+    size_t len;
+
+    while((len = search_next_term(&text, end, term)) > 0) {
+        ssize_t t = builder_term(b, term, len);
+
+        if(t == -1 || builder_post(b, t, doc) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int builder_add_key(struct search_builder *b, const char *prefix,
+                           const char *value, size_t value_len, uint32_t doc) {
+    size_t prefix_len = strlen(prefix);
+    char key[prefix_len + value_len + 1];
+
+    memcpy(key, prefix, prefix_len);
+    memcpy(key + prefix_len, value, value_len);
+    key[prefix_len + value_len] = '\0';
+
+    ssize_t t = builder_term(b, key, prefix_len + value_len);
+
+    return t == -1 ? -1 : builder_post(b, t, doc);
+}
+
+/*
+ * Adds the terms of an entry's file. Files which can't be read are
+ * skipped, they are unlikely to be served and can't be found then.
+ */
+static int builder_add_file(struct search_builder *b, int dir_fd, const char *path, uint32_t doc) {
+    int fd = openat(dir_fd, path, O_RDONLY);
+
+    if(fd == -1) {
+        return 0;
+    }
+
+    struct stat info;
+
+    if(fstat(fd, &info) == -1 || info.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    const char *text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(text == MAP_FAILED) {
+        return 0;
+    }
+
+    size_t skip = 0;
+
+    // title, tags and summary are taken from the index instead
+    if(BLOG_FRONT_MATTER) {
+        struct front_matter fm;
+        skip = entry_front_matter(text, info.st_size, &fm);
+    }
+
+    int result = builder_add_text(b, text + skip, info.st_size - skip, doc);
+
+    munmap((void *) text, info.st_size);
+
+    return result;
+}
+
+static void builder_free(struct search_builder *b) {
+    for(size_t t = 0; t < b->term_count; t++) {
+        free(b->terms[t].docs);
+    }
+
+    free(b->terms);
+    free(b->table);
+    free(b->pool);
+}
+
+/*
+ * Maps the documents of outdated to the positions in index of the entries
+ * whose file is unchanged, marking them in reused. Returns an array of the
+ * new positions (SEARCH_NO_DOC if not reused) or NULL on error.
+ */
+static uint32_t *search_reuse_docs(const struct index *index, const struct search_index *outdated,
+                                   bool *reused) {
+    size_t old_count = outdated->header->doc_count;
+    uint32_t *new_docs = malloc((old_count > 0 ? old_count : 1) * sizeof(uint32_t));
+    size_t table_size = 1024;
+
+    while(table_size < 2 * old_count) {
+        table_size *= 2;
+    }
+
+    uint32_t *table = calloc(table_size, sizeof(uint32_t));
+
+    if(new_docs == NULL || table == NULL) {
+        free(new_docs);
+        free(table);
+        return NULL;
+    }
+
+    for(size_t d = 0; d < old_count; d++) {
+        const char *path = outdated->pool + outdated->paths[d];
+        size_t slot = fnv1a(FNV_OFFSET, path, strlen(path)) & (table_size - 1);
+
+        while(table[slot] != 0) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+
+        table[slot] = d + 1;
+        new_docs[d] = SEARCH_NO_DOC;
+    }
+
+    uint32_t doc = 0;
+
+    for(size_t s = 0; s < index->segment_count; s++) {
+        const struct index_segment *segment = index->segments + s;
+
+        for(size_t i = 0; i < segment->count; i++, doc++) {
+            const char *path = segment->pool + segment->paths[i];
+            size_t slot = fnv1a(FNV_OFFSET, path, strlen(path)) & (table_size - 1);
+
+            for(; table[slot] != 0; slot = (slot + 1) & (table_size - 1)) {
+                size_t d = table[slot] - 1;
+
+                if(strcmp(outdated->pool + outdated->paths[d], path) == 0) {
+                    if(outdated->mtimes[d] == segment->mtimes[i] &&
+                       outdated->sizes[d] == segment->sizes[i] && new_docs[d] == SEARCH_NO_DOC) {
+                        new_docs[d] = doc;
+                        reused[doc] = true;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    free(table);
+
+    return new_docs;
+}
+
+/*
+ * Adds the posting lists of outdated for all reused entries to the builder.
+ */
+static int builder_add_outdated(struct search_builder *b, const struct search_index *outdated,
+                                const uint32_t *new_docs) {
+    for(size_t t = 0; t < outdated->header->term_count; t++) {
+        const unsigned char *p = outdated->posting_data + outdated->postings[t];
+        const unsigned char *end = outdated->posting_data + outdated->postings[t + 1];
+        ssize_t term = -1;
+        uint32_t doc = 0;
+
+        while(posting_next(&p, end, &doc) == 0) {
+            if(doc >= outdated->header->doc_count || new_docs[doc] == SEARCH_NO_DOC) {
+                continue;
+            }
+
+            if(term == -1) {
+                const char *str = outdated->pool + outdated->terms[t];
+                term = builder_term(b, str, strlen(str));
+            }
+
+            if(term == -1 || builder_post(b, term, new_docs[doc]) == -1) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int compare_docs(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+struct term_order {
+    const char *term;
+    uint32_t pos;
+};
+
+static int compare_terms(const void *a, const void *b) {
+    return strcmp(((const struct term_order *) a)->term, ((const struct term_order *) b)->term);
+}
+
+/*
+ * Sorts the terms of the builder and lays them out into a single dynamically
+ * allocated block as described by struct search_header. doc_paths are the
+ * offsets of the entries' paths in the builder's pool.
+ */
+static int search_from_builder(struct search_builder *b, const struct index *index,
+                               const uint32_t *doc_paths, uint64_t fingerprint,
+                               struct search_index *search) {
+    struct term_order *order = malloc((b->term_count > 0 ? b->term_count : 1) * sizeof(struct term_order));
+
+    if(order == NULL) {
+        return -1;
+    }
+
+    size_t postings_size = 0;
+
+    for(size_t t = 0; t < b->term_count; t++) {
+        struct builder_term *term = b->terms + t;
+
+        if(term->unsorted) {
+            qsort(term->docs, term->count, sizeof(uint32_t), compare_docs);
+        }
+
+        for(uint32_t i = 0; i < term->count; i++) {
+            postings_size += varint_size(term->docs[i] - (i > 0 ? term->docs[i - 1] : 0));
+        }
+
+        order[t].term = b->pool + term->term;
+        order[t].pos = t;
+    }
+
+    // offsets of posting lists are 32 bit
+    if(postings_size > UINT32_MAX) {
+        free(order);
+        return -1;
+    }
+
+    qsort(order, b->term_count, sizeof(struct term_order), compare_terms);
+
+    size_t doc_count = index->count;
+    size_t block_size = sizeof(struct search_header)
+        + doc_count * (2 * sizeof(int64_t) + sizeof(uint32_t))
+        + b->term_count * 3 * sizeof(uint32_t) + sizeof(uint32_t)
+        + b->pool_len + postings_size;
+
+    struct search_header *h = malloc(block_size);
+
+    if(h == NULL) {
+        free(order);
+        return -1;
+    }
+
+    memset(h, 0, sizeof(struct search_header));
+    memcpy(h->magic, SEARCH_MAGIC, sizeof(h->magic));
+    h->version = SEARCH_VERSION;
+    h->header_size = sizeof(struct search_header);
+    h->fingerprint = fingerprint;
+    h->options = SEARCH_OPTIONS;
+    h->doc_count = doc_count;
+    h->term_count = b->term_count;
+    h->pool_size = b->pool_len;
+    h->postings_size = postings_size;
+
+    char *p = (char *) h + sizeof(struct search_header);
+    int64_t *mtimes = (int64_t *) p;
+    p += doc_count * sizeof(int64_t);
+    uint64_t *sizes = (uint64_t *) p;
+    p += doc_count * sizeof(uint64_t);
+    uint32_t *paths = (uint32_t *) p;
+    p += doc_count * sizeof(uint32_t);
+    uint32_t *terms = (uint32_t *) p;
+    p += b->term_count * sizeof(uint32_t);
+    uint32_t *counts = (uint32_t *) p;
+    p += b->term_count * sizeof(uint32_t);
+    uint32_t *postings = (uint32_t *) p;
+    p += (b->term_count + 1) * sizeof(uint32_t);
+    char *pool = p;
+    p += b->pool_len;
+    unsigned char *posting_data = (unsigned char *) p;
+
+    size_t doc = 0;
+
+    for(size_t s = 0; s < index->segment_count; s++) {
+        const struct index_segment *segment = index->segments + s;
+
+        for(size_t i = 0; i < segment->count; i++, doc++) {
+            mtimes[doc] = segment->mtimes[i];
+            sizes[doc] = segment->sizes[i];
+            paths[doc] = doc_paths[doc];
+        }
+    }
+
+    unsigned char *data = posting_data;
+
+    for(size_t t = 0; t < b->term_count; t++) {
+        const struct builder_term *term = b->terms + order[t].pos;
+
+        terms[t] = term->term;
+        counts[t] = term->count;
+        postings[t] = data - posting_data;
+
+        for(uint32_t i = 0; i < term->count; i++) {
+            data = varint_write(data, term->docs[i] - (i > 0 ? term->docs[i - 1] : 0));
+        }
+    }
+
+    postings[b->term_count] = data - posting_data;
+
+    if(b->pool_len > 0) {
+        memcpy(pool, b->pool, b->pool_len);
+    }
+
+    free(order);
+
+    search->header = h;
+    search->mapped = false;
+
+    if(search_init(search, block_size) == -1) {
+        free_search_index(search);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Adds the words of the title, tags, summary and file of the entry
+ * at position i of segment.
+ */
+static int builder_add_words(struct search_builder *b, const struct index_segment *segment,
+                             size_t i, int dir_fd, uint32_t doc) {
+    const uint32_t strings[] = { segment->titles[i], segment->tags[i], segment->summaries[i] };
+
+    for(size_t j = 0; j < sizeof(strings) / sizeof(strings[0]); j++) {
+        if(strings[j] != INDEX_NO_STRING) {
+            const char *str = segment->pool + strings[j];
+
+            if(builder_add_text(b, str, strlen(str), doc) == -1) {
+                return -1;
+            }
+        }
+    }
+
+    return builder_add_file(b, dir_fd, segment->pool + segment->paths[i], doc);
+}
+
+/*
+ * Adds the keys of the tags and the month of publication
+ * of the entry at position i of segment.
+ */
+static int builder_add_keys(struct search_builder *b, const struct index_segment *segment,
+                            size_t i, uint32_t doc) {
+    if(segment->tags[i] != INDEX_NO_STRING) {
+        const char *tags = segment->pool + segment->tags[i];
+        const char *tag;
+        size_t len;
+
+        while((tag = entry_next_tag(&tags, &len)) != NULL) {
+            if(builder_add_key(b, SEARCH_KEY_TAG, tag, len, doc) == -1) {
+                return -1;
+            }
+        }
+    }
+
+    char month[MAX_TIMESTR_SIZE];
+    time_t time = segment->times[i];
+    size_t month_len = flocaltime(month, ARCHIVE_TIME_FORMAT, sizeof(month), &time);
+
+    if(month_len > 0 && builder_add_key(b, SEARCH_KEY_ARCHIVE, month, month_len, doc) == -1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Adds the paths of all entries of index to the builder, storing their
+ * offsets in doc_paths, and the terms of all entries not marked in reused.
+ */
+static int builder_add_docs(struct search_builder *b, const struct index *index, int dir_fd,
+                            const bool *reused, uint32_t *doc_paths) {
+    uint32_t doc = 0;
+
+    for(size_t s = 0; s < index->segment_count; s++) {
+        const struct index_segment *segment = index->segments + s;
+
+        for(size_t i = 0; i < segment->count; i++, doc++) {
+            const char *path = segment->pool + segment->paths[i];
+
+            if(builder_add_string(b, path, strlen(path), doc_paths + doc) == -1) {
+                return -1;
+            }
+
+            if(reused[doc]) {
+                continue;
+            }
+
+            if(BLOG_SEARCH && builder_add_words(b, segment, i, dir_fd, doc) == -1) {
+                return -1;
+            }
+
+            if(BLOG_ARCHIVE && builder_add_keys(b, segment, i, doc) == -1) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Builds the search index for index, reusing the posting
+ * lists of unchanged entries from outdated if possible.
+ */
+static int search_build(const struct index *index, const char *blog_dir, uint64_t fingerprint,
+                        const struct search_index *outdated, struct search_index *search) {
+    size_t doc_count = index->count;
+    int dir_fd = entry_dir_fd(blog_dir);
+
+    if((BLOG_SEARCH && dir_fd == -1) || doc_count >= SEARCH_NO_DOC) {
+        return -1;
+    }
+
+    struct search_builder b;
+    memset(&b, 0, sizeof(struct search_builder));
+
+    bool *reused = calloc(doc_count > 0 ? doc_count : 1, sizeof(bool));
+    uint32_t *doc_paths = malloc((doc_count > 0 ? doc_count : 1) * sizeof(uint32_t));
+    uint32_t *new_docs = NULL;
+    int result = -1;
+
+    if(reused != NULL && doc_paths != NULL && outdated->header != NULL) {
+        new_docs = search_reuse_docs(index, outdated, reused);
+    }
+
+    if(reused != NULL && doc_paths != NULL &&
+       (outdated->header == NULL || (new_docs != NULL && builder_add_outdated(&b, outdated, new_docs) == 0)) &&
+       builder_add_docs(&b, index, dir_fd, reused, doc_paths) == 0) {
+        result = search_from_builder(&b, index, doc_paths, fingerprint, search);
+    }
+
+    builder_free(&b);
+    free(new_docs);
+    free(doc_paths);
+    free(reused);
+
+    return result;
+}
+
+#ifdef BLOG_CACHE_DIR
+/*
+ * Maps the search index file at cache_path,
+ * regardless of whether it is still current.
+ */
+static int search_cache_load(const char *cache_path, struct search_index *search) {
+    int fd = open(cache_path, O_RDONLY);
+
+    if(fd == -1) {
+        return -1;
+    }
+
+    struct stat cache_info;
+
+    if(fstat(fd, &cache_info) == -1 || (size_t) cache_info.st_size < sizeof(struct search_header)) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, cache_info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(map == MAP_FAILED) {
+        return -1;
+    }
+
+    search->header = map;
+    search->mapped = true;
+    search->block_size = cache_info.st_size;
+
+    if(search_init(search, cache_info.st_size) == -1) {
+        free_search_index(search);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void search_cache_write(const char *cache_path, const struct search_index *search) {
+    char *tmp_path = catn_alloc(2, cache_path, ".XXXXXX");
+
+    if(tmp_path == NULL) {
+        return;
+    }
+
+    int fd = mkstemp(tmp_path);
+
+    if(fd == -1) {
+        free(tmp_path);
+        return;
+    }
+
+    const char *p = (const char *) search->header;
+    size_t left = search->block_size;
+
+    while(left > 0) {
+        ssize_t written = write(fd, p, left);
+
+        if(written <= 0) {
+            break;
+        }
+
+        p += written;
+        left -= written;
+    }
+
+    // replace the old file atomically, so concurrent readers never see a partial one
+    if(close(fd) != 0 || left > 0 || rename(tmp_path, cache_path) == -1) {
+        unlink(tmp_path);
+    }
+
+    free(tmp_path);
+}
+#endif
+
+int update_search_index(const struct index *index, const char *blog_dir,
+                        struct search_index *search) {
+    uint64_t fingerprint = search_fingerprint(index);
+
+    if(search_current(search, index, fingerprint)) {
+        return 0;
+    }
+
+    struct search_index cached;
+    memset(&cached, 0, sizeof(struct search_index));
+
+#ifdef BLOG_CACHE_DIR
+    const char *cache_path = BLOG_CACHE_DIR "/search";
+
+    if(search_cache_load(cache_path, &cached) == 0 && search_current(&cached, index, fingerprint)) {
+        free_search_index(search);
+        *search = cached;
+        return 0;
+    }
+#endif
+
+    // another process may have updated the cache more recently
+    const struct search_index *outdated = cached.header != NULL ? &cached : search;
+    struct search_index rebuilt;
+    memset(&rebuilt, 0, sizeof(struct search_index));
+
+    int result = search_build(index, blog_dir, fingerprint, outdated, &rebuilt);
+
+    free_search_index(&cached);
+
+    if(result == -1) {
+        return -1;
+    }
+
+#ifdef BLOG_CACHE_DIR
+    search_cache_write(cache_path, &rebuilt);
+#endif
+
+    free_search_index(search);
+    *search = rebuilt;
+
+    return 0;
+}
+
+static ssize_t search_find_term(const struct search_index *search, const char *term) {
+    size_t low = 0;
+    size_t high = search->header->term_count;
+
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        int cmp = strcmp(search->pool + search->terms[mid], term);
+
+        if(cmp == 0) {
+            return mid;
+        } else if(cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Decodes the posting list of the term at position t into a
+ * dynamically allocated array. Returns its length or -1 on error.
+ */
+static ssize_t search_postings(const struct search_index *search, size_t t, size_t **docs) {
+    *docs = malloc((search->counts[t] > 0 ? search->counts[t] : 1) * sizeof(size_t));
+
+    if(*docs == NULL) {
+        return -1;
+    }
+
+    const unsigned char *p = search->posting_data + search->postings[t];
+    const unsigned char *end = search->posting_data + search->postings[t + 1];
+    uint32_t doc = 0;
+    size_t count = 0;
+
+    while(count < search->counts[t] && posting_next(&p, end, &doc) == 0 &&
+          doc < search->header->doc_count) {
+        (*docs)[count++] = doc;
+    }
+
+    return count;
+}
+
+ssize_t search_key(const struct search_index *search, const char *prefix, const char *value,
+                   size_t **results) {
+    *results = NULL;
+
+    if(search->header == NULL) {
+        return 0;
+    }
+
+    char *key = catn_alloc(2, prefix, value);
+
+    if(key == NULL) {
+        return -1;
+    }
+
+    ssize_t t = search_find_term(search, key);
+    ssize_t count = 0;
+
+    free(key);
+
+    if(t != -1) {
+        count = search_postings(search, t, results);
+
+        if(count == 0) {
+            free(*results);
+            *results = NULL;
+        }
+    }
+
+    return count;
+}
+
+ssize_t search_query(const struct search_index *search, const char *query, size_t **results) {
+    *results = NULL;
+
+    if(search->header == NULL || query == NULL) {
+        return 0;
+    }
+
+    // terms of the query ordered by the length of their posting list
+    size_t found[SEARCH_QUERY_TERMS];
+    size_t found_count = 0;
+
+    const char *end = query + strlen(query);
+    char term[SEARCH_TERM_MAX + 1];
+
+    while(found_count < SEARCH_QUERY_TERMS && search_next_term(&query, end, term) > 0) {
+        ssize_t t = search_find_term(search, term);
+
+        // no entry contains this term
+        if(t == -1) {
+            return 0;
+        }
+
+        bool repeated = false;
+
+        for(size_t j = 0; j < found_count; j++) {
+            repeated = repeated || found[j] == (size_t) t;
+        }
+
+        if(!repeated) {
+            size_t j = found_count++;
+
+            for(; j > 0 && search->counts[found[j - 1]] > search->counts[t]; j--) {
+                found[j] = found[j - 1];
+            }
+
+            found[j] = t;
+        }
+    }
+
+    if(found_count == 0) {
+        return 0;
+    }
+
+    size_t *docs;
+    ssize_t count = search_postings(search, found[0], &docs);
+
+    if(count == -1) {
+        return -1;
+    }
+
+    // intersect with the longer posting lists
+    for(size_t k = 1; k < found_count && count > 0; k++) {
+        const unsigned char *p = search->posting_data + search->postings[found[k]];
+        const unsigned char *p_end = search->posting_data + search->postings[found[k] + 1];
+        uint32_t doc = 0;
+
+        bool have = posting_next(&p, p_end, &doc) == 0;
+        size_t kept = 0;
+
+        for(size_t i = 0; i < (size_t) count && have; i++) {
+            while(have && doc < docs[i]) {
+                have = posting_next(&p, p_end, &doc) == 0;
+            }
+
+            if(have && doc == docs[i]) {
+                docs[kept++] = docs[i];
+            }
+        }
+
+        count = kept;
+    }
+
+    if(count == 0) {
+        free(docs);
+        return 0;
+    }
+
+    *results = docs;
+
+    return count;
+}
@@ -0,0 +1,207 @@
+/*!
+ * @file search.h
+ * @brief Full text search, tag and archive lookups using an inverted index
+ *
+ * The search index maps every term occurring in the entries to a posting
+ * list of the entries containing it. Entries are identified by their
+ * position in the complete index (see index.h), so a posting list is an
+ * ascending list of positions, i. e. sorted newest first. Posting lists are
+ * stored as the differences between consecutive positions encoded as
+ * variable length integers (7 bits per byte, least significant first),
+ * so most positions take a single byte.
+ *
+ * Like an index segment, the search index is a single block of memory laid
+ * out like the search index file in `BLOG_CACHE_DIR`, so the file is used
+ * directly via `mmap()`: A query only touches the term table during a binary
+ * search and the posting lists of its own terms.
+ *
+ * If `BLOG_ARCHIVE` is enabled, the search index additionally contains keys
+ * for the tags and the month of publication of every entry, e. g. `tag:c`
+ * and `archive:2020/08`. Since words never contain a colon, they can't be
+ * confused with the words of the entries. They are taken from the index,
+ * so no entry has to be read for them. Use `search_key()` to look them up.
+ *
+ * The search index is rebuilt incrementally: Posting lists of entries whose
+ * modification time and size are unchanged are taken from the outdated
+ * search index, only new and changed entries are read and split into terms.
+ * Entries are only read at all if `BLOG_SEARCH` is enabled.
+ */
+
+#ifndef STERNENBLOG_SEARCH_H
+#define STERNENBLOG_SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "index.h"
+
+/*!
+ * @brief Minimum length of a term in bytes
+ *
+ * Shorter words are neither indexed nor searched for.
+ */
+#define SEARCH_TERM_MIN 2
+
+/*!
+ * @brief Maximum length of a term in bytes
+ *
+ * Longer words are truncated to this length.
+ */
+#define SEARCH_TERM_MAX 32
+
+/*!
+ * @brief Maximum number of terms of a query
+ *
+ * Further terms of a query are ignored.
+ */
+#define SEARCH_QUERY_TERMS 8
+
+/*!
+ * @brief Prefix of the keys of tags
+ *
+ * @see search_key
+ */
+#define SEARCH_KEY_TAG "tag:"
+
+/*!
+ * @brief Prefix of the keys of months of publication
+ *
+ * The month is formatted using `flocaltime()` with `ARCHIVE_TIME_FORMAT`.
+ *
+ * @see search_key
+ */
+#define SEARCH_KEY_ARCHIVE "archive:"
+
+/*!
+ * @brief Header of a search index
+ *
+ * It is followed by the arrays `mtimes`, `sizes` and `paths` with
+ * `doc_count` elements, the arrays `terms` and `counts` with `term_count`
+ * elements and `postings` with `term_count + 1` elements (in this order),
+ * the string pool of `pool_size` bytes and the posting lists of
+ * `postings_size` bytes.
+ *
+ * @see struct search_index
+ */
+struct search_header {
+    char magic[8];          //!< `"sbterms"` including the `NUL` byte
+    uint32_t version;       //!< version of the layout
+    uint32_t header_size;   //!< `sizeof(struct search_header)`
+    uint64_t fingerprint;   //!< identifies the entries of the index the search index was built for
+    uint64_t options;       //!< settings affecting the contents the search index was built with
+    uint64_t doc_count;     //!< number of entries
+    uint64_t term_count;    //!< number of distinct terms
+    uint64_t pool_size;     //!< size of the string pool in bytes
+    uint64_t postings_size; //!< size of the posting lists in bytes
+};
+
+/*!
+ * @brief Inverted index of all entries
+ *
+ * All pointers point into a single block of memory starting with
+ * `header` which is either dynamically allocated or a mapped search
+ * index file. Terms are sorted by `strcmp()`.
+ *
+ * String members are offsets into `pool` pointing
+ * to `NUL` terminated strings.
+ *
+ * @see update_search_index
+ * @see search_query
+ */
+struct search_index {
+    const struct search_header *header; //!< start of the search index's memory, `NULL` if empty
+    size_t block_size;                  //!< size of the search index's memory
+    bool mapped;                        //!< whether the memory is mapped using `mmap()`
+    const int64_t *mtimes;              //!< modification times of the entries' files
+    const uint64_t *sizes;              //!< sizes of the entries' files
+    const uint32_t *paths;              //!< paths to the entries relative to `blog_dir`
+    const uint32_t *terms;              //!< terms in ascending order
+    const uint32_t *counts;             //!< number of entries containing each term
+    const uint32_t *postings;           //!< offsets of the terms' posting lists, followed by their end
+    const char *pool;                   //!< string pool
+    const unsigned char *posting_data;  //!< encoded posting lists
+};
+
+/*!
+ * @brief Split text into terms
+ *
+ * Returns the next term of the text starting at `*text` and advances `*text`
+ * past it. Terms are runs of ASCII letters and digits as well as non-ASCII
+ * bytes (i. e. UTF-8 encoded characters), ASCII letters are converted to
+ * lower case. HTML tags and entities are skipped, so both HTML and Markdown
+ * entries are split into the words of their text. Terms shorter than
+ * `SEARCH_TERM_MIN` are skipped, longer ones than `SEARCH_TERM_MAX` truncated.
+ *
+ * @param text pointer to the start of the text to split, updated
+ * @param end end of the text
+ * @param term buffer for the `NUL` terminated term
+ * @return length of the term or 0 if the end of the text has been reached
+ */
+size_t search_next_term(const char **text, const char *end, char term[SEARCH_TERM_MAX + 1]);
+
+/*!
+ * @brief Bring the search index up to date with an index
+ *
+ * Makes sure `search` covers exactly the entries of `index` which must not
+ * be limited using `max_count`, see `update_index()`. This is decided using
+ * the fingerprints stored in the index segments, so checking an unchanged
+ * index only takes time proportional to the number of segments. If it
+ * doesn't, `search` is replaced by the search index file in `BLOG_CACHE_DIR`
+ * if that one is current or rebuilt otherwise. Rebuilding reuses the posting
+ * lists of all entries whose modification time and size are unchanged from
+ * the outdated search index, so only new and changed entries' files are
+ * read. The result is stored in `BLOG_CACHE_DIR` again.
+ *
+ * @param index complete index of the blog
+ * @param blog_dir path to the directory entries are stored in
+ * @param search search index to update, zero initialized if there is none yet
+ * @return 0 on success, -1 on error in which case `search` is unchanged
+ * @see free_search_index
+ */
+int update_search_index(const struct index *index, const char *blog_dir,
+                        struct search_index *search);
+
+/*!
+ * @brief Look up the entries containing all terms of a query
+ *
+ * Splits `query` into terms using `search_next_term()` and intersects the
+ * posting lists of the first `SEARCH_QUERY_TERMS` of them. The result is a
+ * dynamically allocated array of the positions in the index of all entries
+ * containing every term, sorted ascending, i. e. newest first, which must
+ * be passed to `free()` afterwards.
+ *
+ * @param search search index updated using `update_search_index()`
+ * @param query query as entered by the user
+ * @param results location to store the array of positions at, `NULL` if there are none
+ * @return number of positions or -1 on error
+ */
+ssize_t search_query(const struct search_index *search, const char *query, size_t **results);
+
+/*!
+ * @brief Look up the entries with a tag or month of publication
+ *
+ * Returns the posting list of the key `prefix` followed by `value` like
+ * `search_query()` does for a query. Only the posting list of the key is
+ * decoded, so the cost only depends on the number of entries found.
+ *
+ * @param search search index updated using `update_search_index()`
+ * @param prefix `SEARCH_KEY_TAG` or `SEARCH_KEY_ARCHIVE`
+ * @param value tag or month of publication as `yyyy/mm`
+ * @param results location to store the array of positions at, `NULL` if there are none
+ * @return number of positions or -1 on error
+ */
+ssize_t search_key(const struct search_index *search, const char *prefix, const char *value,
+                   size_t **results);
+
+/*!
+ * @brief Free a search index
+ *
+ * Frees or unmaps the search index and resets it to be empty.
+ *
+ * @param search search index updated using `update_search_index()`
+ */
+void free_search_index(struct search_index *search);
+
+#endif
@@ -0,0 +1,1268 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../config.h"
+#include "server.h"
+#include "stringutil.h"
+
+#ifndef BLOG_SERVER_THREADS
+#define BLOG_SERVER_THREADS 0
+#endif
+
+#ifndef BLOG_SERVER_PROCESSES
+#define BLOG_SERVER_PROCESSES 0
+#endif
+
+#ifndef BLOG_SERVER_MAX_REQUESTS
+#define BLOG_SERVER_MAX_REQUESTS 0
+#endif
+
+#ifndef BLOG_SERVER_MAX_RSS
+#define BLOG_SERVER_MAX_RSS 0
+#endif
+
+#ifndef BLOG_SERVER_CPU_AFFINITY
+#define BLOG_SERVER_CPU_AFFINITY 0
+#endif
+
+/*!
+ * @brief Maximum size of a request's header section
+ *
+ * Requests exceeding it are answered with 431 and the connection is closed.
+ */
+#define SERVER_MAX_HEADER_SIZE 8192
+
+/*!
+ * @brief Seconds after which idle connections are closed
+ */
+#define SERVER_KEEPALIVE_TIMEOUT 10
+
+/*!
+ * @brief Maximum number of events handled per `epoll_wait()` call
+ */
+#define SERVER_MAX_EVENTS 64
+
+/*!
+ * @brief Protocol spoken by the server
+ */
+enum server_protocol {
+    SERVER_PROTOCOL_HTTP,  //!< HTTP/1.1 directly to clients
+    SERVER_PROTOCOL_SCGI   //!< SCGI behind a web server
+};
+
+/*!
+ * @brief State of a single client connection
+ *
+ * A connection is only ever handled by the worker that accepted it.
+ * While a response is still being sent, no further requests are read.
+ */
+struct connection {
+    int fd;                              //!< client socket
+    char in[SERVER_MAX_HEADER_SIZE];     //!< received, not yet handled data
+    size_t in_len;                       //!< number of bytes in `in`
+    char *out;                           //!< response (or its headers) to be sent
+    size_t out_len;                      //!< size of `out`
+    size_t out_pos;                      //!< bytes of `out` sent so far
+    int file_fd;                         //!< file to send after `out` or `-1`
+    off_t file_pos;                      //!< offset of the next byte of `file_fd` to send
+    off_t file_end;                      //!< size of `file_fd`
+    bool eof;                            //!< whether the client has shut down its side
+    bool close_after;                    //!< whether to close after sending the response
+    uint32_t events;                     //!< events currently registered with epoll
+    time_t last_active;                  //!< last time data has been received or sent
+    struct connection *prev;             //!< previous connection of the worker
+    struct connection *next;             //!< next connection of the worker
+};
+
+/*!
+ * @brief State of a worker thread
+ */
+struct worker {
+    pthread_t thread;                    //!< the worker's thread
+    int epoll_fd;                        //!< the worker's epoll instance
+    int listen_fd;                       //!< shared listening socket
+    enum server_protocol protocol;       //!< protocol to speak with clients
+    server_handler handler;              //!< function serving requests
+    struct connection *connections;      //!< connections accepted by this worker
+    long cpu;                            //!< CPU to pin the thread to if enabled
+    bool draining;                       //!< whether the worker stopped accepting connections
+};
+
+static char *default_server_name;
+static char *default_server_port;
+
+// set when the process should exit once its connections are closed
+static atomic_bool stopping;
+// whether the process is a worker of the supervisor, i. e. may be replaced
+static bool supervised = false;
+static atomic_ullong requests_served;
+
+static time_t monotonic_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+
+    if(flags == -1) {
+        return -1;
+    }
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void connection_close(struct worker *w, struct connection *c) {
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+
+    if(c->file_fd != -1) {
+        close(c->file_fd);
+    }
+
+    free(c->out);
+
+    if(c->prev != NULL) {
+        c->prev->next = c->next;
+    } else {
+        w->connections = c->next;
+    }
+
+    if(c->next != NULL) {
+        c->next->prev = c->prev;
+    }
+
+    free(c);
+}
+
+static int connection_want(struct worker *w, struct connection *c, uint32_t events) {
+    if(c->events == events) {
+        return 0;
+    }
+
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = c;
+
+    if(epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+        return -1;
+    }
+
+    c->events = events;
+    return 0;
+}
+
+/*
+ * Sends as much of the pending response as possible.
+ * Returns 0 if it has been sent completely, 1 if the
+ * socket isn't writeable at the moment and -1 on error.
+ */
+static int connection_flush(struct connection *c) {
+    while(c->out_pos < c->out_len) {
+        // let the kernel coalesce headers and file instead of sending them separately
+        int flags = MSG_NOSIGNAL | (c->file_fd != -1 ? MSG_MORE : 0);
+        ssize_t n = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos, flags);
+
+        if(n == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1;
+        }
+
+        c->out_pos += n;
+        c->last_active = monotonic_now();
+    }
+
+    free(c->out);
+    c->out = NULL;
+    c->out_len = c->out_pos = 0;
+
+    while(c->file_fd != -1 && c->file_pos < c->file_end) {
+        ssize_t n = sendfile(c->fd, c->file_fd, &c->file_pos, c->file_end - c->file_pos);
+
+        if(n == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1;
+        } else if(n == 0) {
+            // file has been truncated since the headers have been sent
+            return -1;
+        }
+
+        c->last_active = monotonic_now();
+    }
+
+    if(c->file_fd != -1) {
+        close(c->file_fd);
+        c->file_fd = -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Writes the status line and the headers common to all responses.
+ */
+static void response_start(FILE *out, const char *status, size_t status_len, bool keep_alive) {
+    char date[64];
+    struct tm tm;
+    time_t now = time(NULL);
+
+    fprintf(out, "HTTP/1.1 %.*s\r\n", (int) status_len, status);
+
+    if(gmtime_r(&now, &tm) != NULL &&
+       strftime(date, sizeof date, "%a, %d %b %Y %H:%M:%S GMT", &tm) > 0) {
+        fprintf(out, "Date: %s\r\n", date);
+    }
+
+    fprintf(out, "Connection: %s\r\n", keep_alive ? "keep-alive" : "close");
+}
+
+static int response_finish(struct connection *c, FILE *out) {
+    c->out_pos = 0;
+
+    if(fclose(out) != 0) {
+        free(c->out);
+        c->out = NULL;
+        c->out_len = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Queues a response with a short plain text body.
+ */
+static int respond_simple(struct connection *c, const char *status, const char *extra_header, bool head) {
+    FILE *out = open_memstream(&c->out, &c->out_len);
+
+    if(out == NULL) {
+        return -1;
+    }
+
+    response_start(out, status, strlen(status), !c->close_after);
+
+    if(extra_header != NULL) {
+        fprintf(out, "%s\r\n", extra_header);
+    }
+
+    fprintf(out, "Content-Type: text/plain\r\nContent-Length: %zu\r\n\r\n", strlen(status) + 1);
+
+    if(!head) {
+        fprintf(out, "%s\n", status);
+    }
+
+    return response_finish(c, out);
+}
+
+/*
+ * Converts the CGI response of the handler into a HTTP response:
+ * The Status header becomes the status line, Content-Length is added.
+ */
+static int respond_cgi(struct connection *c, char *cgi, size_t cgi_len, bool head) {
+    // the body may contain anything, so only search within the response
+    char *body = memmem(cgi, cgi_len, "\r\n\r\n", 4);
+
+    if(body == NULL) {
+        return respond_simple(c, "500 Internal Server Error", NULL, head);
+    }
+
+    // keep the last header's line ending, so every header ends in \r\n
+    body[2] = '\0';
+    body += 4;
+
+    size_t body_len = cgi_len - (body - cgi);
+    char *status = "500 Internal Server Error";
+    size_t status_len = strlen(status);
+
+    for(char *line = cgi; *line != '\0'; line = strstr(line, "\r\n") + 2) {
+        if(strncasecmp(line, "Status: ", 8) == 0) {
+            status = line + 8;
+            status_len = strstr(status, "\r\n") - status;
+        }
+    }
+
+    FILE *out = open_memstream(&c->out, &c->out_len);
+
+    if(out == NULL) {
+        return -1;
+    }
+
+    response_start(out, status, status_len, !c->close_after);
+
+    for(char *line = cgi; *line != '\0';) {
+        char *end = strstr(line, "\r\n") + 2;
+
+        if(strncasecmp(line, "Status: ", 8) != 0) {
+            fwrite(line, 1, end - line, out);
+        }
+
+        line = end;
+    }
+
+    fprintf(out, "Content-Length: %zu\r\n\r\n", body_len);
+
+    if(!head) {
+        fwrite(body, 1, body_len, out);
+    }
+
+    return response_finish(c, out);
+}
+
+/*
+ * Decodes percent escapes of the request path in place, stopping at the
+ * query string. Returns -1 for invalid escapes and encoded null bytes.
+ */
+static int decode_path(char *path) {
+    size_t out = 0;
+
+    for(size_t i = 0; path[i] != '\0' && path[i] != '?' && path[i] != '#'; i++) {
+        if(path[i] == '%') {
+            int high = hex_nibble(path[i + 1]);
+            int low = high == -1 ? -1 : hex_nibble(path[i + 2]);
+
+            if(low == -1 || (high == 0 && low == 0)) {
+                return -1;
+            }
+
+            path[out++] = (char) (high << 4 | low);
+            i += 2;
+        } else {
+            path[out++] = path[i];
+        }
+    }
+
+    path[out] = '\0';
+    return 0;
+}
+
+#ifdef BLOG_SERVER_ASSET_DIR
+static const char *asset_content_type(const char *name) {
+    const char *ext = strrchr(name, '.');
+
+    if(ext == NULL) {
+        return "application/octet-stream";
+    } else if(strcmp(ext, ".css") == 0) {
+        return "text/css";
+    } else if(strcmp(ext, ".ico") == 0) {
+        return "image/x-icon";
+    } else if(strcmp(ext, ".png") == 0) {
+        return "image/png";
+    } else if(strcmp(ext, ".svg") == 0) {
+        return "image/svg+xml";
+    } else if(strcmp(ext, ".js") == 0) {
+        return "text/javascript";
+    } else {
+        return "application/octet-stream";
+    }
+}
+
+/*
+ * Queues the headers of an asset and sets it up to be sent using
+ * sendfile(). Returns 1 if path doesn't refer to an asset.
+ */
+static int respond_asset(struct connection *c, const char *path, bool head) {
+    const char *name = path + 1;
+
+    // only files directly in the asset directory, no dotfiles
+    if(name[0] == '\0' || name[0] == '.' || strchr(name, '/') != NULL) {
+        return 1;
+    }
+
+    char *asset_path = catn_alloc(2, BLOG_SERVER_ASSET_DIR "/", name);
+
+    if(asset_path == NULL) {
+        return -1;
+    }
+
+    int fd = open(asset_path, O_RDONLY | O_CLOEXEC);
+    free(asset_path);
+
+    struct stat info;
+
+    if(fd == -1 || fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+        if(fd != -1) {
+            close(fd);
+        }
+
+        return 1;
+    }
+
+    FILE *out = open_memstream(&c->out, &c->out_len);
+
+    if(out == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    response_start(out, "200 OK", 6, !c->close_after);
+    fprintf(out, "Content-Type: %s\r\nContent-Length: %lld\r\n",
+            asset_content_type(name), (long long) info.st_size);
+#ifdef BLOG_CACHE_MAX_AGE
+    fprintf(out, "Cache-Control: max-age=%d\r\n", BLOG_CACHE_MAX_AGE);
+#endif
+    fputs("\r\n", out);
+
+    if(head) {
+        close(fd);
+    } else {
+        c->file_fd = fd;
+        c->file_pos = 0;
+        c->file_end = info.st_size;
+    }
+
+    return response_finish(c, out);
+}
+#endif
+
+/*
+ * Counts a served request. Supervised workers stop once they
+ * exceed the request or memory limit, so they get replaced.
+ */
+static void count_request(void) {
+    unsigned long long served = atomic_fetch_add(&requests_served, 1) + 1;
+
+    if(!supervised) {
+        return;
+    }
+
+#if BLOG_SERVER_MAX_REQUESTS > 0
+    if(served >= BLOG_SERVER_MAX_REQUESTS) {
+        atomic_store(&stopping, true);
+    }
+#else
+    (void) served;
+#endif
+
+    if(BLOG_SERVER_MAX_RSS > 0) {
+        struct rusage usage;
+
+        // ru_maxrss is given in KiB on Linux
+        if(getrusage(RUSAGE_SELF, &usage) == 0 && usage.ru_maxrss >= BLOG_SERVER_MAX_RSS) {
+            atomic_store(&stopping, true);
+        }
+    }
+}
+
+/*
+ * Renders the CGI response of a request using the handler into a dynamically
+ * allocated buffer. For a NULL or empty server_name or server_port the
+ * defaults are used.
+ */
+static int render(struct worker *w, char *script_name, char *path_info,
+                  char *query_string, char *server_name, char *server_port,
+                  char **cgi, size_t *cgi_len) {
+    *cgi = NULL;
+    *cgi_len = 0;
+
+    struct request req;
+
+    req.out = open_memstream(cgi, cgi_len);
+    req.script_name = script_name;
+    req.path_info = path_info;
+    req.query_string = query_string;
+    req.server_name = server_name != NULL && server_name[0] != '\0' ? server_name : default_server_name;
+    req.server_port = server_port != NULL && server_port[0] != '\0' ? server_port : default_server_port;
+    req.template_state = NULL;
+
+    if(req.out == NULL) {
+        return -1;
+    }
+
+    w->handler(&req);
+    count_request();
+
+    if(fclose(req.out) != 0) {
+        free(*cgi);
+        *cgi = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Renders the response for path and query and converts it into a HTTP
+ * response. SERVER_NAME and SERVER_PORT are set from the Host header.
+ */
+static int respond_blog(struct worker *w, struct connection *c, char *path, char *query,
+                        char *host, bool head) {
+    char *port = NULL;
+
+    // split host and port, but not inside an IPv6 literal
+    if(host != NULL) {
+        char *colon = strrchr(host, ':');
+
+        if(colon != NULL && strchr(colon, ']') == NULL) {
+            *colon = '\0';
+            port = colon + 1;
+        }
+    }
+
+    char *cgi;
+    size_t cgi_len;
+
+    if(render(w, "", path, query, host, port, &cgi, &cgi_len) == -1) {
+        return -1;
+    }
+
+    int result = respond_cgi(c, cgi, cgi_len, head);
+
+    free(cgi);
+    return result;
+}
+
+/*
+ * Handles the request whose header section is given as a null
+ * terminated string, queueing the response. Returns -1 on error.
+ */
+static int handle_request(struct worker *w, struct connection *c, char *request) {
+    char *host = NULL;
+    bool http10 = false;
+    bool has_body = false;
+    bool keep_alive_header = false;
+    bool close_header = false;
+
+    // request line
+    char *method = request;
+    char *target = strchr(method, ' ');
+    char *version = target == NULL ? NULL : strchr(target + 1, ' ');
+    char *headers = version == NULL ? NULL : strstr(version + 1, "\r\n");
+
+    if(headers != NULL) {
+        *target++ = '\0';
+        *version++ = '\0';
+        *headers = '\0';
+        headers += 2;
+    } else {
+        // last line of the header section has no line ending
+        headers = version == NULL ? NULL : version + strlen(version);
+
+        if(headers != NULL) {
+            *target++ = '\0';
+            *version++ = '\0';
+        }
+    }
+
+    if(headers == NULL || (strcmp(version, "HTTP/1.1") != 0 &&
+                           !(http10 = strcmp(version, "HTTP/1.0") == 0))) {
+        c->close_after = true;
+        return respond_simple(c, "400 Bad Request", NULL, false);
+    }
+
+    for(char *line = headers; *line != '\0';) {
+        char *end = strstr(line, "\r\n");
+
+        if(end != NULL) {
+            *end = '\0';
+        }
+
+        char *value = strchr(line, ':');
+
+        if(value != NULL) {
+            *value++ = '\0';
+            value += strspn(value, " \t");
+
+            if(strcasecmp(line, "Host") == 0) {
+                host = value;
+            } else if(strcasecmp(line, "Connection") == 0) {
+                close_header = strcasestr(value, "close") != NULL;
+                keep_alive_header = strcasestr(value, "keep-alive") != NULL;
+            } else if(strcasecmp(line, "Transfer-Encoding") == 0 ||
+                      (strcasecmp(line, "Content-Length") == 0 && strtoll(value, NULL, 10) != 0)) {
+                has_body = true;
+            }
+        }
+
+        if(end == NULL) {
+            break;
+        }
+
+        line = end + 2;
+    }
+
+    c->close_after = c->eof || close_header || (http10 && !keep_alive_header) ||
+                     atomic_load(&stopping);
+
+    // request bodies are never read, so the connection can't be reused
+    if(has_body) {
+        c->close_after = true;
+    }
+
+    bool head = strcmp(method, "HEAD") == 0;
+
+    if(!head && strcmp(method, "GET") != 0) {
+        return respond_simple(c, "405 Method Not Allowed", "Allow: GET, HEAD", false);
+    }
+
+    // the query string is passed on undecoded like QUERY_STRING
+    char *query = strchr(target, '?');
+
+    if(query != NULL) {
+        *query++ = '\0';
+        query[strcspn(query, "#")] = '\0';
+    }
+
+    if(target[0] != '/' || decode_path(target) == -1) {
+        return respond_simple(c, "400 Bad Request", NULL, head);
+    }
+
+#ifdef BLOG_SERVER_ASSET_DIR
+    int asset = respond_asset(c, target, head);
+
+    if(asset != 1) {
+        return asset;
+    }
+#endif
+
+    return respond_blog(w, c, target, query, host, head);
+}
+
+/*
+ * Handles the next HTTP request if it has been received completely.
+ * Returns 1 if a response has been queued, 0 if more data is needed.
+ */
+static int http_next_request(struct worker *w, struct connection *c) {
+    char *end = memmem(c->in, c->in_len, "\r\n\r\n", 4);
+
+    if(end == NULL) {
+        if(c->in_len == sizeof(c->in)) {
+            c->close_after = true;
+            c->in_len = 0;
+
+            if(respond_simple(c, "431 Request Header Fields Too Large", NULL, false) == -1) {
+                return -1;
+            }
+
+            return 1;
+        }
+
+        return 0;
+    }
+
+    *end = '\0';
+    size_t request_len = end - c->in + 4;
+
+    if(handle_request(w, c, c->in) == -1) {
+        return -1;
+    }
+
+    c->in_len -= request_len;
+    memmove(c->in, c->in + request_len, c->in_len);
+
+    return 1;
+}
+
+/*
+ * Handles a SCGI request once its header netstring has been received.
+ * The request body is ignored. The CGI response is sent as is and the
+ * connection closed afterwards, as SCGI requires. Returns -1 for malformed
+ * requests and header blocks that don't fit into the buffer.
+ */
+static int scgi_next_request(struct worker *w, struct connection *c) {
+    size_t len = 0;
+    size_t i;
+
+    // netstring length
+    for(i = 0; i < c->in_len && c->in[i] >= '0' && c->in[i] <= '9' && len <= sizeof(c->in); i++) {
+        len = len * 10 + (c->in[i] - '0');
+    }
+
+    if(i == c->in_len) {
+        return 0;
+    } else if(i == 0 || c->in[i] != ':' || len + i + 2 > sizeof(c->in)) {
+        return -1;
+    }
+
+    char *headers = c->in + i + 1;
+    char *headers_end = headers + len;
+
+    if(headers_end >= c->in + c->in_len) {
+        return 0;
+    } else if(*headers_end != ',' || (len > 0 && headers_end[-1] != '\0')) {
+        return -1;
+    }
+
+    char *script_name = NULL;
+    char *path_info = NULL;
+    char *query_string = NULL;
+    char *server_name = NULL;
+    char *server_port = NULL;
+
+    // NUL terminated names and values, alternating
+    for(char *name = headers; name < headers_end;) {
+        char *value = name + strlen(name) + 1;
+
+        if(value >= headers_end) {
+            return -1;
+        }
+
+        if(strcmp(name, "SCRIPT_NAME") == 0) {
+            script_name = value;
+        } else if(strcmp(name, "PATH_INFO") == 0) {
+            path_info = value;
+        } else if(strcmp(name, "QUERY_STRING") == 0) {
+            query_string = value;
+        } else if(strcmp(name, "SERVER_NAME") == 0) {
+            server_name = value;
+        } else if(strcmp(name, "SERVER_PORT") == 0) {
+            server_port = value;
+        }
+
+        name = value + strlen(value) + 1;
+    }
+
+    if(render(w, script_name, path_info, query_string, server_name, server_port, &c->out, &c->out_len) == -1) {
+        return -1;
+    }
+
+    c->out_pos = 0;
+    c->in_len = 0;
+    c->close_after = true;
+
+    return 1;
+}
+
+static int connection_next_request(struct worker *w, struct connection *c) {
+    if(w->protocol == SERVER_PROTOCOL_SCGI) {
+        return scgi_next_request(w, c);
+    } else {
+        return http_next_request(w, c);
+    }
+}
+
+/*
+ * Sends pending output and handles buffered requests until either
+ * the socket blocks or more data needs to be received.
+ */
+static void connection_update(struct worker *w, struct connection *c) {
+    for(;;) {
+        int flushed = connection_flush(c);
+
+        if(flushed == -1) {
+            connection_close(w, c);
+            return;
+        } else if(flushed == 1) {
+            if(connection_want(w, c, EPOLLOUT) == -1) {
+                connection_close(w, c);
+            }
+
+            return;
+        }
+
+        if(c->close_after) {
+            break;
+        }
+
+        int next = connection_next_request(w, c);
+
+        if(next == -1) {
+            connection_close(w, c);
+            return;
+        } else if(next == 0) {
+            break;
+        }
+    }
+
+    if(c->close_after || c->eof || connection_want(w, c, EPOLLIN) == -1) {
+        connection_close(w, c);
+    }
+}
+
+static void connection_read(struct worker *w, struct connection *c) {
+    while(c->in_len < sizeof(c->in)) {
+        ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+
+        if(n == -1) {
+            if(errno == EINTR) {
+                continue;
+            } else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            connection_close(w, c);
+            return;
+        } else if(n == 0) {
+            c->eof = true;
+            break;
+        }
+
+        c->in_len += n;
+        c->last_active = monotonic_now();
+    }
+
+    connection_update(w, c);
+}
+
+static void worker_accept(struct worker *w) {
+    for(;;) {
+        int fd = accept4(w->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if(fd == -1) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            } else if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("sternenblog: accept");
+            }
+
+            return;
+        }
+
+        struct connection *c = calloc(1, sizeof(struct connection));
+
+        if(c == NULL) {
+            close(fd);
+            continue;
+        }
+
+        c->fd = fd;
+        c->file_fd = -1;
+        c->events = EPOLLIN;
+        c->last_active = monotonic_now();
+
+        struct epoll_event ev;
+        ev.events = c->events;
+        ev.data.ptr = c;
+
+        if(epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            close(fd);
+            free(c);
+            continue;
+        }
+
+        c->next = w->connections;
+        if(c->next != NULL) {
+            c->next->prev = c;
+        }
+        w->connections = c;
+    }
+}
+
+static void worker_expire(struct worker *w) {
+    time_t now = monotonic_now();
+    struct connection *c = w->connections;
+
+    while(c != NULL) {
+        struct connection *next = c->next;
+
+        if(now - c->last_active > SERVER_KEEPALIVE_TIMEOUT) {
+            connection_close(w, c);
+        }
+
+        c = next;
+    }
+}
+
+/*
+ * Stops accepting connections once the process is shutting down and closes
+ * idle ones. Returns true when all connections of the worker are closed.
+ */
+static bool worker_drain(struct worker *w) {
+    if(!w->draining) {
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, w->listen_fd, NULL);
+        w->draining = true;
+    }
+
+    struct connection *c = w->connections;
+    time_t now = monotonic_now();
+
+    while(c != NULL) {
+        struct connection *next = c->next;
+
+        // Responses being sent are finished first. Recently active connections
+        // are given a moment, since their next request may already be on its
+        // way. It is then answered with Connection: close, see handle_request().
+        if(c->out == NULL && c->file_fd == -1 && c->in_len == 0 &&
+           now - c->last_active > 1) {
+            connection_close(w, c);
+        }
+
+        c = next;
+    }
+
+    return w->connections == NULL;
+}
+
+static void *worker_run(void *arg) {
+    struct worker *w = arg;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    time_t last_expire = monotonic_now();
+
+#ifdef __linux__
+    if(BLOG_SERVER_CPU_AFFINITY) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu % (cpus > 0 ? cpus : 1), &set);
+
+        // pid 0 is the calling thread
+        if(sched_setaffinity(0, sizeof(set), &set) == -1) {
+            perror("sternenblog: sched_setaffinity");
+        }
+    }
+#endif
+
+    for(;;) {
+        int n = epoll_wait(w->epoll_fd, events, SERVER_MAX_EVENTS, 1000);
+
+        if(n == -1 && errno != EINTR) {
+            perror("sternenblog: epoll_wait");
+            return NULL;
+        }
+
+        for(int i = 0; i < n; i++) {
+            struct connection *c = events[i].data.ptr;
+
+            if(c == NULL) {
+                worker_accept(w);
+            } else if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+                connection_close(w, c);
+            } else if(events[i].events & EPOLLOUT) {
+                connection_update(w, c);
+            } else if(events[i].events & EPOLLIN) {
+                connection_read(w, c);
+            }
+        }
+
+        if(atomic_load(&stopping) && worker_drain(w)) {
+            return NULL;
+        }
+
+        if(monotonic_now() != last_expire) {
+            worker_expire(w);
+            last_expire = monotonic_now();
+        }
+    }
+}
+
+static int server_listen(const char *address, const char *port) {
+    struct addrinfo hints;
+    struct addrinfo *addrs;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    int err = getaddrinfo(address, port, &hints, &addrs);
+
+    if(err != 0) {
+        fprintf(stderr, "sternenblog: %s\n", gai_strerror(err));
+        return -1;
+    }
+
+    int fd = -1;
+
+    for(struct addrinfo *a = addrs; a != NULL; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+
+        if(fd == -1) {
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+        // allows starting a new instance next to a running one, e. g. for upgrades
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#endif
+
+        if(bind(fd, a->ai_addr, a->ai_addrlen) == 0 &&
+           listen(fd, SOMAXCONN) == 0 &&
+           set_nonblocking(fd) == 0) {
+            break;
+        }
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(addrs);
+
+    if(fd == -1) {
+        perror("sternenblog: could not listen");
+    }
+
+    return fd;
+}
+
+static void handle_stop(int sig) {
+    (void) sig;
+    atomic_store(&stopping, true);
+}
+
+/*
+ * Serves connections on listen_fd using thread_count worker threads
+ * until the process is asked to stop and all connections are closed.
+ * Threads are pinned to CPUs starting at first_cpu if enabled.
+ */
+static int run_workers(enum server_protocol protocol, int listen_fd, long thread_count,
+                       long first_cpu, server_handler handler) {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    struct worker *workers = calloc(thread_count, sizeof(struct worker));
+
+    if(workers == NULL) {
+        return -1;
+    }
+
+    long started = 0;
+
+    for(; started < thread_count; started++) {
+        struct worker *w = workers + started;
+        struct epoll_event ev;
+
+        w->listen_fd = listen_fd;
+        w->protocol = protocol;
+        w->handler = handler;
+        w->cpu = first_cpu + started;
+        w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+        // wake only one worker per incoming connection
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = NULL;
+
+        if(w->epoll_fd == -1 ||
+           epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == -1 ||
+           pthread_create(&w->thread, NULL, worker_run, w) != 0) {
+            perror("sternenblog: could not start worker");
+            atomic_store(&stopping, true);
+            break;
+        }
+    }
+
+    for(long i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].epoll_fd);
+    }
+
+    bool failed = started < thread_count;
+
+    free(workers);
+
+    return failed ? -1 : 0;
+}
+
+/*
+ * Forks a worker process for the given slot of the supervisor.
+ * The child never returns.
+ */
+static pid_t supervisor_spawn(enum server_protocol protocol, int listen_fd, long threads,
+                              long slot, const sigset_t *orig_mask, server_handler handler) {
+    pid_t pid = fork();
+
+    if(pid != 0) {
+        return pid;
+    }
+
+    // only the supervisor handles these
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGCHLD, SIG_DFL);
+    sigprocmask(SIG_SETMASK, orig_mask, NULL);
+
+    supervised = true;
+
+    _exit(run_workers(protocol, listen_fd, threads, slot * threads, handler) == 0 ? 0 : 1);
+}
+
+static volatile sig_atomic_t supervisor_hup = 0;
+static volatile sig_atomic_t supervisor_stop = 0;
+
+static void handle_supervisor_signal(int sig) {
+    if(sig == SIGHUP) {
+        supervisor_hup = 1;
+    } else if(sig == SIGTERM || sig == SIGINT) {
+        supervisor_stop = 1;
+    }
+}
+
+/*
+ * Keeps `processes` worker processes running, replacing those which exit
+ * (e. g. because they hit a limit). On SIGHUP, a new set of workers is
+ * started and the old ones are stopped gracefully. Since all workers share
+ * the listening socket, no connection is lost in the process.
+ */
+static int supervise(enum server_protocol protocol, int listen_fd, long processes,
+                     long threads, server_handler handler) {
+    pid_t *pids = calloc(processes, sizeof(pid_t));
+    time_t *started = calloc(processes, sizeof(time_t));
+
+    if(pids == NULL || started == NULL) {
+        free(pids);
+        free(started);
+        return -1;
+    }
+
+    struct sigaction sa;
+    sigset_t mask;
+    sigset_t orig_mask;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_supervisor_signal;
+    sigemptyset(&sa.sa_mask);
+
+    // signals are only handled while waiting in sigsuspend()
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &orig_mask);
+
+    sigaction(SIGHUP, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    // SIGCHLD only needs to interrupt sigsuspend()
+    sigaction(SIGCHLD, &sa, NULL);
+
+    for(long i = 0; i < processes; i++) {
+        pids[i] = supervisor_spawn(protocol, listen_fd, threads, i, &orig_mask, handler);
+        started[i] = monotonic_now();
+    }
+
+    while(!supervisor_stop) {
+        sigsuspend(&orig_mask);
+
+        if(supervisor_hup) {
+            supervisor_hup = 0;
+
+            // start the new generation first, so requests keep being accepted
+            for(long i = 0; i < processes; i++) {
+                pid_t old = pids[i];
+
+                pids[i] = supervisor_spawn(protocol, listen_fd, threads, i, &orig_mask, handler);
+                started[i] = monotonic_now();
+
+                if(old > 0) {
+                    kill(old, SIGTERM);
+                }
+            }
+        }
+
+        pid_t pid;
+
+        while((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+            for(long i = 0; i < processes; i++) {
+                if(pids[i] != pid) {
+                    continue;
+                }
+
+                pids[i] = -1;
+
+                if(supervisor_stop) {
+                    break;
+                }
+
+                // don't spin if workers exit right away
+                if(monotonic_now() - started[i] < 1) {
+                    sleep(1);
+                }
+
+                pids[i] = supervisor_spawn(protocol, listen_fd, threads, i, &orig_mask, handler);
+                started[i] = monotonic_now();
+            }
+        }
+    }
+
+    for(long i = 0; i < processes; i++) {
+        if(pids[i] > 0) {
+            kill(pids[i], SIGTERM);
+        }
+    }
+
+    // wait for all workers, including old generations
+    while(wait(NULL) > 0 || errno == EINTR);
+
+    free(pids);
+    free(started);
+
+    return 0;
+}
+
+static int serve_protocol(enum server_protocol protocol, char *address, char *port,
+                          server_handler handler) {
+    int listen_fd = server_listen(address, port);
+
+    if(listen_fd == -1) {
+        return -1;
+    }
+
+    long processes = BLOG_SERVER_PROCESSES;
+    long threads = BLOG_SERVER_THREADS;
+
+    if(threads <= 0) {
+        // one thread per core in total
+        threads = sysconf(_SC_NPROCESSORS_ONLN) / (processes > 0 ? processes : 1);
+    }
+
+    if(threads <= 0) {
+        threads = 1;
+    }
+
+    default_server_name = address == NULL ? "localhost" : address;
+    default_server_port = port;
+
+    // sendfile() may raise SIGPIPE if a client disconnects
+    signal(SIGPIPE, SIG_IGN);
+
+    int result;
+
+    if(processes > 0) {
+        result = supervise(protocol, listen_fd, processes, threads, handler);
+    } else {
+        result = run_workers(protocol, listen_fd, threads, 0, handler);
+    }
+
+    close(listen_fd);
+
+    return result;
+}
+
+int serve(int argc, char *argv[], server_handler handler) {
+    if(argc >= 2 && argc <= 3) {
+        char *address = argc == 3 ? argv[1] : NULL;
+        char *port = argv[argc - 1];
+
+        if(strcmp(argv[0], "http") == 0) {
+            return serve_protocol(SERVER_PROTOCOL_HTTP, address, port, handler);
+        } else if(strcmp(argv[0], "scgi") == 0) {
+            return serve_protocol(SERVER_PROTOCOL_SCGI, address, port, handler);
+        }
+    }
+
+    fputs("Usage: sternenblog.cgi http|scgi [ADDRESS] PORT\n", stderr);
+    return -1;
+}
@@ -0,0 +1,71 @@
+/*!
+ * @file server.h
+ * @brief Serve requests without a separate web server
+ *
+ * Besides being executed as a CGI script, `sternenblog.cgi` can also run
+ * persistently, listening on a TCP socket itself. It either speaks HTTP/1.1,
+ * intended for small deployments where running a dedicated web server is not
+ * worth it, or SCGI to sit behind a web server.
+ *
+ * The server uses an `epoll(7)` event loop per worker thread, one worker
+ * per online CPU core by default, which share the listening socket.
+ * HTTP connections are kept alive between requests. It is Linux specific.
+ *
+ * Optionally, a supervisor forks `BLOG_SERVER_PROCESSES` worker processes
+ * which inherit the listening socket. Workers are replaced when they exceed
+ * `BLOG_SERVER_MAX_REQUESTS` or `BLOG_SERVER_MAX_RSS` and all of them are
+ * replaced gracefully on `SIGHUP`, dropping their in-memory indexes.
+ *
+ * HTTP requests are mapped onto the CGI interface: The request path becomes
+ * `PATH_INFO`, the query string `QUERY_STRING`, `SCRIPT_NAME` is always empty and `SERVER_NAME` and
+ * `SERVER_PORT` are derived from the `Host` header. The CGI response
+ * produced by the `server_handler` is then converted into a HTTP/1.1
+ * response. SCGI requests already carry the CGI environment and the
+ * response is sent unchanged.
+ */
+
+#ifndef STERNENBLOG_SERVER_H
+#define STERNENBLOG_SERVER_H
+
+#include "core.h"
+
+/*!
+ * @brief Function serving a single request
+ *
+ * A `server_handler` receives a request and writes a CGI response,
+ * i. e. a header section containing a `Status` header followed by
+ * the body, to `req->out`.
+ *
+ * Worker threads call the handler concurrently, every request is
+ * served entirely by the thread which received it.
+ *
+ * @return HTTP status of the response
+ */
+typedef int (*server_handler)(struct request *req);
+
+/*!
+ * @brief Run a server
+ *
+ * Parses the command line arguments, starts listening and serves requests
+ * using `handler` until `SIGTERM` or `SIGINT` is received. Connections are
+ * then closed once their current response has been sent. The arguments are
+ * expected to look like this:
+ *
+ * ```
+ * http|scgi [ADDRESS] PORT
+ * ```
+ *
+ * If `ADDRESS` is omitted, the server listens on all addresses.
+ *
+ * In HTTP mode, assets like the default CSS are served from
+ * `BLOG_SERVER_ASSET_DIR` using `sendfile(2)` if it is set.
+ *
+ * @param argc number of arguments
+ * @param argv command line arguments excluding the program name
+ * @param handler function serving a request
+ * @return 0 after a graceful stop, -1 if the arguments are invalid or the
+ *         server could not be started
+ */
+int serve(int argc, char *argv[], server_handler handler);
+
+#endif
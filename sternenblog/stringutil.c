@@ -28,6 +28,18 @@ char nibble_hex(short h) {
     }
 }
 
+int hex_nibble(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    } else if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    } else if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else {
+        return -1;
+    }
+}
+
 char *catn_alloc(size_t n, ...) {
     va_list args;
     size_t pos = 0;
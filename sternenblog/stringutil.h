@@ -15,6 +15,15 @@
  */
 char nibble_hex(short h);
 
+/*!
+ * @brief Returns integer for given hex digit
+ *
+ * Inverse of `nibble_hex()`: Returns the value of
+ * a hex digit (`0-9`, `A-F` or `a-f`) in range 0-15
+ * or -1 if `c` isn't a hex digit.
+ */
+int hex_nibble(char c);
+
 /*!
  * @brief Concatenate arbitrary number of strings into
  * dynamically allocated buffer
@@ -9,8 +9,14 @@
  *
  * These functions can be implemented by a custom C source file
  * in order to customize the HTML output of sternenblog. Every
- * function is expected to output HTML to `stdout`. They themselves
- * can expect to be called in the following order:
+ * function is expected to output HTML to `data.request->out`.
+ * Since requests may be served concurrently, a template must not
+ * keep state in global variables, but in `data.request->template_state`.
+ * When not running as a CGI script, error pages are rendered once and
+ * reused for all requests with the same `data.status` and
+ * `data.script_name`, so they should not depend on `data.path_info`
+ * or the rest of the request.
+ * They themselves can expect to be called in the following order:
  *
  * * template_header()
  * * One of template_single_entry(), template_index_entry (any number
@@ -43,6 +49,7 @@ struct template_data {
   struct entry *entry;            //!< Pointer to entry if applicable, else `NULL`
   char *script_name;              //!< value of `SCRIPT_NAME` environment variable
   char *path_info;                //!< value of `PATH_INFO` environment variable
+  struct request *request;        //!< request being served, the template writes to `request->out`
 };
 
 /*!
@@ -51,7 +58,8 @@ struct template_data {
  * template_header() is expected to print out the common beginning of
  * any response and allocate any resources the template uses (it's
  * the best place for such things since it is always called as the
- * first template function).
+ * first template function). Resources needed by the later calls
+ * should be stored in `data.request->template_state`.
  *
  * Typically it will print the HTML `<head>` and the header part
  * of the `<body>` element which is common for all pages. It may
@@ -1,5 +1,6 @@
 #define _POSIX_C_SOURCE 1
 #define _XOPEN_SOURCE 1 // for timezone
+#include <pthread.h>
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +13,8 @@ char *format_string(enum time_format t) {
     switch(t) {
         case RSS_TIME_FORMAT:
             return "%a, %d %b %Y %T %z";
+        case ARCHIVE_TIME_FORMAT:
+            return "%Y/%m";
         // both remaining cases still need a UTC offset
         // part at the end which is not supported by
         // strftime(3), so we do this ourselves in
@@ -24,9 +27,20 @@ char *format_string(enum time_format t) {
     }
 }
 
+static pthread_once_t tz_once = PTHREAD_ONCE_INIT;
+
 size_t flocaltime(char *b, enum time_format type, size_t size, const time_t *time) {
-    tzset();
-    struct tm *local = localtime(time);
+    struct tm local_tm;
+    struct tm *local = &local_tm;
+
+    // localtime_r() isn't required to pick up the timezone, but calling
+    // tzset() for every timestamp would needlessly reread it
+    pthread_once(&tz_once, tzset);
+
+    if(localtime_r(time, local) == NULL) {
+        return 0;
+    }
+
     char *format = format_string(type);
 
     size_t res = strftime(b, size, format, local);
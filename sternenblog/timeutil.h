@@ -7,9 +7,10 @@
 #define STERNENBLOG_TIMEUTIL_H
 
 enum time_format {
-    RSS_TIME_FORMAT,          //!< RFC822 formatted time with 4 instead of 2 year digits
-    ATOM_TIME_FORMAT,         //!< RFC3339 formatted time
-    HTML_TIME_FORMAT_READABLE //!< like `ATOM_TIME_FORMAT`, but with space between date and time
+    RSS_TIME_FORMAT,           //!< RFC822 formatted time with 4 instead of 2 year digits
+    ATOM_TIME_FORMAT,          //!< RFC3339 formatted time
+    HTML_TIME_FORMAT_READABLE, //!< like `ATOM_TIME_FORMAT`, but with space between date and time
+    ARCHIVE_TIME_FORMAT        //!< year and month as `yyyy/mm`, e. g. for archive pages
 };
 
 /*!
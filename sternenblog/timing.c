@@ -0,0 +1,129 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "timing.h"
+
+/*!
+ * @brief Measurements of a single stage
+ */
+struct timing_data {
+    struct timespec wall_start; //!< wall clock time at the last `timing_start()`
+    struct timespec cpu_start;  //!< CPU time at the last `timing_start()`
+    double wall_ms;             //!< total wall clock time in milliseconds
+    double cpu_ms;              //!< total CPU time in milliseconds
+    unsigned long count;        //!< number of times the stage has been measured
+};
+
+static const char *stage_names[TIMING_STAGE_COUNT] = {
+    "route",
+    "index",
+    "sort",
+    "search",
+    "text",
+    "render",
+    "flush"
+};
+
+// a request is served by a single thread, so per thread state is per request
+static _Thread_local int enabled_outputs = 0;
+static _Thread_local struct timing_data stages[TIMING_STAGE_COUNT];
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+void timing_init(int outputs) {
+    enabled_outputs = outputs;
+    memset(stages, 0, sizeof(stages));
+}
+
+void timing_start(enum timing_stage stage) {
+    if(enabled_outputs == 0) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stages[stage].wall_start);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &stages[stage].cpu_start);
+}
+
+void timing_stop(enum timing_stage stage) {
+    if(enabled_outputs == 0) {
+        return;
+    }
+
+    struct timespec wall_end;
+    struct timespec cpu_end;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+    stages[stage].wall_ms += elapsed_ms(&stages[stage].wall_start, &wall_end);
+    stages[stage].cpu_ms += elapsed_ms(&stages[stage].cpu_start, &cpu_end);
+    stages[stage].count++;
+}
+
+size_t timing_header(char *b, size_t size) {
+    if(!(enabled_outputs & TIMING_OUTPUT_HEADER) || size == 0) {
+        return 0;
+    }
+
+    size_t pos = 0;
+    b[0] = '\0';
+
+    for(int i = 0; i < TIMING_STAGE_COUNT; i++) {
+        if(stages[i].count == 0) {
+            continue;
+        }
+
+        int len = snprintf(b + pos, size - pos, "%s%s;dur=%.3f;desc=\"cpu %.3f\"",
+                           pos > 0 ? ", " : "", stage_names[i],
+                           stages[i].wall_ms, stages[i].cpu_ms);
+
+        if(len < 0 || (size_t) len >= size - pos) {
+            // don't send a truncated metric
+            b[pos] = '\0';
+            break;
+        }
+
+        pos += len;
+    }
+
+    return pos;
+}
+
+void timing_log(FILE *out, const char *path_info, int status) {
+    if(!(enabled_outputs & TIMING_OUTPUT_LOG)) {
+        return;
+    }
+
+    fputs("sternenblog: timing path=\"", out);
+
+    // PATH_INFO is user input, don't let it break the log line
+    for(size_t i = 0; path_info != NULL && path_info[i] != '\0'; i++) {
+        unsigned char c = path_info[i];
+
+        if(c == '"' || c == '\\') {
+            fputc('\\', out);
+            fputc(c, out);
+        } else if(c < 0x20 || c == 0x7f) {
+            fprintf(out, "\\x%02x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+
+    fprintf(out, "\" status=%d", status);
+
+    for(int i = 0; i < TIMING_STAGE_COUNT; i++) {
+        if(stages[i].count > 0) {
+            fprintf(out, " %s_ms=%.3f %s_cpu_ms=%.3f",
+                    stage_names[i], stages[i].wall_ms,
+                    stage_names[i], stages[i].cpu_ms);
+        }
+    }
+
+    fputc('\n', out);
+}
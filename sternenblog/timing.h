@@ -0,0 +1,122 @@
+/*!
+ * @file timing.h
+ * @brief Optional per-stage timing of requests
+ *
+ * timing.h measures wall clock and CPU time spent in the different
+ * stages of handling a request. Stages may be entered multiple times
+ * (e. g. `TIMING_STAGE_TEXT` once per entry), the times are summed up.
+ *
+ * Timing is disabled by default and all functions return immediately
+ * in that case. It is enabled using `timing_init()` which `main()` calls
+ * if `BLOG_TIMING` is set in `config.h`. The results can then be sent
+ * as a `Server-Timing` header using `timing_header()` and/or logged to
+ * `stderr` using `timing_log()`.
+ *
+ * Measurements are kept per thread, so every request needs to be served
+ * by a single thread which calls `timing_init()` when it starts serving it.
+ */
+
+#ifndef STERNENBLOG_TIMING_H
+#define STERNENBLOG_TIMING_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*!
+ * @brief Stages of a request which are measured
+ */
+enum timing_stage {
+    TIMING_STAGE_ROUTE,   //!< routing, including construction of a single entry
+    TIMING_STAGE_INDEX,   //!< `make_index()`, including sorting
+    TIMING_STAGE_SORT,    //!< sorting of index segments
+    TIMING_STAGE_SEARCH,  //!< updating the search index and looking up the query
+    TIMING_STAGE_TEXT,    //!< mapping the text of entries using `entry_get_text()`
+    TIMING_STAGE_RENDER,  //!< rendering the response, including mapping the text
+    TIMING_STAGE_FLUSH,   //!< flushing the output
+    TIMING_STAGE_COUNT    //!< number of stages
+};
+
+/*!
+ * @brief Output the timing results as a `Server-Timing` header
+ *
+ * @see timing_init
+ */
+#define TIMING_OUTPUT_HEADER 1
+
+/*!
+ * @brief Output the timing results as a log line on `stderr`
+ *
+ * @see timing_init
+ */
+#define TIMING_OUTPUT_LOG 2
+
+/*!
+ * @brief Maximum size necessary to contain the output of timing_header()
+ */
+#define MAX_TIMING_HEADER_SIZE 512
+
+/*!
+ * @brief Enable timing
+ *
+ * Resets all measurements and enables timing with the given
+ * outputs, a bitwise or of `TIMING_OUTPUT_HEADER` and
+ * `TIMING_OUTPUT_LOG`. `0` disables timing.
+ *
+ * @param outputs outputs to enable
+ */
+void timing_init(int outputs);
+
+/*!
+ * @brief Start measuring a stage
+ *
+ * Must be followed by a call to `timing_stop()` for the same stage.
+ * Does nothing if timing is disabled.
+ */
+void timing_start(enum timing_stage stage);
+
+/*!
+ * @brief Stop measuring a stage
+ *
+ * Adds the time since the last `timing_start()` of the stage to its total.
+ * Does nothing if timing is disabled.
+ */
+void timing_stop(enum timing_stage stage);
+
+/*!
+ * @brief Format the `Server-Timing` header value
+ *
+ * Writes the value of a `Server-Timing` header listing all stages measured
+ * so far to `b`, for example:
+ *
+ * ```
+ * route;dur=0.041;desc="cpu 0.039", index;dur=1.204;desc="cpu 0.910"
+ * ```
+ *
+ * Durations are given in milliseconds. Since headers are sent before the
+ * response is rendered, later stages can only be reported by `timing_log()`.
+ *
+ * @param b output buffer
+ * @param size number of `char`s the buffer can hold
+ * @return length of the value placed in `b`, `0` if timing or the header
+ *         output is disabled or nothing has been measured yet.
+ */
+size_t timing_header(char *b, size_t size);
+
+/*!
+ * @brief Log timing results of the current request
+ *
+ * If the log output is enabled, prints a single line of `key=value`
+ * pairs to `out` containing wall and CPU time (in milliseconds) of
+ * all stages measured, for example:
+ *
+ * ```
+ * sternenblog: timing path="/" status=200 route_ms=0.041 route_cpu_ms=0.039 …
+ * ```
+ *
+ * @param out where to write the log line, usually `stderr`
+ * @param path_info `PATH_INFO` of the request, may be `NULL`
+ * @param status HTTP status of the response
+ */
+void timing_log(FILE *out, const char *path_info, int status);
+
+#endif
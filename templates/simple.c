@@ -8,12 +8,12 @@
 #include <sternenblog/core.h>
 #include <sternenblog/template.h>
 #include <sternenblog/cgiutil.h>
+#include <sternenblog/entry.h>
+#include <sternenblog/markdown.h>
 #include <sternenblog/stringutil.h>
 #include <sternenblog/timeutil.h>
 #include <sternenblog/xml.h>
 
-static struct xml_context ctx;
-
 void output_entry_time(struct xml_context *ctx, struct entry entry) {
     char strtime[MAX_TIMESTR_SIZE];
 
@@ -24,40 +24,93 @@ void output_entry_time(struct xml_context *ctx, struct entry entry) {
     }
 }
 
+void output_entry_tags(struct xml_context *ctx, const char *script_name, const struct entry *entry) {
+    const char *tags = entry->tags;
+    const char *tag;
+    size_t len;
+    bool first = true;
+
+    while((tag = entry_next_tag(&tags, &len)) != NULL) {
+        char *name = malloc(len + 1);
+
+        if(name == NULL) {
+            break;
+        }
+
+        memcpy(name, tag, len);
+        name[len] = '\0';
+
+        char *encoded = catn_alloc(1, name);
+        char *link = encoded != NULL && urlencode_realloc(&encoded, len + 1) > 0
+            ? catn_alloc(3, script_name, "/tag/", encoded) : NULL;
+
+        if(link != NULL) {
+            if(first) {
+                xml_open_tag_attrs(ctx, "p", 1, "class", "tags");
+                first = false;
+            } else {
+                xml_escaped(ctx, ", ");
+            }
+
+            xml_open_tag_attrs(ctx, "a", 2, "href", link, "rel", "tag");
+            xml_escaped(ctx, name);
+            xml_close_tag(ctx, "a");
+        }
+
+        free(link);
+        free(encoded);
+        free(name);
+    }
+
+    if(!first) {
+        xml_close_tag(ctx, "p");
+    }
+}
+
 void template_header(struct template_data data) {
-    new_xml_context(&ctx);
-    ctx.warn = stderr;
-    ctx.closing_slash = 0;
+    struct xml_context *ctx = malloc(sizeof(struct xml_context));
+
+    // nowhere to write the page to
+    if(ctx == NULL) {
+        return;
+    }
 
-    xml_raw(&ctx, "<!doctype html>");
-    xml_open_tag_attrs(&ctx, "html", 1, "lang", "en");
+    data.request->template_state = ctx;
 
-    xml_open_tag(&ctx, "head");
+    new_xml_context(ctx);
+    ctx->out = data.request->out;
+    ctx->warn = stderr;
+    ctx->closing_slash = 0;
 
-    xml_empty_tag(&ctx, "meta", 1, "charset", "utf-8");
+    xml_raw(ctx, "<!doctype html>");
+    xml_open_tag_attrs(ctx, "html", 1, "lang", "en");
+
+    xml_open_tag(ctx, "head");
+
+    xml_empty_tag(ctx, "meta", 1, "charset", "utf-8");
 
    #ifdef BLOG_CSS
-    xml_empty_tag(&ctx, "link", 3,
+    xml_empty_tag(ctx, "link", 3,
                   "rel", "stylesheet",
                   "type", "text/css",
                   "href", BLOG_CSS);
    #endif
 
-    xml_open_tag(&ctx, "title");
-    xml_escaped(&ctx, BLOG_TITLE);
+    xml_open_tag(ctx, "title");
+    xml_escaped(ctx, BLOG_TITLE);
     if(data.page_type == PAGE_TYPE_ENTRY) {
-       xml_escaped(&ctx, ": ");
-       xml_escaped(&ctx, data.entry->title);
+       xml_escaped(ctx, ": ");
+       xml_escaped(ctx, data.entry->title);
     } else if(data.page_type == PAGE_TYPE_ERROR) {
-       xml_escaped(&ctx, ": error");
+       xml_escaped(ctx, ": error");
     }
-    xml_close_tag(&ctx, "title");
+    xml_close_tag(ctx, "title");
 
-    xml_close_tag(&ctx, "head");
+    xml_close_tag(ctx, "head");
 
-    xml_open_tag(&ctx, "body");
-    xml_open_tag(&ctx, "header");
-    xml_open_tag(&ctx, "h1");
+    xml_open_tag(ctx, "body");
+    xml_open_tag(ctx, "header");
+    xml_open_tag(ctx, "h1");
     if(data.page_type != PAGE_TYPE_INDEX) {
       char *index;
       if(data.script_name == NULL || data.script_name[0] == '\0') {
@@ -66,91 +119,157 @@ void template_header(struct template_data data) {
         index = data.script_name;
       }
 
-      xml_open_tag_attrs(&ctx, "a", 1, "href", index);
+      xml_open_tag_attrs(ctx, "a", 1, "href", index);
     }
-    xml_escaped(&ctx, BLOG_TITLE);
-    xml_close_including(&ctx, "header");
+    xml_escaped(ctx, BLOG_TITLE);
+    xml_close_including(ctx, "header");
 
-    xml_open_tag(&ctx, "main");
+    xml_open_tag(ctx, "main");
 }
 
 void template_footer(struct template_data data) {
-    xml_close_tag(&ctx, "main");
+    struct xml_context *ctx = data.request->template_state;
+
+    if(ctx == NULL) {
+        return;
+    }
 
-    xml_open_tag(&ctx, "footer");
+    xml_close_tag(ctx, "main");
+
+    xml_open_tag(ctx, "footer");
 
     char *rss_link = catn_alloc(2, data.script_name, "/rss.xml");
     char *atom_link = catn_alloc(2, data.script_name, "/atom.xml");
 
     if(rss_link != NULL) {
-        xml_open_tag_attrs(&ctx, "a", 1, "href", rss_link);
-        xml_escaped(&ctx, "RSS Feed");
-        xml_close_tag(&ctx, "a");
+        xml_open_tag_attrs(ctx, "a", 1, "href", rss_link);
+        xml_escaped(ctx, "RSS Feed");
+        xml_close_tag(ctx, "a");
 
         free(rss_link);
     }
 
     if(atom_link != NULL) {
-        xml_raw(&ctx, " &bull; ");
+        xml_raw(ctx, " &bull; ");
 
-        xml_open_tag_attrs(&ctx, "a", 1, "href", atom_link);
-        xml_escaped(&ctx, "Atom Feed");
-        xml_close_tag(&ctx, "a");
+        xml_open_tag_attrs(ctx, "a", 1, "href", atom_link);
+        xml_escaped(ctx, "Atom Feed");
+        xml_close_tag(ctx, "a");
 
         free(atom_link);
     }
 
-    xml_close_all(&ctx);
+#if BLOG_SEARCH
+    char *search_link = catn_alloc(2, data.script_name, "/search");
+
+    if(search_link != NULL) {
+        // keep the query of a search in the search field
+        char *query = data.page_type == PAGE_TYPE_INDEX && strcmp(data.path_info, "/search") == 0
+            ? query_param(data.request->query_string, "q") : NULL;
+
+        xml_open_tag_attrs(ctx, "form", 2, "action", search_link, "method", "get");
+        xml_empty_tag(ctx, "input", 4,
+                      "type", "search",
+                      "name", "q",
+                      "value", query == NULL ? "" : query,
+                      "placeholder", "Search");
+        xml_close_tag(ctx, "form");
 
-    del_xml_context(&ctx);
+        free(query);
+        free(search_link);
+    }
+#endif
+
+    xml_close_all(ctx);
+
+    del_xml_context(ctx);
+    free(ctx);
+    data.request->template_state = NULL;
 }
 
 void template_main(struct template_data data) {
+    struct xml_context *ctx = data.request->template_state;
+
+    if(ctx == NULL) {
+        return;
+    }
+
     if(data.page_type == PAGE_TYPE_ERROR) {
-       xml_open_tag_attrs(&ctx, "div", 1, "class", "error-page");
-       xml_open_tag(&ctx, "h2");
-       xml_escaped(&ctx, "An error occured while handling your request");
-       xml_close_tag(&ctx, "h2");
+       xml_open_tag_attrs(ctx, "div", 1, "class", "error-page");
+       xml_open_tag(ctx, "h2");
+       xml_escaped(ctx, "An error occured while handling your request");
+       xml_close_tag(ctx, "h2");
 
-       xml_open_tag_attrs(&ctx, "div", 1, "class", "content");
-       xml_open_tag(&ctx, "p");
+       xml_open_tag_attrs(ctx, "div", 1, "class", "content");
+       xml_open_tag(ctx, "p");
 
        if(data.status == 500) {
-          xml_escaped(&ctx, "Something is wrong with this application and/or its server (error 500).");
+          xml_escaped(ctx, "Something is wrong with this application and/or its server (error 500).");
        } else if(data.status == 404) {
-          xml_escaped(&ctx, "What you requested doesn't exist (error 404).");
+          xml_escaped(ctx, "What you requested doesn't exist (error 404).");
        } else {
-          xml_escaped(&ctx, "The error encoutered is: ");
-          xml_escaped(&ctx, http_status_line(data.status));
+          xml_escaped(ctx, "The error encoutered is: ");
+          xml_escaped(ctx, http_status_line(data.status));
        }
 
-       xml_close_tag(&ctx, "p");
-       xml_close_tag(&ctx, "div");
-       xml_close_tag(&ctx, "div");
+       xml_close_tag(ctx, "p");
+       xml_close_tag(ctx, "div");
+       xml_close_tag(ctx, "div");
     } else {
 
-       xml_open_tag(&ctx, "article");
+       xml_open_tag(ctx, "article");
 
-       xml_open_tag(&ctx, "h2");
+       xml_open_tag(ctx, "h2");
        if(data.page_type == PAGE_TYPE_INDEX) {
-          xml_open_tag_attrs(&ctx, "a", 1, "href", data.entry->link);
+          xml_open_tag_attrs(ctx, "a", 1, "href", data.entry->link);
        }
-       xml_escaped(&ctx, data.entry->title);
-       xml_close_including(&ctx, "h2");
+       xml_escaped(ctx, data.entry->title);
+       xml_close_including(ctx, "h2");
 
        if(data.entry->text_size > 0) {
-          xml_open_tag_attrs(&ctx, "div", 1, "class", "content");
-          xml_raw(&ctx, data.entry->text);
-          xml_close_tag(&ctx, "div");
+          xml_open_tag_attrs(ctx, "div", 1, "class", "content");
+          markdown_entry_text(ctx, data.entry);
+          xml_close_tag(ctx, "div");
+       }
+
+       if(data.entry->text_excerpt) {
+          xml_open_tag_attrs(ctx, "p", 1, "class", "more");
+          xml_open_tag_attrs(ctx, "a", 1, "href", data.entry->link);
+          xml_escaped(ctx, "Continue reading");
+          xml_close_including(ctx, "p");
        }
 
-       xml_open_tag_attrs(&ctx, "div", 1, "class", "meta");
+       xml_open_tag_attrs(ctx, "div", 1, "class", "meta");
 
        // modification time
-       xml_open_tag_attrs(&ctx, "p", 1, "class", "mtime");
-       output_entry_time(&ctx, *data.entry);
-       xml_close_tag(&ctx, "p");
+       xml_open_tag_attrs(ctx, "p", 1, "class", "mtime");
+#if BLOG_ARCHIVE
+       // links to the archive of the month
+       char month[MAX_TIMESTR_SIZE];
+       char *archive_link = NULL;
+
+       if(flocaltime(month, ARCHIVE_TIME_FORMAT, sizeof(month), &data.entry->time) > 0) {
+          archive_link = catn_alloc(3, data.script_name, "/archive/", month);
+       }
+
+       if(archive_link != NULL) {
+          xml_open_tag_attrs(ctx, "a", 1, "href", archive_link);
+          output_entry_time(ctx, *data.entry);
+          xml_close_tag(ctx, "a");
+
+          free(archive_link);
+       } else {
+          output_entry_time(ctx, *data.entry);
+       }
+#else
+       output_entry_time(ctx, *data.entry);
+#endif
+       xml_close_tag(ctx, "p");
+
+#if BLOG_ARCHIVE
+       output_entry_tags(ctx, data.script_name, data.entry);
+#endif
 
-       xml_close_including(&ctx, "article");
+       xml_close_including(ctx, "article");
     }
 }